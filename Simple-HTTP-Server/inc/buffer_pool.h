@@ -0,0 +1,33 @@
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <map>
+#include <vector>
+
+#include "locker.h"
+
+/*
+     緩衝區池：
+         依大小分級回收重用緩衝區，讀取緩衝區擴充時從池中取得，
+         連線恢復到小緩衝區後歸還，避免大請求反覆配置與釋放記憶體
+*/
+class buffer_pool
+{
+public:
+     /* 取得一塊size大小的緩衝區 */
+     static char *acquire(int size);
+     /* 歸還緩衝區，size需與取得時相同 */
+     static void release(char *buf, int size);
+
+private:
+     buffer_pool();
+     ~buffer_pool();
+
+private:
+     /* 每一級最多保留的空閒緩衝區數量，超過則直接釋放 */
+     static const int MAX_FREE_PER_SIZE = 64;
+     static std::map<int, std::vector<char *>> m_free; // 依大小分級的空閒緩衝區
+     static locker m_mutex; // 保護m_free
+};
+
+#endif
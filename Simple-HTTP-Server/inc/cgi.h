@@ -0,0 +1,121 @@
+#ifndef __CGI_H__
+#define __CGI_H__
+
+#include <sys/types.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "locker.h"
+#include "http_conn.h"
+#include "cgi_cache.h"
+
+/*
+     非同步執行的cgi程式：
+         執行緒池只負責啟動子程序（或連線到FastCGI worker），不等待其結束；
+         stdin/stdout的pipe與子程序的pidfd以非阻塞方式註冊到主執行緒的epoll，
+         由主執行緒寫入請求內容、讀取輸出並回收子程序；
+         輸出開頭的標頭區塊解析後，輸出一邊讀取一邊交給等待中的連線（http_conn::cgi_output），
+         連線尚未寫出的輸出超過上限時暫停讀取，直到片段寫出釋放；
+         超過時間上限的子程序以SIGKILL結束，尚未送出標頭時回覆504；
+         相同腳本與相同輸入的並發請求在送出第一段輸出前可共用一次執行
+         設定快取的腳本成功結束後，完整的輸出存入cgi_cache；
+         超過讀取緩衝區的請求內容由連線邊收邊送入（stream、feed），累積過多時連線暫停讀取，寫入子程序後再恢復
+*/
+class cgi
+{
+public:
+     /* 已交給連線但尚未寫出的輸出上限，單一片段的上限，與標頭區塊的上限（HTTP/2需能放入寫入緩衝區） */
+     static const size_t MAX_PENDING = 256 * 1024;
+     static const size_t MAX_PIECE = 64 * 1024;
+     static const size_t MAX_HEAD = 1024;
+     /* 連線串流送入、尚未寫入子程序的請求內容上限 */
+     static const size_t MAX_STDIN = 256 * 1024;
+
+     /* 建立逾時檢查的計時器並註冊到epoll，需在開始服務前呼叫；timeout為單一cgi程式的時間上限（秒） */
+     static bool init(int epollfd, int max_fd, int timeout);
+     /*
+         執行file，content為標準輸入；pool不為0時交給FastCGI程式池
+         輸出以conn->cgi_output(id, stream, 片段)依序送達，stream為HTTP/2串流編號（HTTP/1.1為0）
+         cache不為0時成功的輸出以cache_key存入cgi_cache，同時執行中的相同請求（腳本、內容與快取鍵）共用一次執行；
+         cache為0時每個請求各自執行；conn為0時為快取的背景更新，沒有等待的連線
+         傳回值：無法啟動時為false
+     */
+     static bool run(http_conn *conn, unsigned long id, int stream, const std::string &file, const std::string &content,
+                     fastcgi_pool *pool, const std::string &cache_key = std::string(),
+                     const cgi_cache::policy *cache = 0);
+     /*
+         與run相同，但請求內容尚未收完：content為已收到的部分，content_length為總長度，
+         其餘內容由連線以feed依序送入；不與其他請求共用執行，也不使用快取
+         傳回值：送入內容用的通道，無法啟動時為空
+     */
+     static std::shared_ptr<cgi_input> stream(http_conn *conn, unsigned long id, const std::string &file,
+                                              const std::string &content, size_t content_length, fastcgi_pool *pool);
+     /*
+         送入一段請求內容，last表示已全部收到；子程序不再讀取或已結束時內容直接丟棄
+         傳回值：累積的內容已達MAX_STDIN時為false，連線需暫停讀取，內容寫入子程序後以conn->cgi_resume(id)恢復
+     */
+     static bool feed(const std::shared_ptr<cgi_input> &in, const char *data, size_t len, bool last, http_conn *conn,
+                      unsigned long id);
+     /* 連線中斷：不再送入內容，子程序的標準輸入在已收到的內容之後結束 */
+     static void close_input(const std::shared_ptr<cgi_input> &in);
+     /* 主執行緒：fd屬於cgi（pipe、pidfd、FastCGI連線或計時器）時處理事件並傳回true */
+     static bool handle(int fd, unsigned int events);
+     /*
+         解析輸出開頭的標頭區塊，設定piece的狀態碼與轉送的標頭，body_start為訊息體的起點
+         傳回值：需要更多輸出時為false（eof時一定為true）
+     */
+     static bool parse_head(const std::string &buf, bool eof, http_conn::cgi_result &piece, size_t &body_start);
+
+private:
+     struct waiter
+     {
+         http_conn *conn;
+         unsigned long id;
+         int stream;
+     };
+     struct job;
+     struct flow;
+     struct release;
+     friend struct cgi_input;
+
+     cgi();
+     ~cgi();
+
+     static bool launch(job *j, const waiter *w, const std::string &file, const std::string &content,
+                        size_t content_length, fastcgi_pool *pool);
+     static bool spawn(job *j, const std::string &file, size_t content_length);
+     static std::shared_ptr<http_conn::cgi_result> make_piece(job *j);
+     static bool paused(job *j, size_t extra);
+     static void output(job *j, std::string &data);
+     static void deliver(job *j, const std::shared_ptr<http_conn::cgi_result> &piece);
+     static void remember(job *j, const http_conn::cgi_result &piece);
+     static void watch(int fd, unsigned int events, job *j);
+     static void unwatch(int &fd);
+     static void pump_input(job *j);
+     static bool take_input(job *j);
+     static void detach_input(job *j);
+     static void kick_input(job *j);
+     static void pump_output(job *j);
+     static void reap(job *j);
+     static bool finished(const job *j);
+     static void complete(job *j);
+     static void check_timeouts();
+
+private:
+     static int m_epollfd;
+     static int m_timer_fd;
+     static int m_timeout;
+     /* fd對應的工作，由執行緒池在註冊到epoll前寫入，主執行緒在關閉fd前清除 */
+     static std::vector<job *> m_fds;
+     /* 執行中的工作與可加入的相同請求，受m_lock保護 */
+     static locker m_lock;
+     static std::list<job *> m_jobs;
+     static std::map<std::string, job *> m_flight;
+     /* 啟動時複製的環境變數，不含CONTENT_LENGTH */
+     static std::vector<std::string> m_env;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __CGI_CACHE_H__
+#define __CGI_CACHE_H__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "locker.h"
+#include "http_conn.h"
+
+/*
+     cgi輸出快取：
+         只快取啟動時設定過的腳本，快取鍵由URL、設定的請求標頭與訊息體的SHA-256組成；
+         在TTL內命中時直接以完整的回應回覆，不啟動任何程式；
+         過期後的stale秒內仍回覆舊的輸出，並只讓第一個請求在背景重新執行一次（stale-while-revalidate）
+*/
+class cgi_cache
+{
+public:
+     /* 單一腳本的快取設定 */
+     struct policy
+     {
+         int ttl; // 快取有效秒數
+         int stale; // 過期後仍可回覆舊輸出的秒數
+         std::vector<std::string> vary; // 計入快取鍵的請求標頭，名稱為小寫
+     };
+
+     /* 設定file（cgi程式的完整路徑）的快取，需在開始服務前呼叫 */
+     static void configure(const std::string &file, int ttl, int stale,
+                           const std::vector<std::string> &vary = std::vector<std::string>());
+     /* 取得file的快取設定，未設定時傳回0 */
+     static const policy *find(const std::string &file);
+     /* 快取鍵：url + '\0' + 各標頭的值（各以'\0'結尾） + 訊息體的SHA-256 */
+     static std::string key(const std::string &url, const std::vector<const char *> &values, const char *body,
+                            size_t len);
+     /*
+         查詢快取，未命中時傳回空指標
+         已過期但仍在stale期間時傳回舊的輸出，並在尚無請求負責更新時將refresh設為true，由呼叫方在背景重新執行
+     */
+     static std::shared_ptr<http_conn::cgi_result> lookup(const std::string &key, bool &refresh);
+     /* 儲存完整的輸出（同時是第一段與最後一段） */
+     static void store(const std::string &key, const policy &p, const std::shared_ptr<http_conn::cgi_result> &result);
+     /* 背景更新失敗或輸出不可快取，讓之後的請求可以再次更新 */
+     static void abandon(const std::string &key);
+
+     /* 單一輸出可快取的上限 */
+     static const size_t MAX_SIZE = 1024 * 1024;
+
+private:
+     cgi_cache();
+     ~cgi_cache();
+
+     static void evict(time_t now);
+
+private:
+     /* 最多快取的輸出數量，達上限時由evict騰出位置 */
+     static const size_t MAX_ENTRIES = 1024;
+
+     struct entry
+     {
+         std::shared_ptr<http_conn::cgi_result> result;
+         time_t expire; // 過期時間
+         time_t stale_until; // 之後不再回覆舊的輸出
+         bool refreshing; // 已有請求在背景更新
+     };
+
+     /* 啟動時設定，之後唯讀 */
+     static std::map<std::string, policy> m_policies;
+     static std::map<std::string, entry> m_entries;
+     static locker m_mutex; // 保護m_entries
+};
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __CHUNKED_H__
+#define __CHUNKED_H__
+
+#include <stddef.h>
+
+/*
+     chunked訊息體（RFC 9112 7.1）的增量解碼器：
+         逐段輸入原始資料，輸出去除分段格式後的內容，狀態保存在物件中，資料可在任意位置切開；
+         輸出可寫回輸入所在的緩衝區（就地解碼），讀取緩衝區與上傳的暫存區共用同一套解碼
+*/
+class chunked_decoder
+{
+public:
+     /* decode的結果 */
+     enum STATUS
+     {
+         MORE = 0, // 輸入已全部處理，訊息體尚未結束
+         DONE, // 訊息體（含trailer）已結束，consumed之後的資料屬於下一個請求
+         BAD // 格式錯誤
+     };
+
+     /* 大小行（含擴充參數）與trailer單行的長度上限 */
+     static const int MAX_LINE = 4096;
+
+public:
+     chunked_decoder()
+     {
+         reset();
+     };
+     ~chunked_decoder(){};
+
+     /* 回到訊息體開頭的狀態 */
+     void reset();
+     /*
+         解碼in的len位元組，內容依序寫入out，out可與in相同或在in之前
+         consumed設為處理的輸入位元組數（DONE時可能小於len），out_len設為輸出的位元組數
+     */
+     STATUS decode(const char *in, size_t len, char *out, size_t &consumed, size_t &out_len);
+     /* 目前chunk尚未收到的資料長度，不在資料區時為0 */
+     unsigned long long remaining() const
+     {
+         return m_state == DATA ? m_size : 0;
+     }
+
+private:
+     /* 解碼所處的位置 */
+     enum STATE
+     {
+         SIZE = 0, // 十六進位的chunk大小
+         EXT, // 大小之後的擴充參數，略過到\r
+         SIZE_LF, // 大小行結尾的\n
+         DATA, // chunk資料
+         DATA_CR, // 資料之後的\r
+         DATA_LF, // 資料之後的\n
+         TRAILER_START, // trailer的一行開頭，\r表示結束
+         TRAILER, // trailer標頭，略過到\r
+         TRAILER_LF, // trailer一行結尾的\n
+         END_LF, // 訊息體最後的\n
+         FINISHED,
+         FAILED
+     };
+
+private:
+     STATE m_state;
+     unsigned long long m_size; // 大小行中已讀到的值，或資料區剩餘的長度
+     int m_digits; // 大小行中的位數
+     int m_line_len; // 目前一行已讀的長度
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __FASTCGI_H__
+#define __FASTCGI_H__
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+     FastCGI（responder角色）程式池：
+         伺服器建立監聽的Unix socket，依FastCGI的慣例以fd 0交給常駐的worker程式，
+         每個請求建立一條新連線，由當時閒置的worker接受，不必為每個請求fork與載入直譯器；
+         worker結束時由監控執行緒重新啟動，期間的請求在監聽佇列中等待
+*/
+class fastcgi_pool
+{
+public:
+     typedef std::vector<std::pair<std::string, std::string>> param_list;
+
+     /* 記錄類型 */
+     enum RECORD_TYPE
+     {
+         BEGIN_REQUEST = 1,
+         ABORT_REQUEST = 2,
+         END_REQUEST = 3,
+         PARAMS = 4,
+         STDIN = 5,
+         STDOUT = 6,
+         STDERR = 7
+     };
+
+     static const int VERSION_1 = 1;
+     static const int RESPONDER = 1;
+     static const int HEADER_LEN = 8;
+     static const int MAX_CONTENT = 65535;
+
+public:
+     /* argv為worker程式與參數 */
+     fastcgi_pool(const std::vector<std::string> &argv, int workers);
+     ~fastcgi_pool();
+
+     /* 建立監聽socket、啟動worker與監控執行緒，需在開始服務前呼叫 */
+     bool start();
+     /*
+         連線到worker並將請求編碼為記錄存入msg，之後由呼叫方以非阻塞方式送出與讀取回應
+         last為false時訊息體尚未收完，不送出結束STDIN的空記錄，其餘內容之後以add_stdin加入
+         傳回值：非阻塞的socket，無法連線時為-1
+     */
+     int begin(const param_list &params, const char *body, size_t len, std::string &msg, bool last = true);
+     /* 將一段訊息體編碼為STDIN記錄附加到out，len為0時為結束的空記錄 */
+     static void add_stdin(std::string &out, const char *data, size_t len);
+     /*
+         解碼in中完整的記錄，STDOUT的內容附加到out，已處理的記錄從in移除
+         傳回值：收到END_REQUEST時為true，app_status設為worker的結束碼
+     */
+     static bool parse(std::string &in, std::string &out, unsigned int &app_status);
+
+private:
+     void spawn(int slot);
+     static void *monitor(void *arg);
+     static void put_header(std::string &out, int type, int length, int padding);
+     static void put_record(std::string &out, int type, const char *data, size_t len);
+     static void put_length(std::string &out, size_t len);
+
+private:
+     std::vector<std::string> m_argv;
+     std::vector<char *> m_exec_argv; // fork前備好的execv參數，子程序中不再配置記憶體
+     int m_workers;
+     std::vector<pid_t> m_pids;
+     std::vector<time_t> m_started; // 每個worker的啟動時間，短時間內反覆結束時延後重啟
+     int m_listen_fd;
+     sockaddr_un m_addr;
+     socklen_t m_addr_len;
+     int m_max_fd; // 子程序需關閉的fd上限
+};
+
+#endif
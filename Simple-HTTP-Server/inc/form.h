@@ -0,0 +1,115 @@
+#ifndef __FORM_H__
+#define __FORM_H__
+
+#include <map>
+#include <string>
+
+/*
+     應用程式接收表單的介面，每個請求建立一個實例，回應送出前刪除
+     所有函數都在處理該連線的執行緒池執行緒中呼叫
+*/
+class form_handler
+{
+public:
+     virtual ~form_handler(){};
+     /* 一般欄位：urlencoded的每一組，或multipart中沒有filename的部分（已解碼） */
+     virtual void on_field(const std::string &name, const std::string &value){};
+     /* 檔案部分開始，內容之後以on_file_data分段送出，不會整個保存在記憶體中 */
+     virtual void on_file_begin(const std::string &name, const std::string &filename, const std::string &content_type){};
+     virtual void on_file_data(const char *data, size_t len){};
+     virtual void on_file_end(){};
+     /* 訊息體完整解析後呼叫，body為回應內容 */
+     virtual void on_complete(std::string &body) = 0;
+     /* 回應的Content-Type */
+     virtual const char *content_type() const
+     {
+         return "text/html; charset=utf-8";
+     };
+};
+
+/* 建立處理一個請求的form_handler */
+typedef form_handler *(*form_factory)();
+
+/*
+     表單處理器註冊：POST到已註冊路徑的表單不交給cgi，改由處理器在行程內處理
+*/
+class form
+{
+public:
+     /* 註冊path的處理器，需在開始服務前呼叫 */
+     static void add_handler(const std::string &path, form_factory factory);
+     /* 取得path的處理器，沒有時傳回0 */
+     static form_factory find_handler(const char *path);
+
+private:
+     form();
+     ~form();
+
+private:
+     static std::map<std::string, form_factory> m_handlers;
+};
+
+/*
+     串流表單解析器：
+         支援application/x-www-form-urlencoded與multipart/form-data，訊息體可分成任意大小的片段依序送入，
+         只保留未完成的欄位與不足一個分隔線長度的資料，記憶體用量與訊息體大小無關
+*/
+class form_parser
+{
+public:
+     /* 單一一般欄位（名稱或值）的長度上限 */
+     static const size_t MAX_FIELD_SIZE = 64 * 1024;
+     /* multipart每個部分標頭的長度上限 */
+     static const size_t MAX_PART_HEADER = 8 * 1024;
+
+public:
+     /* 取得handler的擁有權 */
+     form_parser(form_handler *handler);
+     ~form_parser();
+     /* 依Content-Type決定格式，不支援的類型或缺少boundary時傳回false */
+     bool init(const char *content_type);
+     /* 送入下一段訊息體，格式錯誤或超過上限時傳回false，之後不可再呼叫 */
+     bool feed(const char *data, size_t len);
+     /* 訊息體結束，multipart尚未遇到結束分隔線時傳回false */
+     bool finish();
+     form_handler *handler() const { return m_handler; }
+
+private:
+     enum TYPE
+     {
+         URLENCODED,
+         MULTIPART
+     };
+     enum STATE
+     {
+         URL_NAME, // urlencoded名稱
+         URL_VALUE, // urlencoded值
+         PART_PREAMBLE, // 第一個分隔線之前
+         PART_DELIMITER, // 分隔線之後的"--"或\r\n
+         PART_HEADER, // 部分的標頭
+         PART_DATA, // 部分的內容
+         PART_END // 結束分隔線之後
+     };
+
+     bool feed_urlencoded(const char *data, size_t len);
+     bool feed_multipart(const char *data, size_t len);
+     void url_field();
+     bool part_header(const char *line, size_t len);
+     bool part_data(const char *data, size_t len);
+     void part_end();
+
+private:
+     form_handler *m_handler;
+     TYPE m_type;
+     STATE m_state;
+     std::string m_name; // 目前欄位的名稱
+     std::string m_value; // 目前一般欄位的值
+     std::string m_delimiter; // "\r\n--" + boundary
+     std::string m_pending; // 尚未處理的資料
+     std::string m_filename;
+     std::string m_content_type;
+     bool m_has_name; // 部分標頭帶有Content-Disposition: form-data; name=
+     bool m_is_file; // 部分標頭帶有filename
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __HEAD_SCANNER_H__
+#define __HEAD_SCANNER_H__
+
+#include <stddef.h>
+
+/*
+     請求頭掃描器：
+         以SIMD一次比對16/32個位元組，建立請求頭的結構索引（行尾與分隔字元的偏移），以及尋找URL中需要處理的字元，
+         啟動時依CPU支援的指令集選擇AVX2、SSE4.2或逐位元組的實作
+*/
+class head_scanner
+{
+public:
+     /*
+         結構索引：單次掃描p開始n個位元組，依序將\r、\n、空白、\t與:的偏移寫入out，最多max個
+         傳回寫入的數量；scanned為已掃描的長度，out寫滿時停在最後一個偏移之後，下次從該處接著掃描
+     */
+     static size_t index(const char *p, size_t n, int *out, size_t max, size_t &scanned)
+     {
+         return m_index(p, n, out, max, scanned);
+     }
+
+     /*
+         傳回URL路徑p開始n個位元組中第一個需要解碼或正規化的位置：
+         %、?、#，或後面接著/或.的/；不需要處理時傳回n。p[n]必須可讀（字串結尾的\0）
+     */
+     static size_t find_url_special(const char *p, size_t n)
+     {
+         return m_find_url(p, n);
+     }
+
+     /* 目前使用的實作名稱 */
+     static const char *impl_name();
+
+private:
+     head_scanner();
+     ~head_scanner();
+
+     typedef size_t (*index_func)(const char *p, size_t n, int *out, size_t max, size_t &scanned);
+     typedef size_t (*find_url_func)(const char *p, size_t n);
+     static index_func select_impl();
+     static find_url_func select_url_impl();
+
+private:
+     static index_func m_index; // 結構索引的實作
+     static find_url_func m_find_url; // 尋找URL特殊字元的實作
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+     HPACK（RFC 7541）標頭壓縮：
+         解碼端維護連線的動態表並支援Huffman字串；
+         編碼端只輸出「不加入索引、名稱引用靜態表」的字面值，不需要維護動態表
+*/
+class hpack
+{
+public:
+     typedef std::vector<std::pair<std::string, std::string>> header_list;
+
+     /* 常用回應標頭在靜態表中的索引 */
+     enum STATIC_INDEX
+     {
+         IDX_STATUS = 8,
+         IDX_ALLOW = 22,
+         IDX_CONTENT_LENGTH = 28,
+         IDX_CONTENT_TYPE = 31,
+         IDX_DATE = 33,
+         IDX_LOCATION = 46
+     };
+
+     /* 動態表預設大小（SETTINGS_HEADER_TABLE_SIZE） */
+     static const size_t DEFAULT_TABLE_SIZE = 4096;
+
+public:
+     hpack() : m_size(0), m_max_size(DEFAULT_TABLE_SIZE){};
+     ~hpack(){};
+
+     /*
+         解碼一個完整的標頭區塊，依序加入headers
+         傳回值：成功true；格式錯誤false，呼叫方需以COMPRESSION_ERROR結束連線
+     */
+     bool decode(const unsigned char *data, size_t len, header_list &headers);
+
+     /* 編碼:status，傳回寫入的位元組數 */
+     static int encode_status(char *out, int status);
+     /* 以靜態表索引為名稱編碼一個標頭，傳回寫入的位元組數，out至少需len + 8位元組 */
+     static int encode_header(char *out, int name_index, const char *value, size_t len);
+     /* 以字面值名稱（需為小寫）編碼一個標頭，傳回寫入的位元組數，out至少需name_len + len + 16位元組 */
+     static int encode_literal(char *out, const char *name, size_t name_len, const char *value, size_t len);
+
+private:
+     bool decode_int(const unsigned char *&p, const unsigned char *end, int prefix, unsigned long &v);
+     bool decode_string(const unsigned char *&p, const unsigned char *end, std::string &s);
+     bool lookup(unsigned long index, std::pair<std::string, std::string> &field);
+     void insert(const std::pair<std::string, std::string> &field);
+     void evict(size_t limit);
+     static bool huffman_decode(const unsigned char *p, size_t len, std::string &s);
+     static int encode_int(char *out, int prefix, unsigned char first, unsigned long v);
+
+private:
+     std::deque<std::pair<std::string, std::string>> m_dynamic; // 動態表，最新的在前
+     size_t m_size; // 動態表目前大小（每項為名稱+值+32）
+     size_t m_max_size; // 動態表目前上限
+};
+
+#endif
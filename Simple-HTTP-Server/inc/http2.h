@@ -0,0 +1,157 @@
+#ifndef __HTTP2_H__
+#define __HTTP2_H__
+
+#include <map>
+#include <deque>
+#include <string>
+#include <memory>
+#include "hpack.h"
+
+/*
+     串流式回應（cgi輸出）中尚未送出的後續片段
+*/
+struct http2_chunk
+{
+     const char *data;
+     size_t len;
+     std::shared_ptr<void> ref;
+};
+
+/*
+     HTTP/2（RFC 7540）串流：一個請求與其回應
+*/
+struct http2_stream
+{
+     int id;
+     bool end_stream; // 已收到END_STREAM，請求完整
+     bool too_large; // 訊息體超過讀取緩衝區上限
+     bool responded; // 已送出回應的HEADERS
+     long send_window; // 串流層級的傳送窗口
+     long recv_window; // 串流層級的接收窗口，本端不變更初始窗口，固定從預設的65535開始
+     std::string method;
+     std::string path;
+     std::string body;
+     std::string content_type;
+     hpack::header_list headers; // 虛擬標頭以外的請求標頭，名稱為小寫
+     const char *data; // 尚未送出的回應訊息體
+     size_t left;
+     std::shared_ptr<void> ref; // 回應訊息體的持有者（檔案映射或cgi輸出）
+     bool streaming; // 訊息體仍在產生中，送完目前的資料後不結束串流
+     std::deque<http2_chunk> chunks; // 目前資料之後的片段
+     http2_stream(int stream_id, long window) : id(stream_id), end_stream(false), too_large(false), responded(false),
+                                                send_window(window), recv_window(65535), data(0), left(0),
+                                                streaming(false){};
+};
+
+/*
+     HTTP/2連線狀態，由http_conn在收到連線前言或h2c升級後建立
+*/
+struct http2_session
+{
+     /* 訊框類型 */
+     enum FRAME_TYPE
+     {
+         DATA = 0,
+         HEADERS,
+         PRIORITY,
+         RST_STREAM,
+         SETTINGS,
+         PUSH_PROMISE,
+         PING,
+         GOAWAY,
+         WINDOW_UPDATE,
+         CONTINUATION
+     };
+
+     /* 訊框旗標 */
+     enum FRAME_FLAG
+     {
+         FLAG_END_STREAM = 0x1,
+         FLAG_ACK = 0x1,
+         FLAG_END_HEADERS = 0x4,
+         FLAG_PADDED = 0x8,
+         FLAG_PRIORITY = 0x20
+     };
+
+     /* 錯誤碼 */
+     enum ERROR_CODE
+     {
+         NO_ERROR = 0,
+         PROTOCOL_ERROR,
+         INTERNAL_ERROR,
+         FLOW_CONTROL_ERROR,
+         SETTINGS_TIMEOUT,
+         STREAM_CLOSED,
+         FRAME_SIZE_ERROR,
+         REFUSED_STREAM,
+         CANCEL,
+         COMPRESSION_ERROR
+     };
+
+     /* SETTINGS參數 */
+     enum SETTING_ID
+     {
+         SETTINGS_HEADER_TABLE_SIZE = 1,
+         SETTINGS_ENABLE_PUSH,
+         SETTINGS_MAX_CONCURRENT_STREAMS,
+         SETTINGS_INITIAL_WINDOW_SIZE,
+         SETTINGS_MAX_FRAME_SIZE,
+         SETTINGS_MAX_HEADER_LIST_SIZE
+     };
+
+     /* 訊框標頭長度 */
+     static const int FRAME_HEADER_LEN = 9;
+     /* 連線前言"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"的長度 */
+     static const int PREFACE_LEN = 24;
+     /* 預設（也是本端接受）的最大訊框大小 */
+     static const int DEFAULT_MAX_FRAME_SIZE = 16384;
+     /* 預設窗口大小 */
+     static const long DEFAULT_WINDOW = 65535;
+     /* 窗口上限 2^31-1 */
+     static const long MAX_WINDOW = 0x7fffffff;
+     /* 本端允許的同時串流數 */
+     static const int MAX_CONCURRENT_STREAMS = 100;
+
+     bool preface_done; // 已收到客戶端連線前言
+     bool closing; // 已送出GOAWAY，寫完後關閉連線
+     bool goaway; // 已收到客戶端的GOAWAY，不再接受新串流
+     int last_stream_id; // 已接受的最大串流編號
+     int continuation_stream; // 等待CONTINUATION的串流，0表示沒有
+     bool block_end_stream; // 等待中的標頭區塊是否帶END_STREAM
+     std::string header_block; // 尚未結束的標頭區塊
+     long send_window; // 連線層級的傳送窗口
+     long recv_window; // 連線層級的接收窗口，尚未歸還給對方的部分
+     long initial_window; // 對方設定的串流初始窗口
+     int max_frame_size; // 對方接受的最大訊框大小
+     hpack decoder; // 請求標頭解碼器
+     std::map<int, http2_stream> streams; // 進行中的串流
+
+     http2_session() : preface_done(false), closing(false), goaway(false), last_stream_id(0), continuation_stream(0),
+                       block_end_stream(false), send_window(DEFAULT_WINDOW), recv_window(DEFAULT_WINDOW),
+                       initial_window(DEFAULT_WINDOW),
+                       max_frame_size(DEFAULT_MAX_FRAME_SIZE){};
+
+     /* 寫入9位元組的訊框標頭 */
+     static void put_frame_header(char *out, int len, int type, int flags, int stream_id)
+     {
+         out[0] = (len >> 16) & 0xff;
+         out[1] = (len >> 8) & 0xff;
+         out[2] = len & 0xff;
+         out[3] = type;
+         out[4] = flags;
+         put_uint32(out + 5, stream_id & MAX_WINDOW);
+     };
+     static void put_uint32(char *out, unsigned long v)
+     {
+         out[0] = (v >> 24) & 0xff;
+         out[1] = (v >> 16) & 0xff;
+         out[2] = (v >> 8) & 0xff;
+         out[3] = v & 0xff;
+     };
+     static unsigned long get_uint32(const unsigned char *p)
+     {
+         return ((unsigned long)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+     };
+};
+
+#endif
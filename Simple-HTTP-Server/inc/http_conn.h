@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,16 +22,50 @@
 #include "locker.h"
 #include <sys/uio.h>
 #include <sys/wait.h>
+#include <string>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include "singleflight.h"
+#include "http_headers.h"
+#include "chunked.h"
+#include "http2.h"
+#include "tls.h"
+#include "websocket.h"
+#include "sse.h"
+#include "form.h"
+#include "router.h"
+#include "fastcgi.h"
+#include "url.h"
+
+/* 串流送入cgi的請求內容（src/cgi.cpp） */
+struct cgi_input;
 
 class http_conn
 {
 public:
      /* 檔案名稱的最大長度 */
      static const int FILENAME_LEN = 200;
-     /* 讀取緩衝區大小 */
+     /* 連線內建讀取緩衝區大小，請求更大時從緩衝區池擴充 */
      static const int READ_BUFFER_SIZE = 2048;
      /* 寫入緩衝區大小 */
-     static const int WRITE_BUFFER_SIZE = 1024;
+     static const int WRITE_BUFFER_SIZE = 2048;
+     /* 一次批次寫出最多合併的回應數量 */
+     static const int MAX_BATCH_REQUESTS = 16;
+     /* 批次達到此位元組數後不再加入新的回應 */
+     static const int MAX_BATCH_BYTES = 64 * 1024;
+     /* 請求頭結構索引一次最多記錄的偏移數，與一行中最多記錄的空白位置數 */
+     static const int MAX_HEAD_MARKS = 32;
+     static const int MAX_LINE_SEPS = 8;
+     /* 推送佇列上限，超過時視為讀取過慢的客戶端並關閉連線 */
+     static const size_t MAX_PUSH_QUEUE = 1024;
+     static const size_t MAX_PUSH_BYTES = 4 * 1024 * 1024;
+     /* 串流訊息體（PUT上傳與表單）：socket到檔案之間的pipe大小，與單次處理的最大位元組數（之後讓出執行緒） */
+     static const int UPLOAD_PIPE_SIZE = 1024 * 1024;
+     static const long long UPLOAD_SLICE = 4 * 1024 * 1024;
+     /* chunked的PUT訊息體長度未知，收到最後一個chunk前m_upload_left維持此值 */
+     static const long long UPLOAD_CHUNKED = 0x7fffffffffffffffLL;
      /* HTTP請求方式 */
      enum METHOD
      {
@@ -64,10 +99,30 @@ public:
          FORBIDDEN_REQUEST,
          FILE_REQUEST,
          CGI_REQUEST,
+         OPTIONS_REQUEST,
          INTERNAL_ERROR, // 伺服器內部錯誤
+         ENTITY_TOO_LARGE, // 請求超過讀取緩衝區上限
+         HEADER_TOO_LARGE, // 請求行或標頭超過讀取緩衝區上限
+         WEBSOCKET_REQUEST, // WebSocket握手成功，回覆101後切換協定
+         SSE_REQUEST, // 訂閱SSE頻道，回覆事件串流標頭後保持開啟
+         UPLOAD_REQUEST, // PUT或表單的訊息體尚未收完，繼續從socket讀取
+         CREATED_REQUEST, // PUT建立了新檔案
+         UPDATED_REQUEST, // PUT取代了既有檔案
+         MOVED_REQUEST, // 路由重新導向（301）
+         FOUND_REQUEST, // 路由重新導向（302）
+         CGI_PENDING, // cgi已在背景執行，完成後才回應
+         GATEWAY_TIMEOUT, // cgi超過時間上限
+         METHOD_NOT_ALLOWED, // 方法有效但不支援（HTTP/2的PUT等），回覆405與Allow
          CLOSED_CONNECTION
      };
 
+     /* 推送連線的擁有狀態：BUSY時由主執行緒或執行緒池處理，IDLE時等待讀事件，推送需喚醒主執行緒 */
+     enum PUSH_STATE
+     {
+         PUSH_BUSY = 0,
+         PUSH_IDLE
+     };
+
      /* 行的讀取狀態 */
      enum LINE_STATUS
      {
@@ -76,8 +131,52 @@ public:
          LINE_OPEN // 尚未讀取到結尾
      };
 
+     /* 靜態檔案載入結果，透過single-flight在同時請求同一檔案的連線間共享 */
+     struct file_result
+     {
+         HTTP_CODE code; // 載入結果
+         struct stat st; // 檔案狀態
+         char *address; // mmap起始位置，最後一個持有者釋放時解除映射
+         file_result() : code(NO_RESOURCE), address(0){};
+         ~file_result()
+         {
+             if (address)
+             {
+                 munmap(address, st.st_size);
+             }
+         };
+     };
+
+     /*
+         cgi輸出的一段，同一次執行的各段依序交給所有等待的連線，交出後唯讀
+         第一段（head）帶有從cgi輸出解析出的狀態與標頭，最後一段（last）表示結束；
+         原生處理器與表單一次產生完整回應，同時是第一段與最後一段
+     */
+     struct cgi_result
+     {
+         HTTP_CODE code; // CGI_REQUEST；第一段為錯誤碼時以錯誤回應取代，標頭送出後才失敗時中斷回應
+         bool head;
+         bool last;
+         int status; // cgi的Status標頭，預設200
+         std::string reason;
+         std::string header_lines; // HTTP/1.1轉送的其他標頭，每行以\r\n結尾
+         std::vector<std::pair<std::string, std::string>> headers; // HTTP/2轉送的標頭，名稱為小寫
+         std::string output; // 此段的訊息體
+         cgi_result() : code(CGI_REQUEST), head(true), last(true), status(200), reason("OK"){};
+         /* 行程內產生的回應（端點、表單）沒有cgi標頭區塊，由此加入Content-Type */
+         void set_content_type(const char *type)
+         {
+             header_lines += "Content-Type: ";
+             header_lines += type;
+             header_lines += "\r\n";
+             headers.push_back(std::make_pair(std::string("content-type"), std::string(type)));
+         };
+     };
+
 public:
-     http_conn(){};
+     http_conn() : m_read_buf(m_read_inline), m_read_size(READ_BUFFER_SIZE), m_file_address(0), m_batch_count(0), m_ssl(0),
+                   m_push_enabled(false), m_push_wake(false), m_ws(0), m_sse(0),
+                   m_upload_fd(-1), m_form(0), m_upload_paused(false), m_cgi_running(0), m_h2_stream(0){};
      ~http_conn(){};
 
 public:
@@ -91,10 +190,40 @@ public:
      bool read();
      /* 非阻塞寫入操作 */
      bool write();
+     /* 在TLS埠接受的連線，建立SSL物件並開始握手 */
+     bool tls_accept();
+     /* TLS握手是否尚未完成 */
+     bool handshaking(){
+         return m_ssl && m_tls_handshake;
+     };
+     /* 產生共用的錯誤回應，啟動時呼叫一次 */
+     static void init_error_responses();
+     /* 回應寫完後緩衝區中是否還有待處理的pipeline請求 */
+     bool pipelined(){
+         return m_pipelined;
+     };
+     /* 連線代號，每次接受新連線時遞增，用來辨識fd被重複使用後的舊連線 */
+     unsigned long conn_id(){
+         return m_conn_id;
+     };
+     /* 將已編碼的資料排入連線的推送佇列，可在任何執行緒呼叫；連線已關閉或佇列溢位時傳回false */
+     bool push(unsigned long id, const std::shared_ptr<std::string> &data);
+     /* 主執行緒處理推送喚醒，傳回false時需關閉連線 */
+     bool push_wakeup();
+     /* 取出待喚醒的連線並清除eventfd */
+     static void take_wakeups(std::vector<http_conn *> &conns);
+     /* 主執行緒：背景執行的cgi產生一段輸出，id與連線不符（已關閉）時傳回false */
+     bool cgi_output(unsigned long id, int stream, const std::shared_ptr<cgi_result> &piece);
+     /* 主執行緒：串流送入cgi的訊息體已寫出，暫停讀取的連線繼續接收 */
+     void cgi_resume(unsigned long id);
 
 private:
      /* 初始化連線 */
      void init();
+     /* 保留pipeline資料並準備解析下一個請求 */
+     void next_request();
+     /* 格式錯誤，丟棄剩餘資料 */
+     void bad_request();
      /* 解析HTTP請求 */
      HTTP_CODE process_read();
      /* 填充HTTP應答 */
@@ -103,52 +232,168 @@ private:
      /* 解析請求 */
      HTTP_CODE parse_request_line(char *text);
      HTTP_CODE parse_headers(char *text);
+     void parse_connection(const char *value);
      HTTP_CODE parse_content(char *text);
-     HTTP_CODE do_request();
-     HTTP_CODE do_cgi_request();
-     http_conn::HTTP_CODE execute_cgi();
+     HTTP_CODE dispatch_request();
+     HTTP_CODE do_route();
+     void real_file(const char *root, const char *path);
+     HTTP_CODE do_request(const char *root, const char *path);
+     HTTP_CODE do_head_request(const char *root, const char *path);
+     static HTTP_CODE check_file(const struct stat &st);
+     bool add_error_response(HTTP_CODE ret);
+     static const char *error_body(HTTP_CODE code, int &status);
+     HTTP_CODE do_cgi_request(const char *root, const char *path, fastcgi_pool *pool = 0);
+     http_conn::HTTP_CODE execute_cgi(fastcgi_pool *pool);
+     HTTP_CODE stream_cgi(fastcgi_pool *pool);
+     const char *request_header(const char *name);
+     static std::shared_ptr<file_result> load_file(const std::string &file);
+     bool cgi_deliver();
+     bool cgi_has_room(const cgi_result &piece);
      char *get_line(){
          return m_read_buf + m_start_line;
      };
      LINE_STATUS parse_line();
+     HTTP_CODE parse_chunked();
+     /* 讀取緩衝區擴充與縮回 */
+     bool grow_read_buf();
+     void shrink_read_buf(int left);
+     void rebase_read_buf(char *buf);
 
      /* HTTP應答 */
      void unmap();
      bool add_response(const char *format, ...);
+     bool add_bytes(const char *data, int len);
      bool add_content(const char *content);
      bool add_status_line(int status, const char *title);
      bool add_headers(int content_length);
      bool add_content_length(int content_length);
      bool add_linger();
+     bool add_keep_alive();
+     bool add_date();
      bool add_blank_line();
+     void add_continue();
+     bool add_chunked_headers();
+     bool add_chunk(char *data, size_t len);
+     bool add_last_chunk();
+     void add_iv(char *base, size_t len);
+
+     /* TLS讀寫 */
+     int tls_handshake();
+     int tls_read(char *buf, int len);
+     int tls_writev();
+     bool tls_buffered();
+     void arm_read();
+
+     /* HTTP/2（src/http2.cpp） */
+     bool h2_preface();
+     void h2_start();
+     bool h2_upgrade(HTTP_CODE ret);
+     void process_h2();
+     bool h2_has_room();
+     bool h2_frame(int type, int flags, int stream_id, const unsigned char *payload, int len);
+     bool h2_settings(const unsigned char *payload, int len);
+     bool h2_headers(int flags, int stream_id, const unsigned char *payload, int len);
+     bool h2_end_headers();
+     bool h2_data(int flags, int stream_id, const unsigned char *payload, int len);
+     void h2_dispatch(http2_stream &s);
+     void h2_respond(http2_stream &s, HTTP_CODE ret);
+     void h2_cgi_output(int stream_id, const std::shared_ptr<cgi_result> &piece);
+     void h2_flush();
+     bool h2_want_write();
+     bool h2_send(const char *frame, int len);
+     void h2_reset(int stream_id, int code);
+     void h2_window_update(int stream_id, int increment);
+     bool h2_goaway(int code);
+
+     /* 推送佇列 */
+     void wake();
+     void push_enable();
+     void push_claim();
+     int push_drain();
+     bool wait_read();
+     bool rearm();
+
+     /* WebSocket（src/websocket.cpp） */
+     HTTP_CODE do_websocket_request();
+     bool add_websocket_accept();
+     void ws_start();
+     void process_ws();
+     bool ws_frame(bool fin, int opcode, const char *payload, size_t len);
+     bool ws_control(int opcode, const char *payload, size_t len);
+     void ws_close(int code);
+
+     /* PUT上傳（src/upload.cpp），表單與cgi的訊息體同樣由process_upload接收 */
+     HTTP_CODE do_put_request(const char *root, const char *path);
+     HTTP_CODE write_chunked(char *data, size_t len, size_t &consumed);
+     bool unread_body(const char *data, size_t len);
+     void process_upload();
+     HTTP_CODE finish_upload();
+     void abort_upload();
+     void upload_respond(HTTP_CODE ret);
+     bool uploading() const { return m_upload_fd >= 0 || m_form || m_cgi_input; }
+
+     /* 表單（src/form.cpp） */
+     HTTP_CODE do_form_request(form_factory factory);
+     HTTP_CODE finish_form();
+
+     /* Server-Sent Events（src/sse.cpp） */
+     bool add_sse_headers();
+     void sse_start();
+     void process_sse();
 
 public:
      /* 共用1個epollfd */
      static int m_epollfd;
      /* 使用者數量 */
      static int m_user_count;
+     /* 單一連線讀取緩衝區的最大大小 */
+     static int m_read_buffer_limit;
+     /* 單一連線最多處理的請求數 */
+     static int m_max_keep_alive_requests;
+     /* 靜態檔案的請求合併 */
+     static singleflight<file_result> m_file_flight;
+     /* 推送喚醒用的eventfd，由主執行緒註冊到epoll */
+     static int m_wake_fd;
 
 private:
      /* 該HTTP連接的socket和對方的socket位址 */
      int m_sockfd;
      sockaddr_in m_address;
 
-     /* 讀緩衝區 */
-     char m_read_buf[READ_BUFFER_SIZE];
+     /* 讀緩衝區：平時指向內建的m_read_inline，不足時改指向池中較大的緩衝區 */
+     char m_read_inline[READ_BUFFER_SIZE];
+     char *m_read_buf;
+     /* 目前讀緩衝區的大小 */
+     int m_read_size;
      /* 標記目前緩衝區中儲存的位元組數量 */
      int m_read_idx;
      /* 正在解析的字元在緩衝區的位置 */
      int m_check_idx;
      /* 正在解析的行的起始位置 */
      int m_start_line;
+     /* 請求頭的結構索引：head_scanner從m_scan_idx接著掃描，找出的行尾與分隔字元偏移由parse_line依序取用 */
+     int m_marks[MAX_HEAD_MARKS];
+     int m_mark_count;
+     int m_mark_next;
+     int m_scan_idx;
+     /* 從m_line_begin開始的一行中空白與\t的位置，以及第一個冒號的位置（沒有時為-1） */
+     int m_line_begin;
+     int m_line_seps[MAX_LINE_SEPS];
+     int m_line_sep_count;
+     int m_line_colon;
+     /* 目前請求（含訊息體）在緩衝區的結束位置，之後為pipeline的後續請求 */
+     int m_request_end;
+     /* 是否有已讀入但尚未處理的pipeline請求 */
+     bool m_pipelined;
 
      /* 寫入緩衝區 */
      char m_write_buf[WRITE_BUFFER_SIZE];
-     /* cgi緩衝區 */
-     char m_cgi_buf[WRITE_BUFFER_SIZE];
 
      /* 寫緩衝區待發送的位元組數 */
      int m_write_idx;
+     /* 本次回應尚未送出與已送出的位元組數 */
+     int m_bytes_to_send;
+     int m_bytes_have_send;
 
      /* 目前所處狀態 */
      CHECK_STATE m_chek_state;
@@ -157,30 +402,121 @@ private:
 
      /* 客戶請求的目標檔案的完整路徑 */
      char m_real_file[FILENAME_LEN];
-     /* 客戶請求的目標檔案名稱 */
+     /* 客戶請求的目標檔案名稱，已解碼並正規化 */
      char *m_url;
+     /* URL中?之後的查詢字串，沒有時為0 */
+     char *m_query;
      /* HTTP協定版本號 */
      char *m_version;
      /* 主機名稱 */
      char *m_host;
+     /* 訊息體類型（表單解析用），HTTP/2時指向串流的標頭 */
+     char *m_content_type;
+     /* 請求中的所有標頭 */
+     http_headers m_headers;
      /* HTTP請求的訊息體的長度 */
      int m_content_length;
      /* HTTP請求是否要保持連線 */
      bool m_linger;
+     /* 請求是否為HTTP/1.0（不支援chunked編碼） */
+     bool m_http10;
+     /* 目前請求是否已回覆100 Continue */
+     bool m_continue_sent;
 
      /* POST請求的Content資料 */
      char *m_content_data;
+     /* 訊息體是否為chunked編碼 */
+     bool m_chunked;
+     /* chunked解碼器與其在讀取緩衝區中的讀取位置、解碼後寫入位置 */
+     chunked_decoder m_chunk;
+     int m_chunk_in;
+     int m_chunk_out;
 
      /* 客戶請求的目標檔案被mmap到記憶體中的起始位置 */
      char *m_file_address;
+     /* 目前請求持有的共享檔案映射與cgi輸出，確保寫出完成前不被釋放 */
+     std::shared_ptr<file_result> m_file;
+     std::shared_ptr<cgi_result> m_cgi;
      /* 目標檔案狀態 */
      struct stat m_file_stat;
-     /* 使用writev執行寫入操作 */
-     struct iovec m_iv[2];
+     /* 使用writev執行寫入操作，每個回應最多佔用三段（標頭、檔案或cgi輸出、chunked結尾） */
+     struct iovec m_iv[3 * MAX_BATCH_REQUESTS];
      int m_iv_count;
+     /* 批次中各回應引用的檔案映射或cgi輸出 */
+     std::shared_ptr<void> m_batch_refs[MAX_BATCH_REQUESTS];
+     int m_batch_count;
+     /* 批次最後一個回應後是否保持連線 */
+     bool m_batch_linger;
+     /* 寫入緩衝區放不下而延到批次送出後才寫入的回應，沒有時為NO_REQUEST */
+     HTTP_CODE m_pending_write;
+     /* 此連線已處理的請求數 */
+     int m_request_count;
+     /* 切換為HTTP/2後的連線狀態，HTTP/1.1時為空 */
+     std::unique_ptr<http2_session> m_h2;
+     /* TLS連線，明文連線時為0 */
+     SSL *m_ssl;
+     /* 握手是否進行中 */
+     bool m_tls_handshake;
+     /* 是否已由kTLS負責加密傳送 */
+     bool m_ktls_send;
+
+     /* 連線代號 */
+     unsigned long m_conn_id;
+     static std::atomic<unsigned long> m_next_conn_id;
+     /* HTTP/2回覆OPTIONS與405時的Allow值（路由的方法中HTTP/2支援的部分） */
+     static std::string m_h2_allow;
+     /* 推送佇列：其他執行緒排入的唯讀資料，由擁有連線的執行緒移入批次寫出 */
+     locker m_push_mutex;
+     bool m_push_enabled;
+     PUSH_STATE m_push_state;
+     bool m_push_wake; // 已加入喚醒清單
+     bool m_push_overflow; // 佇列曾經溢位，需關閉連線
+     std::deque<std::shared_ptr<std::string>> m_push_queue;
+     size_t m_push_bytes;
+     /* 等待主執行緒處理的推送喚醒 */
+     static std::vector<http_conn *> m_wakeups;
+     static locker m_wake_mutex;
+
+     /* WebSocket請求：握手中的處理器與回應金鑰 */
+     bool m_upgrade_websocket;
+     bool m_connection_upgrade;
+     websocket_handler *m_ws_pending;
+     std::string m_ws_accept;
+     /* 已切換為WebSocket的處理器，HTTP連線時為0 */
+     websocket_handler *m_ws;
+     /* 分段訊息的類型與已收到的內容 */
+     int m_ws_opcode;
+     std::string m_ws_message;
+     /* 已送出關閉訊框，寫完後關閉連線 */
+     bool m_ws_closing;
+     /* 訂閱請求的頻道與已訂閱的頻道，一般連線時為0 */
+     sse_channel *m_sse_pending;
+     sse_channel *m_sse;
+
+     /* PUT上傳：暫存檔、socket到檔案的pipe、尚未收到的訊息體長度 */
+     int m_upload_fd;
+     int m_upload_pipe[2];
+     long long m_upload_left;
+     /* 暫存檔與目標路徑，收完後以rename原子地取代目標 */
+     std::string m_upload_tmp;
+     std::string m_upload_target;
+     bool m_upload_created;
+     /* 串流解析中的表單，其餘時間為0 */
+     form_parser *m_form;
+     /* 串流送入cgi標準輸入的訊息體，其餘時間為空；送入的內容過多時暫停讀取（受m_push_mutex保護） */
+     std::shared_ptr<cgi_input> m_cgi_input;
+     bool m_upload_paused;
+     /* 路由重新導向的目標 */
+     std::string m_location;
+     /* 背景執行中（含最後一段尚未回應）的cgi數量，與已收到尚未回應的輸出（串流編號、片段），受m_push_mutex保護 */
+     int m_cgi_running;
+     std::vector<std::pair<int, std::shared_ptr<cgi_result>>> m_cgi_done;
+     /* HTTP/2處理中的串流編號 */
+     int m_h2_stream;
 };
 
 
 void addFd(int epollfd, int fd, bool oneShot);
 void removefd(int epollfd, int fd);
+void modfd(int epollfd, int fd, int ev);
 #endif
@@ -0,0 +1,39 @@
+#ifndef __HTTP_FORMAT_H__
+#define __HTTP_FORMAT_H__
+
+#include <atomic>
+#include <time.h>
+
+/*
+     回應標頭格式化工具：
+         整數以查表方式轉成字串，不經過printf的格式解析；
+         Date標頭每秒只格式化一次，所有執行緒共用同一份結果
+*/
+class http_format
+{
+public:
+     /* "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"的長度 */
+     static const int DATE_HEADER_LEN = 37;
+
+     /* 將v以十進位寫入buf，傳回寫入的位元組數（不含'\0'），buf至少需20位元組 */
+     static int format_dec(char *buf, unsigned long v);
+     /* 將v以十六進位（小寫）寫入buf，傳回寫入的位元組數，buf至少需16位元組 */
+     static int format_hex(char *buf, unsigned long v);
+     /* 將目前時間的Date標頭（含\r\n）複製到buf，傳回DATE_HEADER_LEN */
+     static int date_header(char *buf);
+
+private:
+     http_format();
+     ~http_format();
+
+     /* 將t格式化成Date標頭寫入buf */
+     static void format_date(time_t t, char *buf);
+
+private:
+     static char m_date[2][DATE_HEADER_LEN + 1]; // 雙緩衝，更新時只寫入未使用的一份
+     static std::atomic<int> m_date_slot; // 目前有效的一份
+     static std::atomic<long> m_date_sec; // 目前有效的一份對應的秒數
+     static std::atomic_flag m_date_updating; // 是否已有執行緒正在更新
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef __HTTP_HEADERS_H__
+#define __HTTP_HEADERS_H__
+
+#include <stddef.h>
+#include <time.h>
+
+/*
+     請求頭表：
+         記錄請求中的每一個標頭，名稱與值以相對讀取緩衝區的偏移保存（緩衝區擴充後仍然有效），
+         常見標頭以編譯期驗證無碰撞的完美雜湊辨識，數值與日期只在第一次讀取時才解析
+*/
+class http_headers
+{
+public:
+     /* 已知的標頭，HDR_UNKNOWN以外的順序需與known_names一致 */
+     enum HEADER_ID
+     {
+         HDR_UNKNOWN = 0,
+         HDR_CONNECTION,
+         HDR_CONTENT_LENGTH,
+         HDR_HOST,
+         HDR_TRANSFER_ENCODING,
+         HDR_CONTENT_TYPE,
+         HDR_UPGRADE,
+         HDR_KEEP_ALIVE,
+         HDR_IF_MODIFIED_SINCE,
+         HDR_IF_NONE_MATCH,
+         HDR_COOKIE,
+         HDR_USER_AGENT,
+         HDR_ACCEPT,
+         HDR_ACCEPT_ENCODING,
+         HDR_EXPECT,
+         HDR_SEC_WEBSOCKET_KEY,
+         HDR_SEC_WEBSOCKET_VERSION,
+         HDR_HTTP2_SETTINGS,
+         HDR_RANGE,
+         HDR_LAST_EVENT_ID,
+         HDR_AUTHORIZATION,
+         HDR_DATE,
+         HDR_REFERER,
+         HDR_TE,
+         HDR_ORIGIN,
+         HDR_CACHE_CONTROL,
+         HDR_PRAGMA,
+         HDR_ACCEPT_LANGUAGE,
+         HDR_IF_MATCH,
+         HDR_IF_UNMODIFIED_SINCE,
+         HDR_CONTENT_ENCODING,
+         HDR_X_FORWARDED_FOR,
+         HDR_SEC_WEBSOCKET_PROTOCOL,
+         HDR_SEC_WEBSOCKET_EXTENSIONS,
+         HDR_COUNT
+     };
+
+     /* 單一請求最多記錄的標頭數量 */
+     static const int MAX_HEADERS = 64;
+
+public:
+     http_headers() : m_base(0), m_count(0)
+     {
+         for (int i = 0; i < HDR_COUNT; ++i)
+         {
+             m_first[i] = -1;
+         }
+     };
+     ~http_headers(){};
+
+     /* 綁定讀取緩衝區指標的位址，偏移皆相對於*base */
+     void bind(char *const *base)
+     {
+         m_base = base;
+     }
+     /* 清除所有標頭 */
+     void clear();
+     /* 記錄一個標頭，傳回其HEADER_ID；超過MAX_HEADERS時傳回-1 */
+     int add(int name_off, int name_len, int value_off, int value_len);
+     /* 辨識標頭名稱，不屬於已知標頭時傳回HDR_UNKNOWN */
+     static HEADER_ID lookup(const char *name, size_t len);
+
+     /* 標頭數量與第i個標頭的名稱、值 */
+     int count() const
+     {
+         return m_count;
+     }
+     const char *name(int i) const
+     {
+         return *m_base + m_entries[i].name_off;
+     }
+     int name_len(int i) const
+     {
+         return m_entries[i].name_len;
+     }
+     const char *value(int i) const
+     {
+         return *m_base + m_entries[i].value_off;
+     }
+     int value_len(int i) const
+     {
+         return m_entries[i].value_len;
+     }
+
+     /* 取得已知標頭的值（第一次出現者），不存在時傳回NULL */
+     const char *get(HEADER_ID id) const
+     {
+         return m_first[id] < 0 ? 0 : value(m_first[id]);
+     }
+     /* 以名稱取得標頭的值（不分大小寫），不存在時傳回NULL */
+     const char *get(const char *name) const;
+     /* 以十進位整數讀取標頭，格式錯誤或不存在時傳回false */
+     bool get_int(HEADER_ID id, long &out);
+     /* 以HTTP日期（IMF-fixdate）讀取標頭，格式錯誤或不存在時傳回false */
+     bool get_date(HEADER_ID id, time_t &out);
+
+private:
+     /* 單一標頭 */
+     struct entry
+     {
+         int name_off; // 名稱偏移
+         int name_len; // 名稱長度
+         int value_off; // 值偏移
+         int value_len; // 值長度
+         int id; // HEADER_ID
+         bool parsed; // 數值是否已解析
+         bool valid; // 解析結果是否有效
+         long number; // 解析後的整數或時間
+     };
+
+private:
+     char *const *m_base; // 讀取緩衝區指標的位址
+     entry m_entries[MAX_HEADERS];
+     int m_count;
+     int m_first[HDR_COUNT]; // 各已知標頭第一次出現的位置，-1表示不存在
+};
+
+#endif
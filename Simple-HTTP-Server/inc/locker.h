@@ -55,6 +55,11 @@ public:
      bool unlock(){
          return pthread_mutex_unlock(&m_mutex) == 0;
      }
+
+     // 取得底層互斥鎖，供條件變數搭配使用
+     pthread_mutex_t *get(){
+         return &m_mutex;
+     }
 private:
      pthread_mutex_t m_mutex;
 };
@@ -86,9 +91,19 @@ public:
          return ret == 0;
      }
 
+     // 使用外部互斥鎖等待，呼叫前須已持有該鎖
+     bool wait(pthread_mutex_t *mutex){
+         return pthread_cond_wait(&m_cond, mutex) == 0;
+     }
+
      bool signal(){
          return pthread_cond_signal(&m_cond);
      }
+
+     // 喚醒所有等待者
+     bool broadcast(){
+         return pthread_cond_broadcast(&m_cond) == 0;
+     }
 private:
      pthread_mutex_t m_mutex;
      pthread_cond_t m_cond;
@@ -0,0 +1,141 @@
+#ifndef __ROUTER_H__
+#define __ROUTER_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class fastcgi_pool;
+
+/*
+     行程內端點收到的請求，指標只在handle執行期間有效
+*/
+struct route_request
+{
+     int method; // http_conn::METHOD
+     const char *url; // 正規化後的完整路徑
+     const char *rest; // 路由前綴之後的部分，以/開頭或為空字串
+     const char *query; // ?之後的查詢字串，沒有時為0
+     const char *body; // 訊息體，長度為body_len
+     size_t body_len;
+};
+
+/*
+     行程內端點，在執行緒池中呼叫，需可重入
+*/
+class route_handler
+{
+public:
+     virtual ~route_handler(){};
+     /* 產生回應內容，以200回覆 */
+     virtual void handle(const route_request &req, std::string &body) = 0;
+     /* 回應的Content-Type */
+     virtual const char *content_type() const
+     {
+         return "text/plain; charset=utf-8";
+     };
+};
+
+/*
+     一個路由的處理方式
+*/
+struct route
+{
+     enum KIND
+     {
+         STATIC, // target目錄下的靜態檔案
+         CGI, // target目錄下的cgi程式
+         NATIVE, // 行程內的route_handler
+         REDIRECT, // 重新導向到target + 前綴之後的部分
+         FASTCGI, // target目錄下的cgi程式，交給常駐的FastCGI程式池執行
+         UPLOAD // 以PUT上傳到target目錄下，收完後取代目標檔案
+     };
+
+     KIND kind;
+     std::string target;
+     route_handler *handler;
+     int status; // REDIRECT的狀態碼（301或302）
+     fastcgi_pool *pool; // FASTCGI使用的程式池
+
+     route(KIND k, const std::string &t, route_handler *h = 0, int s = 302)
+         : kind(k), target(t), handler(h), status(s), pool(0){};
+     route(KIND k, const std::string &t, fastcgi_pool *p) : kind(k), target(t), handler(0), status(302), pool(p){};
+};
+
+/*
+     路由表：
+         以路徑前綴組成的基數樹（radix trie），每個節點依請求方法各自對應一個路由，
+         查詢時沿著路徑走一次，取最長且在/邊界上的前綴，時間與路徑長度成正比；
+         路由在開始服務前建立，之後唯讀，不需要鎖
+*/
+class router
+{
+public:
+     /* 方法遮罩，位元順序與http_conn::METHOD一致 */
+     enum METHOD_MASK
+     {
+         M_GET = 1 << 0,
+         M_POST = 1 << 1,
+         M_HEAD = 1 << 2,
+         M_PUT = 1 << 3,
+         M_DELETE = 1 << 4,
+         M_TRACE = 1 << 5,
+         M_OPTIONS = 1 << 6,
+         M_CONNECT = 1 << 7,
+         M_PATCH = 1 << 8,
+         M_ANY = (1 << 9) - 1
+     };
+
+     /* 路由表能區分的方法數量 */
+     static const int MAX_METHODS = 9;
+
+     /*
+         加入前綴prefix（例如"/"、"/api"）對methods的路由，同一前綴與方法重複加入時以後者為準
+         prefix結尾的/會被忽略："/api"與"/api/"相同，都符合"/api"與"/api/..."而不符合"/apix"
+     */
+     static void add(const std::string &prefix, unsigned methods, const route &r);
+     /*
+         尋找path對method的路由，prefix_len設為符合的前綴長度
+         傳回值：沒有符合的路由時為0
+     */
+     static const route *find(int method, const char *path, size_t &prefix_len);
+     /* 所有路由的方法遮罩加上OPTIONS（由dispatch_request直接回覆） */
+     static unsigned methods()
+     {
+         return m_methods | M_OPTIONS;
+     }
+     /* 將方法遮罩依位元順序轉成Allow的值，例如"GET, HEAD, OPTIONS" */
+     static std::string allow_value(unsigned mask);
+     /* OPTIONS回覆的Allow標頭（含\r\n），對應methods()，隨add更新 */
+     static const std::string &allow_header()
+     {
+         return m_allow;
+     }
+
+private:
+     struct node
+     {
+         std::string label; // 與父節點之間的路徑片段
+         const route *routes[MAX_METHODS];
+         std::vector<node *> children; // 依label第一個字元區分
+         node(const std::string &l) : label(l)
+         {
+             for (int i = 0; i < MAX_METHODS; ++i)
+             {
+                 routes[i] = 0;
+             }
+         };
+     };
+
+     router();
+     ~router();
+
+     static node *child(const node *n, char c);
+
+private:
+     static node m_root;
+     static unsigned m_methods; // 所有路由的方法遮罩
+     static std::string m_allow;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __SINGLE_FLIGHT_H__
+#define __SINGLE_FLIGHT_H__
+
+#include <map>
+#include <string>
+#include <memory>
+#include <functional>
+
+#include "locker.h"
+
+/*
+     請求合併（single-flight）：
+         同一個key同時只允許一個執行緒執行載入函數，
+         其餘執行緒等待該次執行完成後直接共享其結果，
+         避免熱門資源失效時大量執行緒重複讀檔或fork cgi
+*/
+template<typename T>
+class singleflight
+{
+public:
+     singleflight(){};
+     ~singleflight(){};
+
+     /* 以key執行fn，傳回本次（或正在進行中的那次）執行結果 */
+     std::shared_ptr<T> do_call(const std::string &key, std::function<std::shared_ptr<T>()> fn);
+
+private:
+     /* 一次進行中的呼叫 */
+     struct call
+     {
+         bool done; // 是否已完成
+         std::shared_ptr<T> val; // 執行結果
+         call() : done(false){};
+     };
+
+private:
+     std::map<std::string, std::shared_ptr<call>> m_calls; // 進行中的呼叫
+     locker m_mutex; // 保護m_calls
+     cond m_cond; // 呼叫完成時通知等待者
+};
+
+template<typename T>
+std::shared_ptr<T> singleflight<T>::do_call(const std::string &key, std::function<std::shared_ptr<T>()> fn)
+{
+     m_mutex.lock();
+     typename std::map<std::string, std::shared_ptr<call>>::iterator it = m_calls.find(key);
+     if (it != m_calls.end())
+     {
+         // 已有執行緒在載入，等待其完成後共享結果
+         std::shared_ptr<call> c = it->second;
+         while (!c->done)
+         {
+             m_cond.wait(m_mutex.get());
+         }
+         m_mutex.unlock();
+         return c->val;
+     }
+     std::shared_ptr<call> c(new call());
+     m_calls[key] = c;
+     m_mutex.unlock();
+
+     // 由本執行緒負責實際載入，執行期間不持有鎖
+     std::shared_ptr<T> val = fn();
+
+     m_mutex.lock();
+     c->val = val;
+     c->done = true;
+     m_calls.erase(key);
+     m_cond.broadcast();
+     m_mutex.unlock();
+     return val;
+}
+
+#endif
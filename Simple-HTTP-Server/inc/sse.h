@@ -0,0 +1,57 @@
+#ifndef __SSE_H__
+#define __SSE_H__
+
+#include <map>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include "locker.h"
+
+class http_conn;
+
+/*
+     一個SSE頻道：訂閱中的連線與事件編號
+     訂閱者以連線代號記錄，發布時連線已關閉（fd被重複使用）不會送到新連線
+*/
+struct sse_channel
+{
+     std::string path;
+     locker mutex;
+     std::unordered_map<http_conn *, unsigned long> subscribers;
+     unsigned long last_id; // 最後發布的事件編號
+     sse_channel(const std::string &p) : path(p), last_id(0){};
+};
+
+/*
+     Server-Sent Events廣播：
+         GET頻道路徑的連線回覆text/event-stream後保持開啟並訂閱該頻道，
+         發布的事件只編碼一次，同一份唯讀緩衝區以引用計數排入所有訂閱者的推送佇列
+*/
+class sse
+{
+public:
+     /* 註冊頻道，需在開始服務前呼叫 */
+     static sse_channel *add_channel(const std::string &path);
+     /* 取得path的頻道，沒有時傳回0 */
+     static sse_channel *find_channel(const char *path);
+     static void subscribe(sse_channel *channel, http_conn *conn, unsigned long id);
+     static void unsubscribe(sse_channel *channel, http_conn *conn);
+     /*
+         發布事件，可在任何執行緒呼叫；event為空時不帶event欄位，其中的CR、LF會被去除；data中的換行（\r\n、\r或\n）分成多個data欄位
+         推送失敗（連線已關閉或佇列溢位）的訂閱者會被移除，溢位的連線由主執行緒關閉
+         傳回值：排入的訂閱者數量，頻道不存在時為-1
+     */
+     static int publish(const std::string &path, const std::string &event, const std::string &data);
+     static int publish(sse_channel *channel, const std::string &event, const std::string &data);
+     /* 編碼一個事件 */
+     static std::shared_ptr<std::string> encode(unsigned long id, const std::string &event, const std::string &data);
+
+private:
+     sse();
+     ~sse();
+
+private:
+     static std::map<std::string, sse_channel *> m_channels;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __STAT_CACHE_H__
+#define __STAT_CACHE_H__
+
+#include <map>
+#include <string>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "locker.h"
+
+/*
+     檔案狀態快取：
+         以路徑快取stat的結果（包含不存在的檔案），在TTL內重複查詢不再呼叫stat，
+         供只需要中繼資料的請求（例如HEAD）使用
+*/
+class stat_cache
+{
+public:
+     /* 取得path的檔案狀態，傳回值與stat相同：成功0，失敗-1 */
+     static int get(const std::string &path, struct stat &st);
+
+private:
+     stat_cache();
+     ~stat_cache();
+
+     /* 騰出一個位置，呼叫方需持有m_mutex */
+     static void evict(time_t now);
+
+private:
+     /* 快取有效秒數 */
+     static const int TTL = 1;
+     /* 最多快取的路徑數量，達上限時由evict騰出位置 */
+     static const size_t MAX_ENTRIES = 4096;
+
+     struct entry
+     {
+         int ret; // stat的傳回值
+         struct stat st; // 檔案狀態
+         time_t expire; // 過期時間
+     };
+
+     static std::map<std::string, entry> m_entries;
+     static locker m_mutex; // 保護m_entries
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __TLS_H__
+#define __TLS_H__
+
+#include <openssl/ssl.h>
+
+/*
+     TLS終止：
+         所有連線共用一個SSL_CTX，握手在使用者空間以非阻塞方式完成；
+         啟用SSL_OP_ENABLE_KTLS，核心支援時握手後的金鑰交給kTLS，
+         之後回應可直接writev到socket，由核心加密，不需經過SSL_write複製；
+         伺服器端session快取與session ticket讓回訪的客戶端以簡短握手恢復連線
+*/
+class tls
+{
+public:
+     /* 載入憑證與私鑰並建立共用的SSL_CTX，失敗時傳回false，伺服器不啟用TLS */
+     static bool init(const char *cert_file, const char *key_file);
+     /* 為已接受的連線建立伺服器端的SSL物件，失敗傳回0 */
+     static SSL *accept(int fd);
+
+private:
+     tls();
+     ~tls();
+
+     /* ALPN：優先選擇h2，其次http/1.1 */
+     static int select_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                            const unsigned char *in, unsigned int inlen, void *arg);
+
+private:
+     /* 伺服器端session快取的數量 */
+     static const long SESSION_CACHE_SIZE = 20480;
+
+     static SSL_CTX *m_ctx;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __URL_H__
+#define __URL_H__
+
+#include <stddef.h>
+#include <string>
+
+/*
+     請求URL路徑的解碼與正規化：
+         百分比解碼、移除.與..路徑段（不會超出根目錄）、合併連續的/，並切出查詢字串，
+         結果一定不比原字串長，因此直接在讀取緩衝區中就地改寫，
+         同一資源的各種寫法得到相同的路徑，作為檔案快取與single-flight的鍵
+*/
+class url
+{
+public:
+     /*
+         就地正規化以/開頭、以\0結尾的路徑
+         query設為?之後的查詢字串（沒有時為0），#之後的片段被捨棄
+         傳回值：正規化後的長度；格式錯誤的%編碼或解碼出\0時為-1
+     */
+     static int normalize(char *path, char **query);
+     /* 就地解碼application/x-www-form-urlencoded的名稱或值：+為空白，格式錯誤的%編碼原樣保留 */
+     static void decode_form(std::string &s);
+
+private:
+     url();
+     ~url();
+
+     static int hex_value(char c);
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __WEBSOCKET_H__
+#define __WEBSOCKET_H__
+
+#include <map>
+#include <string>
+#include <memory>
+
+class http_conn;
+
+/*
+     一條WebSocket連線的代號，可在任何執行緒用來傳送訊息
+     id在連線建立時產生，連線關閉（fd被重複使用）後傳送會失敗而不會送到新連線
+*/
+struct websocket_conn
+{
+     http_conn *conn;
+     unsigned long id;
+};
+
+/*
+     應用程式處理WebSocket訊息的介面
+     on_open與on_message在執行緒池中呼叫，on_close在關閉連線的執行緒中呼叫
+*/
+class websocket_handler
+{
+public:
+     virtual ~websocket_handler(){};
+     virtual void on_open(const websocket_conn &ws){};
+     virtual void on_message(const websocket_conn &ws, int opcode, const std::string &message) = 0;
+     virtual void on_close(const websocket_conn &ws){};
+};
+
+/*
+     WebSocket（RFC 6455）：處理器註冊、握手金鑰與伺服器訊框編碼
+*/
+class websocket
+{
+public:
+     /* 訊框類型 */
+     enum OPCODE
+     {
+         CONTINUATION = 0,
+         TEXT = 1,
+         BINARY = 2,
+         CLOSE = 8,
+         PING = 9,
+         PONG = 10
+     };
+
+     /* 控制訊框的最大資料長度 */
+     static const size_t MAX_CONTROL_PAYLOAD = 125;
+
+     /* 註冊path的處理器，需在開始服務前呼叫 */
+     static void add_handler(const std::string &path, websocket_handler *handler);
+     /* 取得path的處理器，沒有時傳回0 */
+     static websocket_handler *find_handler(const char *path);
+     /* 由Sec-WebSocket-Key計算Sec-WebSocket-Accept */
+     static std::string accept_key(const char *key);
+     /* 寫入伺服器訊框標頭（不遮罩），out至少需10位元組，傳回標頭長度 */
+     static int frame_header(char *out, int opcode, size_t len);
+     /* 對方CLOSE訊框中的狀態碼是否可以使用（RFC 6455 7.4），1005、1006、1015等保留碼不可出現在訊框中 */
+     static bool valid_close_code(int code);
+     /* TEXT訊息與關閉原因必須是合法的UTF-8：不可有過長編碼、代理區的碼點或超過U+10FFFF */
+     static bool valid_utf8(const char *data, size_t len);
+     /* 編碼一個完整的伺服器訊框（不遮罩），結果唯讀，可同時排入多條連線 */
+     static std::shared_ptr<std::string> frame(int opcode, const char *data, size_t len);
+     /* 傳送訊息，連線已關閉或輸出佇列已滿時傳回false */
+     static bool send(const websocket_conn &ws, int opcode, const std::string &message);
+     static bool send(const websocket_conn &ws, const std::shared_ptr<std::string> &frame);
+
+private:
+     websocket();
+     ~websocket();
+
+private:
+     static std::map<std::string, websocket_handler *> m_handlers;
+};
+
+#endif
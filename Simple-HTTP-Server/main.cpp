@@ -1,15 +1,37 @@
+#include <sys/eventfd.h>
 #include "http_conn.h"
 #include "threadpool.h"
+#include "websocket.h"
+#include "sse.h"
+#include "form.h"
+#include "router.h"
+#include "fastcgi.h"
+#include "cgi.h"
+#include "cgi_cache.h"
+#include "http_format.h"
+#include "head_scanner.h"
 #include "log.h"
 
 const int thread_num = 8; // 執行緒池執行緒數目
 const short port = 9000; // 網路埠號
 const int MAX_FD = 65536; // 最大檔案符號數量
 const int MAX_EVENT_NUMBER = 10000; // 最大並發事件處理數
+const int MAX_READ_BUFFER = 64 * 1024; // 單一連線讀取緩衝區上限
+const int MAX_KEEP_ALIVE_REQUESTS = 100; // 單一連線最多處理的請求數
+const short tls_port = 9443; // HTTPS埠號，憑證與私鑰存在時才啟用
+const char* tls_cert = "../template/tls/server.crt"; // PEM憑證鏈
+const char* tls_key = "../template/tls/server.key"; // PEM私鑰
+const bool ALLOW_PUT = false; // 允許以PUT上傳檔案（沒有身分驗證，只在upload_prefix之下）
+const char* upload_prefix = "/upload"; // 接受PUT的路徑前綴，對應網站根目錄下的同名目錄
+const int FASTCGI_WORKERS = 4; // 常駐的FastCGI worker數目，0時每個cgi請求各自fork
+const char* fastcgi_worker = "../template/fcgi/cgi_worker.py"; // FastCGI worker程式
+const int CGI_TIMEOUT = 30; // 單一cgi程式的執行時間上限（秒），超過時強制結束並回覆504
 
 
 // extern int addFd(int epollfd, int fd, bool one_shot);
 // extern int removefd(int epollfd, int fd);
+extern const char* doc_root; // 網站根目錄
+extern const char* cgi_root; // cgi程式目錄
 
 void addsig(int sig, void(handler)(int), bool restart = true)
 {
@@ -34,30 +56,152 @@ void show_error(int connfd, const char* info)
     close(connfd);
 }
 
-int main()
+/*
+    WebSocket範例：將收到的訊息原樣送回
+*/
+class echo_handler : public websocket_handler
 {
-    chdir("./");
-    //創建線程池
-    addsig(SIGPIPE, SIG_IGN);
+public:
+    void on_message(const websocket_conn &ws, int opcode, const std::string &message)
+    {
+        websocket::send(ws, opcode, message);
+    }
+};
 
-    threadpool<http_conn>* pool = NULL;
-    try{
-        pool = new threadpool<http_conn>(thread_num);
-    }catch(...)
+/*
+    將s中的HTML特殊字元轉成字元參照後附加到out，避免欄位內容被當成標記執行
+*/
+void append_html(std::string &out, const std::string &s)
+{
+    for (size_t i = 0; i < s.size(); ++i)
     {
-        return 1;
+        switch (s[i])
+        {
+        case '&': out += "&amp;"; break;
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '"': out += "&quot;"; break;
+        case '\'': out += "&#39;"; break;
+        default: out.push_back(s[i]); break;
+        }
     }
+}
 
-    //啟用日誌
-    Log::init(".", "log_test", 0, 10000);
+/*
+    表單範例：列出收到的欄位，檔案只統計大小而不保存內容
+*/
+class form_echo : public form_handler
+{
+public:
+    form_echo() : m_size(0) {}
+    void on_field(const std::string &name, const std::string &value)
+    {
+        m_list += "<li>";
+        append_html(m_list, name);
+        m_list += " = ";
+        append_html(m_list, value);
+        m_list += "</li>\n";
+    }
+    void on_file_begin(const std::string &name, const std::string &filename, const std::string &content_type)
+    {
+        m_list += "<li>";
+        append_html(m_list, name);
+        m_list += ": ";
+        append_html(m_list, filename);
+        m_list += " (";
+        append_html(m_list, content_type);
+        m_list += ") ";
+        m_size = 0;
+    }
+    void on_file_data(const char *data, size_t len)
+    {
+        m_size += len;
+    }
+    void on_file_end()
+    {
+        m_list += std::to_string(m_size) + " bytes</li>\n";
+    }
+    void on_complete(std::string &body)
+    {
+        body = "<html>\n<head>\n<title>POST</title>\n</head>\n<body>\n<h2> Your POST data: </h2>\n<ul>\n" + m_list +
+               "</ul>\n</body>\n</html>\n";
+    }
+    static form_handler *create()
+    {
+        return new form_echo();
+    }
 
-    http_conn* users = new http_conn[MAX_FD];
-    if(users == NULL){
-        LOG_ERROR("malloc %d http_conn memory failed!\n", MAX_FD);
-        exit(1);
+private:
+    std::string m_list;
+    unsigned long long m_size;
+};
+
+/*
+    行程內端點範例：回報目前的連線數，不需要fork任何程式
+*/
+class status_handler : public route_handler
+{
+public:
+    void handle(const route_request &req, std::string &body)
+    {
+        body = "{\"connections\": " + std::to_string(http_conn::m_user_count) + "}\n";
     }
-    int user_count = 0; // 使用者計數
+    const char *content_type() const
+    {
+        return "application/json";
+    }
+};
+
+/*
+    建立路由表：靜態檔案與cgi維持原本的行為，另外加入行程內端點與重新導向
+    cgi優先交給FastCGI程式池，worker無法啟動時退回每個請求fork
+*/
+void init_routes()
+{
+    static status_handler status;
+    router::add("/", router::M_GET | router::M_HEAD, route(route::STATIC, doc_root));
+    // worker以參數接收時間上限，自行中斷逾時的腳本
+    std::vector<std::string> worker_argv;
+    worker_argv.push_back(fastcgi_worker);
+    worker_argv.push_back(std::to_string(CGI_TIMEOUT));
+    static fastcgi_pool cgi_pool(worker_argv, FASTCGI_WORKERS);
+    if(FASTCGI_WORKERS > 0 && cgi_pool.start()){
+        router::add("/", router::M_POST, route(route::FASTCGI, cgi_root, &cgi_pool));
+    }else{
+        router::add("/", router::M_POST, route(route::CGI, cgi_root));
+    }
+    // 輸出可重複使用的腳本：time.cgi每秒更新一次，test.cgi的輸出固定，依Accept-Language分開快取
+    cgi_cache::configure(std::string(cgi_root) + "/time.cgi", 1, 1);
+    cgi_cache::configure(std::string(cgi_root) + "/test.cgi", 60, 60, std::vector<std::string>(1, "accept-language"));
+    router::add("/api/status", router::M_GET, route(route::NATIVE, "", &status));
+    router::add("/home", router::M_GET | router::M_HEAD, route(route::REDIRECT, "/index", 0, 301));
+    // 上傳的檔案之後以GET經由靜態檔案路由讀取
+    if(ALLOW_PUT){
+        router::add(upload_prefix, router::M_PUT, route(route::UPLOAD, std::string(doc_root) + upload_prefix));
+    }
+}
 
+/*
+    SSE範例：每秒向/events/clock發布目前時間
+*/
+void* clock_publisher(void* arg)
+{
+    sse_channel* channel = (sse_channel*)arg;
+    char date[http_format::DATE_HEADER_LEN + 1];
+    while(true){
+        http_format::date_header(date);
+        // 去掉"Date: "與\r\n
+        sse::publish(channel, "tick", std::string(date + 6, http_format::DATE_HEADER_LEN - 8));
+        sleep(1);
+    }
+    return NULL;
+}
+
+/*
+    建立監聽port的socket，失敗時結束程式
+*/
+int create_listen(short port)
+{
     int listenfd = socket(AF_INET, SOCK_STREAM, 0);
     if(listenfd < 0){
         LOG_ERROR("create socket() failed!\n");
@@ -65,8 +209,9 @@ int main()
     }
 
     // 位址復用
-    struct linger tmp = {1, 0};
-    setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+    // 不可設定SO_LINGER {1, 0}：接受的連線會繼承，close時送出RST而丟棄尚未送達的回應
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
     int ret = 0;
     sockaddr_in address;
@@ -81,17 +226,83 @@ int main()
         exit(1);
     }
 
-    ret = listen(listenfd, 5);
+    // 大量客戶端同時（重新）連線時，佇列過短會使SYN被丟棄而延遲1秒重送
+    ret = listen(listenfd, SOMAXCONN);
     if(ret < 0){
         LOG_ERROR("call listen() failed!\n");
         exit(1);
     }
+    return listenfd;
+}
+
+int main()
+{
+    chdir("./");
+    //創建線程池
+    addsig(SIGPIPE, SIG_IGN);
+
+    threadpool<http_conn>* pool = NULL;
+    try{
+        pool = new threadpool<http_conn>(thread_num);
+    }catch(...)
+    {
+        return 1;
+    }
+
+    //啟用日誌
+    Log::init(".", "log_test", 0, 10000);
+    LOG_INFO("request head scanner: %s", head_scanner::impl_name());
+
+    http_conn* users = new http_conn[MAX_FD];
+    if(users == NULL){
+        LOG_ERROR("malloc %d http_conn memory failed!\n", MAX_FD);
+        exit(1);
+    }
+    int user_count = 0; // 使用者計數
+
+    int listenfd = create_listen(port);
+
+    // 憑證存在時另外在tls_port提供HTTPS（ALPN可協商h2）
+    int tls_listenfd = -1;
+    if(tls::init(tls_cert, tls_key)){
+        tls_listenfd = create_listen(tls_port);
+    }
 
     epoll_event events[MAX_EVENT_NUMBER];
     int epollfd = epoll_create(5);
     assert(epollfd != 1);
     addFd(epollfd, listenfd, false);
+    if(tls_listenfd >= 0){
+        addFd(epollfd, tls_listenfd, false);
+    }
     http_conn::m_epollfd = epollfd;
+    http_conn::m_read_buffer_limit = MAX_READ_BUFFER;
+    http_conn::m_max_keep_alive_requests = MAX_KEEP_ALIVE_REQUESTS;
+
+    // 其他執行緒向閒置連線推送資料時，經由eventfd喚醒主執行緒寫出
+    int wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(wakefd >= 0);
+    addFd(epollfd, wakefd, false);
+    http_conn::m_wake_fd = wakefd;
+    std::vector<http_conn*> wakeups;
+
+    // cgi的pipe與子程序由主執行緒在背景處理
+    if(!cgi::init(epollfd, MAX_FD, CGI_TIMEOUT)){
+        LOG_ERROR("cgi timer create failed!\n");
+        exit(1);
+    }
+
+    static echo_handler echo;
+    websocket::add_handler("/ws/echo", &echo);
+    form::add_handler("/form/echo", form_echo::create);
+    init_routes();
+    // 405回應的Allow取自路由表
+    http_conn::init_error_responses();
+
+    pthread_t clock_thread;
+    if(pthread_create(&clock_thread, NULL, clock_publisher, sse::add_channel("/events/clock")) == 0){
+        pthread_detach(clock_thread);
+    }
 
     while(true)
     {
@@ -101,29 +312,45 @@ int main()
             break;
         }
 
+        bool wakeup = false;
         for(int i = 0; i < number; i++){
             int sockfd = events[i].data.fd;
-            if(sockfd == listenfd){
-                sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                int connfd = accept(listenfd, (sockaddr*)&client_address, &client_addrlength);
-                if(connfd < 0){
-                    printf("errno is %d\n", errno);
-                    LOG_WARNING(" main.cpp line 112 accept() failed!")
-                    continue;
-                }
-                if(http_conn::m_user_count >= MAX_FD){
-                    show_error(connfd, "Internal server busy");
-                    continue;
+            if(sockfd == wakefd){
+                wakeup = true;
+            }else if(cgi::handle(sockfd, events[i].events)){
+                // cgi的pipe、pidfd、FastCGI連線或逾時計時器
+            }else if(sockfd == listenfd || sockfd == tls_listenfd){
+                // listenfd為ET模式，需一次接受完所有已完成的連線，否則並發連線會滯留在佇列中
+                while(true){
+                    sockaddr_in client_address;
+                    socklen_t client_addrlength = sizeof(client_address);
+                    int connfd = accept(sockfd, (sockaddr*)&client_address, &client_addrlength);
+                    if(connfd < 0){
+                        if(errno != EAGAIN && errno != EWOULDBLOCK){
+                            printf("errno is %d\n", errno);
+                            LOG_WARNING(" main.cpp accept() failed!")
+                        }
+                        break;
+                    }
+                    if(http_conn::m_user_count >= MAX_FD){
+                        show_error(connfd, "Internal server busy");
+                        continue;
+                    }
+                    users[connfd].init(connfd, client_address);
+                    if(sockfd == tls_listenfd && !users[connfd].tls_accept()){
+                        users[connfd].close_conn();
+                    }
                 }
-                users[connfd].init(connfd, client_address);
             }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
                 users[sockfd].close_conn();
             }else if(events[i].events & EPOLLIN)
             {
                 if(users[sockfd].read())
                 {
-                    pool->append(users + sockfd);
+                    // TLS握手尚未完成時沒有可處理的請求
+                    if(!users[sockfd].handshaking()){
+                        pool->append(users + sockfd);
+                    }
                 }else{
                     users[sockfd].close_conn();
                 }
@@ -132,12 +359,33 @@ int main()
                 if(!users[sockfd].write())
                 {
                     users[sockfd].close_conn();
+                }else if(users[sockfd].pipelined())
+                {
+                    // 緩衝區中還有pipeline請求，依序交給執行緒池處理
+                    pool->append(users + sockfd);
+                }
+            }
+        }
+        // 推送喚醒在處理完本輪事件後進行，同一輪中已取得擁有權的連線會被略過
+        if(wakeup){
+            http_conn::take_wakeups(wakeups);
+            for(size_t i = 0; i < wakeups.size(); i++){
+                http_conn* conn = wakeups[i];
+                if(!conn->push_wakeup()){
+                    conn->close_conn();
+                }else if(conn->pipelined()){
+                    pool->append(conn);
                 }
             }
+            wakeups.clear();
         }
     }
     close(epollfd);
+    close(wakefd);
     close(listenfd);
+    if(tls_listenfd >= 0){
+        close(tls_listenfd);
+    }
     delete [] users;
     delete pool;
     return 0;
@@ -0,0 +1,42 @@
+#include "buffer_pool.h"
+
+std::map<int, std::vector<char *>> buffer_pool::m_free;
+locker buffer_pool::m_mutex;
+
+/*
+     優先從對應大小的空閒串列取出，沒有時才配置新的緩衝區
+*/
+char *buffer_pool::acquire(int size)
+{
+     m_mutex.lock();
+     std::vector<char *> &list = m_free[size];
+     if (!list.empty())
+     {
+         char *buf = list.back();
+         list.pop_back();
+         m_mutex.unlock();
+         return buf;
+     }
+     m_mutex.unlock();
+     return new char[size];
+}
+
+/*
+     歸還到對應大小的空閒串列，空閒數量已達上限時直接釋放
+*/
+void buffer_pool::release(char *buf, int size)
+{
+     if (!buf)
+     {
+         return;
+     }
+     m_mutex.lock();
+     std::vector<char *> &list = m_free[size];
+     if ((int)list.size() < MAX_FREE_PER_SIZE)
+     {
+         list.push_back(buf);
+         buf = 0;
+     }
+     m_mutex.unlock();
+     delete[] buf;
+}
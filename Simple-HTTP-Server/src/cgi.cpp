@@ -0,0 +1,1056 @@
+/*
+     非同步cgi：子程序與FastCGI連線的啟動、主執行緒中的pipe讀寫與子程序回收、輸出的標頭解析與串流、逾時處理
+*/
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <spawn.h>
+
+#include "http_conn.h"
+#include "cgi.h"
+#include "log.h"
+
+/*
+     一次cgi執行：子程序（pid > 0）或FastCGI請求（pid為-1，in_fd與out_fd為同一個socket）
+     啟動後只由主執行緒存取，waiters受m_lock保護
+*/
+struct cgi::job
+{
+     std::string key; // 腳本路徑 + '\0' + 請求內容，設定快取時再加上'\0' + 快取鍵
+     pid_t pid;
+     int pidfd; // 子程序結束時可讀，核心不支援時為-1，改由計時器輪詢
+     int in_fd; // 寫入子程序的stdin
+     int out_fd; // 讀取子程序的stdout
+     std::string input; // 請求內容，FastCGI時為編碼後的記錄
+     size_t input_pos;
+     std::string records; // FastCGI尚未解碼的回應記錄
+     std::string head; // 標頭區塊結束前暫存的輸出
+     bool head_sent; // 已送出帶有標頭的第一段
+     bool eof; // 輸出已讀完
+     bool exited; // 子程序已回收，FastCGI時為已收到END_REQUEST
+     int status; // waitpid的狀態或FastCGI的結束碼
+     bool timed_out;
+     time_t deadline;
+     std::shared_ptr<flow> out_flow;
+     std::vector<waiter> waiters;
+     std::shared_ptr<cgi_input> in; // 連線串流送入的請求內容，全部取出或不再寫入後為空
+     std::string cache_key;
+     const cgi_cache::policy *cache; // 未設定快取時為0
+     std::shared_ptr<http_conn::cgi_result> cached; // 累積中的完整輸出，不可快取時為空
+     job();
+};
+
+/*
+     已交給連線但尚未釋放的輸出量，受m_lock保護；片段可能在工作結束後才釋放，因此獨立於工作之外
+*/
+struct cgi::flow
+{
+     size_t pending;
+     int paused_fd; // 因pending過多而暫停讀取的輸出fd，未暫停或工作已結束時為-1
+     unsigned int events; // 恢復時重新設定的事件，FastCGI的socket同時用於寫入請求內容
+     flow() : pending(0), paused_fd(-1), events(0){};
+};
+
+/*
+     連線串流送入的請求內容，受m_lock保護：
+         連線（執行緒池）以feed加入，主執行緒取出後寫入子程序的stdin或編碼為FastCGI的STDIN記錄；
+         累積達MAX_STDIN時連線暫停讀取socket，取出後以http_conn::cgi_resume恢復
+*/
+struct cgi_input
+{
+     std::string data; // 已收到、尚未取出的內容
+     bool closed; // 已收到全部內容（或連線已中斷）
+     cgi::job *j; // 寫入的工作，子程序不再讀取或工作結束後為0，之後送入的內容直接丟棄
+     bool waiting; // 主執行緒已寫完取出的內容，新的內容送入時需重新觸發寫事件
+     http_conn *conn; // 暫停讀取的連線，未暫停時為0
+     unsigned long id;
+     cgi_input() : closed(false), j(0), waiting(false), conn(0), id(0){};
+};
+
+/*
+     片段的刪除器：所有連線都寫出（或丟棄）片段後扣除pending，低於上限時恢復讀取
+     可能在任何執行緒呼叫，呼叫時不可持有m_lock
+*/
+struct cgi::release
+{
+     std::shared_ptr<flow> f;
+     void operator()(http_conn::cgi_result *piece) const
+     {
+         m_lock.lock();
+         f->pending -= piece->output.size();
+         if (f->paused_fd >= 0 && f->pending < MAX_PENDING)
+         {
+             // 邊緣觸發的fd重新設定後，pipe中已有的資料會再產生一次事件，由主執行緒繼續讀取
+             epoll_event event;
+             event.data.fd = f->paused_fd;
+             event.events = f->events;
+             epoll_ctl(m_epollfd, EPOLL_CTL_MOD, f->paused_fd, &event);
+             f->paused_fd = -1;
+         }
+         m_lock.unlock();
+         delete piece;
+     }
+};
+
+cgi::job::job()
+     : pid(-1), pidfd(-1), in_fd(-1), out_fd(-1), input_pos(0), head_sent(false), eof(false), exited(false), status(0),
+       timed_out(false), deadline(0), out_flow(new flow()), cache(0)
+{
+}
+
+int cgi::m_epollfd = -1;
+int cgi::m_timer_fd = -1;
+int cgi::m_timeout = 30;
+std::vector<cgi::job *> cgi::m_fds;
+locker cgi::m_lock;
+std::list<cgi::job *> cgi::m_jobs;
+std::map<std::string, cgi::job *> cgi::m_flight;
+std::vector<std::string> cgi::m_env;
+
+bool cgi::init(int epollfd, int max_fd, int timeout)
+{
+     m_epollfd = epollfd;
+     m_timeout = timeout;
+     m_fds.assign(max_fd, 0);
+     // 子程序的環境變數在啟動時複製一次，每次只需要加上CONTENT_LENGTH
+     for (char **e = environ; *e; ++e)
+     {
+         if (strncmp(*e, "CONTENT_LENGTH=", 15) != 0)
+         {
+             m_env.push_back(*e);
+         }
+     }
+     // 每秒檢查一次逾時，時間上限以秒為單位，不需要更精確的計時
+     m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+     if (m_timer_fd < 0)
+     {
+         return false;
+     }
+     struct itimerspec its = {{1, 0}, {1, 0}};
+     timerfd_settime(m_timer_fd, 0, &its, NULL);
+     epoll_event event;
+     event.data.fd = m_timer_fd;
+     event.events = EPOLLIN;
+     return epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_timer_fd, &event) == 0;
+}
+
+bool cgi::run(http_conn *conn, unsigned long id, int stream, const std::string &file, const std::string &content,
+              fastcgi_pool *pool, const std::string &cache_key, const cgi_cache::policy *cache)
+{
+     waiter w = {conn, id, stream};
+     // 不可快取的腳本可能有副作用（例如每個POST各自新增一筆資料），每個請求各自執行
+     if (!cache)
+     {
+         job *j = new job();
+         j->key = file;
+         j->deadline = time(NULL) + m_timeout;
+         return launch(j, conn ? &w : 0, file, content, content.size(), pool);
+     }
+     // 輸出只存入一個快取鍵，快取鍵不同（例如標頭不同）的請求不可共用
+     std::string key = file;
+     key.push_back('\0');
+     key += content;
+     key.push_back('\0');
+     key += cache_key;
+
+     // 相同的請求正在執行時只登記等待，結果共用；背景更新遇到執行中的相同請求時不需再執行
+     m_lock.lock();
+     std::map<std::string, job *>::iterator it = m_flight.find(key);
+     if (it != m_flight.end())
+     {
+         if (conn)
+         {
+             it->second->waiters.push_back(w);
+         }
+         m_lock.unlock();
+         return true;
+     }
+     job *j = new job();
+     j->key = key;
+     j->deadline = time(NULL) + m_timeout;
+     j->cache_key = cache_key;
+     j->cache = cache;
+     j->cached.reset(new http_conn::cgi_result());
+     m_flight[key] = j;
+     m_lock.unlock();
+     return launch(j, conn ? &w : 0, file, content, content.size(), pool);
+}
+
+std::shared_ptr<cgi_input> cgi::stream(http_conn *conn, unsigned long id, const std::string &file,
+                                       const std::string &content, size_t content_length, fastcgi_pool *pool)
+{
+     waiter w = {conn, id, 0};
+     std::shared_ptr<cgi_input> in(new cgi_input());
+     job *j = new job();
+     j->key = file;
+     j->deadline = time(NULL) + m_timeout;
+     j->in = in;
+     if (!launch(j, &w, file, content, content_length, pool))
+     {
+         return std::shared_ptr<cgi_input>();
+     }
+     return in;
+}
+
+/*
+     啟動子程序或FastCGI請求並註冊到epoll，w為0時沒有等待的連線（快取的背景更新）
+     無法啟動時以500回應已加入的等待者並刪除工作，本請求由呼叫方直接回應
+*/
+bool cgi::launch(job *j, const waiter *w, const std::string &file, const std::string &content, size_t content_length,
+                 fastcgi_pool *pool)
+{
+     bool ok;
+     if (pool)
+     {
+         fastcgi_pool::param_list params;
+         params.push_back(std::make_pair(std::string("SCRIPT_FILENAME"), file));
+         params.push_back(std::make_pair(std::string("REQUEST_METHOD"), std::string("POST")));
+         params.push_back(std::make_pair(std::string("CONTENT_LENGTH"), std::to_string(content_length)));
+         params.push_back(std::make_pair(std::string("GATEWAY_INTERFACE"), std::string("CGI/1.1")));
+         j->in_fd = j->out_fd = pool->begin(params, content.data(), content.size(), j->input, !j->in);
+         ok = j->out_fd >= 0 && (size_t)j->out_fd < m_fds.size();
+     }
+     else
+     {
+         j->input = content;
+         ok = spawn(j, file, content_length);
+     }
+     if (ok)
+     {
+         // 先在目前執行緒寫入，pipe緩衝區放得下的請求不需要再註冊寫事件
+         pump_input(j);
+     }
+
+     m_lock.lock();
+     if (!ok)
+     {
+         std::map<std::string, job *>::iterator it = m_flight.find(j->key);
+         if (it != m_flight.end() && it->second == j)
+         {
+             m_flight.erase(it);
+         }
+         std::vector<waiter> waiters;
+         waiters.swap(j->waiters);
+         m_lock.unlock();
+         if (j->out_fd >= 0)
+         {
+             close(j->out_fd);
+         }
+         std::shared_ptr<http_conn::cgi_result> piece = make_piece(j);
+         piece->code = http_conn::INTERNAL_ERROR;
+         for (size_t i = 0; i < waiters.size(); ++i)
+         {
+             waiters[i].conn->cgi_output(waiters[i].id, waiters[i].stream, piece);
+         }
+         delete j;
+         return false;
+     }
+     if (w)
+     {
+         j->waiters.push_back(*w);
+     }
+     // 註冊後連線才能送入其餘的內容；寫入失敗時已不再需要
+     if (j->in)
+     {
+         j->in->j = j;
+     }
+     m_jobs.push_back(j);
+     // 註冊後事件可能立即在主執行緒中處理；完成需要m_lock，註冊結束前不會釋放此工作
+     if (j->pid > 0)
+     {
+         if (j->in_fd >= 0)
+         {
+             watch(j->in_fd, EPOLLOUT | EPOLLET, j);
+         }
+         watch(j->out_fd, EPOLLIN | EPOLLET, j);
+         if (j->pidfd >= 0)
+         {
+             watch(j->pidfd, EPOLLIN, j);
+         }
+     }
+     else
+     {
+         watch(j->out_fd, EPOLLIN | EPOLLOUT | EPOLLET, j);
+     }
+     m_lock.unlock();
+     return true;
+}
+
+/*
+     以posix_spawn執行cgi程式，stdin與stdout重新導向到非阻塞的pipe
+     glibc以CLONE_VM|CLONE_VFORK建立子程序，不複製伺服器的分頁表，啟動時間與伺服器佔用的記憶體無關；
+     重新導向與關閉繼承的fd都由file actions在子程序中完成，環境變數事先組好，子程序中不配置記憶體
+*/
+bool cgi::spawn(job *j, const std::string &file, size_t content_length)
+{
+     // pipe需close-on-exec，避免同時啟動的其他子程序繼承而使輸出遲遲收不到EOF
+     int cgi_in[2];
+     int cgi_out[2];
+     if (pipe2(cgi_in, O_CLOEXEC) < 0)
+     {
+         return false;
+     }
+     if (pipe2(cgi_out, O_CLOEXEC) < 0)
+     {
+         close(cgi_in[0]);
+         close(cgi_in[1]);
+         return false;
+     }
+
+     // 透過環境變數設定Content-Length傳遞
+     std::string content_env = "CONTENT_LENGTH=" + std::to_string(content_length);
+     std::vector<char *> envp;
+     envp.reserve(m_env.size() + 2);
+     for (size_t i = 0; i < m_env.size(); ++i)
+     {
+         envp.push_back(&m_env[i][0]);
+     }
+     envp.push_back(&content_env[0]);
+     envp.push_back(NULL);
+     char *argv[] = {(char *)file.c_str(), NULL};
+
+     // dup2後的0與1不帶close-on-exec；客戶端連線等未設close-on-exec的fd在exec前全部關閉
+     posix_spawn_file_actions_t actions;
+     posix_spawn_file_actions_init(&actions);
+     posix_spawn_file_actions_adddup2(&actions, cgi_in[0], 0);
+     posix_spawn_file_actions_adddup2(&actions, cgi_out[1], 1);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+     posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+     // 伺服器忽略的SIGPIPE會被exec保留，子程序恢復預設處理並清空信號遮罩
+     posix_spawnattr_t attr;
+     posix_spawnattr_init(&attr);
+     sigset_t sigs;
+     sigemptyset(&sigs);
+     posix_spawnattr_setsigmask(&attr, &sigs);
+     sigaddset(&sigs, SIGPIPE);
+     posix_spawnattr_setsigdefault(&attr, &sigs);
+     posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+     pid_t pid = -1;
+     int err = posix_spawn(&pid, file.c_str(), &actions, &attr, argv, &envp[0]);
+     posix_spawn_file_actions_destroy(&actions);
+     posix_spawnattr_destroy(&attr);
+     if (err != 0)
+     {
+         LOG_ERROR("cgi: spawn %s failed: %s", file.c_str(), strerror(err));
+         pid = -1;
+     }
+     close(cgi_in[0]);
+     close(cgi_out[1]);
+     if (pid < 0)
+     {
+         close(cgi_in[1]);
+         close(cgi_out[0]);
+         return false;
+     }
+     j->pid = pid;
+     j->in_fd = cgi_in[1];
+     j->out_fd = cgi_out[0];
+#ifdef SYS_pidfd_open
+     j->pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+     int max_fd = j->pidfd > j->out_fd ? j->pidfd : j->out_fd;
+     if (j->in_fd > max_fd)
+     {
+         max_fd = j->in_fd;
+     }
+     if ((size_t)max_fd >= m_fds.size())
+     {
+         kill(pid, SIGKILL);
+         waitpid(pid, NULL, 0);
+         close(j->in_fd);
+         close(j->out_fd);
+         if (j->pidfd >= 0)
+         {
+             close(j->pidfd);
+         }
+         j->out_fd = -1;
+         return false;
+     }
+     fcntl(j->in_fd, F_SETFL, fcntl(j->in_fd, F_GETFL) | O_NONBLOCK);
+     fcntl(j->out_fd, F_SETFL, fcntl(j->out_fd, F_GETFL) | O_NONBLOCK);
+     return true;
+}
+
+void cgi::watch(int fd, unsigned int events, job *j)
+{
+     m_fds[fd] = j;
+     epoll_event event;
+     event.data.fd = fd;
+     event.events = events;
+     epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+     移出epoll並關閉fd；fd清除後編號可能立即被其他工作重複使用
+*/
+void cgi::unwatch(int &fd)
+{
+     if (fd < 0)
+     {
+         return;
+     }
+     m_fds[fd] = 0;
+     epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+     close(fd);
+     fd = -1;
+}
+
+bool cgi::handle(int fd, unsigned int events)
+{
+     if (fd == m_timer_fd)
+     {
+         uint64_t ticks;
+         read(m_timer_fd, &ticks, sizeof(ticks));
+         check_timeouts();
+         return true;
+     }
+     if (fd < 0 || (size_t)fd >= m_fds.size() || !m_fds[fd])
+     {
+         return false;
+     }
+     // 事件可能屬於同一輪中已完成的工作而fd已被重複使用，各處理函數在沒有資料時不做任何事
+     job *j = m_fds[fd];
+     if (fd == j->in_fd && (j->input_pos < j->input.size() || j->in))
+     {
+         pump_input(j);
+     }
+     if (fd == j->out_fd)
+     {
+         pump_output(j);
+     }
+     if (fd == j->pidfd)
+     {
+         reap(j);
+     }
+     if (finished(j))
+     {
+         complete(j);
+     }
+     return true;
+}
+
+/*
+     寫入請求內容直到pipe已滿；串流送入時寫完再取出連線送來的內容，尚未送來時等待feed重新觸發
+     全部寫完後關閉子程序的stdin使其讀到EOF
+*/
+void cgi::pump_input(job *j)
+{
+     bool broken = false;
+     while (!broken)
+     {
+         while (j->input_pos < j->input.size())
+         {
+             ssize_t n = write(j->in_fd, j->input.data() + j->input_pos, j->input.size() - j->input_pos);
+             if (n < 0)
+             {
+                 if (errno == EINTR)
+                 {
+                     continue;
+                 }
+                 if (errno == EAGAIN)
+                 {
+                     return;
+                 }
+                 // 子程序不再讀取，其餘內容丟棄
+                 broken = true;
+                 break;
+             }
+             j->input_pos += n;
+         }
+         if (broken || !j->in)
+         {
+             break;
+         }
+         if (!take_input(j))
+         {
+             return;
+         }
+     }
+     detach_input(j);
+     std::string().swap(j->input);
+     j->input_pos = 0;
+     if (j->pid > 0)
+     {
+         if (m_fds[j->in_fd] == j)
+         {
+             unwatch(j->in_fd);
+         }
+         else
+         {
+             close(j->in_fd);
+             j->in_fd = -1;
+         }
+     }
+}
+
+/*
+     取出連線送入的內容放入j->input（FastCGI時編碼為STDIN記錄）；取出後暫停讀取的連線可以繼續
+     全部內容取出後不再需要串流；傳回值：還沒有新的內容時為false，登記等待後由feed重新觸發寫事件
+*/
+bool cgi::take_input(job *j)
+{
+     j->input.clear();
+     j->input_pos = 0;
+     m_lock.lock();
+     cgi_input &in = *j->in;
+     if (j->pid > 0)
+     {
+         j->input.swap(in.data);
+     }
+     else if (!in.data.empty())
+     {
+         fastcgi_pool::add_stdin(j->input, in.data.data(), in.data.size());
+         in.data.clear();
+     }
+     bool closed = in.closed;
+     if (closed)
+     {
+         if (j->pid < 0)
+         {
+             fastcgi_pool::add_stdin(j->input, 0, 0);
+         }
+         in.j = 0;
+     }
+     in.waiting = j->input.empty() && !closed;
+     http_conn *conn = in.conn;
+     unsigned long id = in.id;
+     in.conn = 0;
+     m_lock.unlock();
+     if (closed)
+     {
+         j->in.reset();
+     }
+     if (conn)
+     {
+         conn->cgi_resume(id);
+     }
+     if (j->input.empty())
+     {
+         return closed;
+     }
+     // 時間上限從最後收到內容時起算，上傳較慢的請求不會因此逾時
+     j->deadline = time(NULL) + m_timeout;
+     return true;
+}
+
+/*
+     不再寫入串流送入的內容（子程序已不讀取或工作結束），之後送入的內容丟棄，暫停中的連線恢復讀取以收完訊息體
+*/
+void cgi::detach_input(job *j)
+{
+     if (!j->in)
+     {
+         return;
+     }
+     m_lock.lock();
+     cgi_input &in = *j->in;
+     in.j = 0;
+     in.waiting = false;
+     std::string().swap(in.data);
+     http_conn *conn = in.conn;
+     unsigned long id = in.id;
+     in.conn = 0;
+     m_lock.unlock();
+     j->in.reset();
+     if (conn)
+     {
+         conn->cgi_resume(id);
+     }
+}
+
+/*
+     m_lock內：主執行緒正在等待新的內容，重新設定寫事件，fd可寫時立即觸發
+*/
+void cgi::kick_input(job *j)
+{
+     j->in->waiting = false;
+     epoll_event event;
+     event.data.fd = j->in_fd;
+     event.events = j->pid > 0 ? EPOLLOUT | EPOLLET : EPOLLIN | EPOLLOUT | EPOLLET;
+     epoll_ctl(m_epollfd, EPOLL_CTL_MOD, j->in_fd, &event);
+}
+
+bool cgi::feed(const std::shared_ptr<cgi_input> &in, const char *data, size_t len, bool last, http_conn *conn,
+               unsigned long id)
+{
+     bool room = true;
+     m_lock.lock();
+     in->closed = last;
+     if (in->j)
+     {
+         in->data.append(data, len);
+         if (in->waiting && (!in->data.empty() || last))
+         {
+             kick_input(in->j);
+         }
+         if (in->data.size() >= MAX_STDIN)
+         {
+             in->conn = conn;
+             in->id = id;
+             room = false;
+         }
+     }
+     m_lock.unlock();
+     return room;
+}
+
+void cgi::close_input(const std::shared_ptr<cgi_input> &in)
+{
+     m_lock.lock();
+     in->closed = true;
+     in->conn = 0;
+     if (in->j && in->waiting)
+     {
+         kick_input(in->j);
+     }
+     m_lock.unlock();
+}
+
+/*
+     讀出所有可讀的輸出並交給連線，FastCGI的回應記錄在此解碼
+     連線尚未寫出的輸出過多時停止讀取，pipe寫滿後子程序也隨之暫停，片段釋放後由release恢復
+*/
+void cgi::pump_output(job *j)
+{
+     char buf[16 * 1024];
+     std::string data;
+     while (true)
+     {
+         if (data.size() >= MAX_PIECE)
+         {
+             output(j, data);
+         }
+         if (paused(j, data.size()))
+         {
+             break;
+         }
+         ssize_t n = read(j->out_fd, buf, sizeof(buf));
+         if (n > 0)
+         {
+             if (j->pid > 0)
+             {
+                 data.append(buf, n);
+                 continue;
+             }
+             j->records.append(buf, n);
+             unsigned int app_status = 0;
+             if (fastcgi_pool::parse(j->records, data, app_status))
+             {
+                 j->exited = true;
+                 j->status = app_status;
+                 break;
+             }
+             continue;
+         }
+         if (n < 0 && errno == EINTR)
+         {
+             continue;
+         }
+         if (n < 0 && errno == EAGAIN)
+         {
+             break;
+         }
+         j->eof = true;
+         break;
+     }
+     // 輸出已結束但還沒送出標頭時留給complete，失敗的程式仍能回覆500而不是中斷的回應
+     if (!j->head_sent && (j->eof || j->exited))
+     {
+         j->head += data;
+     }
+     else
+     {
+         output(j, data);
+     }
+     if (j->pid < 0)
+     {
+         if (j->eof || j->exited)
+         {
+             detach_input(j);
+             unwatch(j->out_fd);
+             j->in_fd = -1;
+         }
+         return;
+     }
+     if (j->eof)
+     {
+         unwatch(j->out_fd);
+         if (j->pidfd < 0)
+         {
+             reap(j);
+         }
+     }
+}
+
+/*
+     pending加上還沒交出的extra達到上限時暫停：記錄fd，之後由release重新觸發讀事件
+*/
+bool cgi::paused(job *j, size_t extra)
+{
+     m_lock.lock();
+     bool full = j->out_flow->pending + extra >= MAX_PENDING;
+     if (full)
+     {
+         j->out_flow->paused_fd = j->out_fd;
+         j->out_flow->events = j->pid > 0 ? EPOLLIN | EPOLLET : EPOLLIN | EPOLLOUT | EPOLLET;
+     }
+     m_lock.unlock();
+     return full;
+}
+
+std::shared_ptr<http_conn::cgi_result> cgi::make_piece(job *j)
+{
+     release r = {j->out_flow};
+     return std::shared_ptr<http_conn::cgi_result>(new http_conn::cgi_result(), r);
+}
+
+/*
+     將讀到的輸出交給連線，data交出後清空
+     標頭區塊結束前先暫存，結束後第一段帶著解析出的標頭與其後的訊息體送出
+*/
+void cgi::output(job *j, std::string &data)
+{
+     if (!j->head_sent)
+     {
+         j->head += data;
+         data.clear();
+         std::shared_ptr<http_conn::cgi_result> piece = make_piece(j);
+         size_t body_start;
+         if (!parse_head(j->head, false, *piece, body_start))
+         {
+             return;
+         }
+         piece->last = false;
+         piece->output.assign(j->head, body_start, std::string::npos);
+         std::string().swap(j->head);
+         j->head_sent = true;
+         deliver(j, piece);
+         return;
+     }
+     if (data.empty())
+     {
+         return;
+     }
+     std::shared_ptr<http_conn::cgi_result> piece = make_piece(j);
+     piece->head = false;
+     piece->last = false;
+     piece->output.swap(data);
+     deliver(j, piece);
+}
+
+/*
+     將片段交給所有等待的連線；送出第一段後不再讓相同的請求加入，之後加入的請求無法取得已送出的輸出
+*/
+void cgi::deliver(job *j, const std::shared_ptr<http_conn::cgi_result> &piece)
+{
+     if (j->cached)
+     {
+         remember(j, *piece);
+     }
+     m_lock.lock();
+     if (piece->head)
+     {
+         std::map<std::string, job *>::iterator it = m_flight.find(j->key);
+         if (it != m_flight.end() && it->second == j)
+         {
+             m_flight.erase(it);
+         }
+     }
+     j->out_flow->pending += piece->output.size();
+     std::vector<waiter> waiters(j->waiters);
+     m_lock.unlock();
+     for (size_t i = 0; i < waiters.size(); ++i)
+     {
+         waiters[i].conn->cgi_output(waiters[i].id, waiters[i].stream, piece);
+     }
+}
+
+/*
+     累積要存入快取的輸出；失敗、超過cgi_cache::MAX_SIZE、
+     或腳本以Cache-Control禁止共用、設定Cookie（因請求者而異的輸出）時放棄
+*/
+void cgi::remember(job *j, const http_conn::cgi_result &piece)
+{
+     http_conn::cgi_result &r = *j->cached;
+     if (piece.code != http_conn::CGI_REQUEST || r.output.size() + piece.output.size() > cgi_cache::MAX_SIZE)
+     {
+         j->cached.reset();
+         return;
+     }
+     if (piece.head)
+     {
+         for (size_t i = 0; i < piece.headers.size(); ++i)
+         {
+             const std::string &name = piece.headers[i].first;
+             const std::string &value = piece.headers[i].second;
+             if (name == "set-cookie" ||
+                 (name == "cache-control" && (strcasestr(value.c_str(), "no-store") ||
+                                              strcasestr(value.c_str(), "no-cache") ||
+                                              strcasestr(value.c_str(), "private"))))
+             {
+                 j->cached.reset();
+                 return;
+             }
+         }
+         r.status = piece.status;
+         r.reason = piece.reason;
+         r.header_lines = piece.header_lines;
+         r.headers = piece.headers;
+     }
+     r.output += piece.output;
+}
+
+/* RFC 7230的token字元 */
+static bool is_tchar(char c)
+{
+     return isalnum((unsigned char)c) || strchr("!#$%&'*+-.^_`|~", c) != 0;
+}
+
+/*
+     解析cgi輸出開頭的標頭區塊（RFC 3875）：「名稱: 值」的各行，以空行結束，行尾可為\n或\r\n
+     第一行就不是標頭、區塊中沒有Content-Type、Location或Status、或超過MAX_HEAD時，整段輸出視為訊息體（不輸出標頭的腳本）
+     Status設定狀態碼，只有Location時為302；連線相關的標頭與Content-Length、Date由伺服器決定，不轉送
+     傳回值：已能判斷時為true，piece的標頭已設定，body_start為訊息體在buf中的起點；需要更多輸出時為false（eof時一定為true）
+*/
+bool cgi::parse_head(const std::string &buf, bool eof, http_conn::cgi_result &piece, size_t &body_start)
+{
+     // 各行的名稱起點、名稱結尾（冒號）、值的起點與結尾
+     struct field
+     {
+         size_t name, colon, value, end;
+     };
+     std::vector<field> fields;
+     bool cgi_field = false;
+     size_t pos = 0;
+     body_start = 0;
+     while (true)
+     {
+         size_t lf = buf.find('\n', pos);
+         size_t end = lf == std::string::npos ? buf.size() : lf;
+         if (end > MAX_HEAD)
+         {
+             return true;
+         }
+         if (lf == std::string::npos)
+         {
+             // 不完整的一行：名稱中出現token以外的字元時已可判斷不是標頭
+             size_t i = pos;
+             while (i < end && is_tchar(buf[i]))
+             {
+                 ++i;
+             }
+             return eof || (i < end && (i == pos || buf[i] != ':'));
+         }
+         if (end > pos && buf[end - 1] == '\r')
+         {
+             --end;
+         }
+         if (end == pos)
+         {
+             if (!cgi_field)
+             {
+                 return true;
+             }
+             body_start = lf + 1;
+             break;
+         }
+         field f = {pos, pos, 0, end};
+         while (f.colon < end && is_tchar(buf[f.colon]))
+         {
+             ++f.colon;
+         }
+         if (f.colon == pos || f.colon == end || buf[f.colon] != ':')
+         {
+             return true;
+         }
+         f.value = f.colon + 1;
+         while (f.value < end && (buf[f.value] == ' ' || buf[f.value] == '\t'))
+         {
+             ++f.value;
+         }
+         while (f.end > f.value && (buf[f.end - 1] == ' ' || buf[f.end - 1] == '\t'))
+         {
+             --f.end;
+         }
+         size_t len = f.colon - f.name;
+         if ((len == 12 && strncasecmp(&buf[pos], "content-type", len) == 0) ||
+             (len == 8 && strncasecmp(&buf[pos], "location", len) == 0) ||
+             (len == 6 && strncasecmp(&buf[pos], "status", len) == 0))
+         {
+             cgi_field = true;
+         }
+         fields.push_back(f);
+         pos = lf + 1;
+     }
+
+     bool has_status = false;
+     bool has_location = false;
+     for (size_t i = 0; i < fields.size(); ++i)
+     {
+         const field &f = fields[i];
+         std::string name(buf, f.name, f.colon - f.name);
+         for (size_t k = 0; k < name.size(); ++k)
+         {
+             name[k] = tolower((unsigned char)name[k]);
+         }
+         std::string value(buf, f.value, f.end - f.value);
+         if (name == "status")
+         {
+             // 「Status: 404 Not Found」，格式錯誤時忽略
+             if (value.size() >= 3 && value[0] >= '1' && value[0] <= '5' && isdigit((unsigned char)value[1]) &&
+                 isdigit((unsigned char)value[2]) && (value.size() == 3 || value[3] == ' '))
+             {
+                 piece.status = atoi(value.substr(0, 3).c_str());
+                 piece.reason = value.size() > 4 ? value.substr(4) : std::string();
+                 has_status = true;
+             }
+             continue;
+         }
+         if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade" ||
+             name == "content-length" || name == "date" || value.find('\r') != std::string::npos)
+         {
+             continue;
+         }
+         has_location = has_location || name == "location";
+         // HTTP/1.1保留原本的名稱大小寫，HTTP/2的名稱必須是小寫
+         piece.header_lines.append(buf, f.name, f.colon - f.name);
+         piece.header_lines += ": ";
+         piece.header_lines += value;
+         piece.header_lines += "\r\n";
+         piece.headers.push_back(std::make_pair(name, value));
+     }
+     if (has_location && !has_status)
+     {
+         piece.status = 302;
+         piece.reason = "Found";
+     }
+     return true;
+}
+
+/*
+     回收已結束的子程序
+*/
+void cgi::reap(job *j)
+{
+     int status = 0;
+     pid_t ret = waitpid(j->pid, &status, WNOHANG);
+     if (ret == 0 || (ret < 0 && errno == EINTR))
+     {
+         return;
+     }
+     j->exited = true;
+     j->status = ret == j->pid ? status : -1;
+     unwatch(j->pidfd);
+}
+
+/*
+     子程序已回收且輸出已讀完（逾時被強制結束時不等待輸出），FastCGI收到END_REQUEST或連線中斷
+*/
+bool cgi::finished(const job *j)
+{
+     if (j->pid > 0)
+     {
+         return j->exited && (j->eof || j->timed_out);
+     }
+     return j->exited || j->eof || j->timed_out;
+}
+
+/*
+     主執行緒：釋放工作的資源，將最後一段交給所有等待的連線；設定快取且成功時存入完整的輸出
+     尚未送出標頭時，成功則連同暫存的輸出一次送出，失敗則以錯誤回應取代；已送出標頭後失敗時由連線中斷回應
+*/
+void cgi::complete(job *j)
+{
+     m_lock.lock();
+     m_jobs.remove(j);
+     // fd即將關閉，之後釋放的片段不可再重新設定
+     j->out_flow->paused_fd = -1;
+     m_lock.unlock();
+
+     detach_input(j);
+     if (j->in_fd != j->out_fd)
+     {
+         unwatch(j->in_fd);
+     }
+     unwatch(j->out_fd);
+     j->in_fd = -1;
+     unwatch(j->pidfd);
+
+     std::shared_ptr<http_conn::cgi_result> piece = make_piece(j);
+     if (j->timed_out)
+     {
+         piece->code = http_conn::GATEWAY_TIMEOUT;
+     }
+     else if (j->exited && j->status == 0)
+     {
+         piece->code = http_conn::CGI_REQUEST;
+     }
+     else
+     {
+         piece->code = http_conn::INTERNAL_ERROR;
+     }
+     if (j->head_sent)
+     {
+         piece->head = false;
+     }
+     else if (piece->code == http_conn::CGI_REQUEST)
+     {
+         size_t body_start;
+         parse_head(j->head, true, *piece, body_start);
+         piece->output.assign(j->head, body_start, std::string::npos);
+     }
+     // 尚未送出標頭時此段就是第一段，deliver在登記的鎖內移出m_flight，之後不會再有請求加入
+     deliver(j, piece);
+     if (j->cached)
+     {
+         cgi_cache::store(j->cache_key, *j->cache, j->cached);
+     }
+     else if (j->cache)
+     {
+         cgi_cache::abandon(j->cache_key);
+     }
+     delete j;
+}
+
+/*
+     計時器：超過時間上限的子程序以SIGKILL結束，FastCGI請求直接中斷連線；
+     沒有pidfd時也在此輪詢回收子程序
+*/
+void cgi::check_timeouts()
+{
+     time_t now = time(NULL);
+     std::vector<job *> due;
+     m_lock.lock();
+     for (std::list<job *>::iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+     {
+         job *j = *it;
+         if (j->deadline <= now || (j->pid > 0 && j->pidfd < 0))
+         {
+             due.push_back(j);
+         }
+     }
+     m_lock.unlock();
+
+     for (size_t i = 0; i < due.size(); ++i)
+     {
+         job *j = due[i];
+         if (j->pid > 0 && j->pidfd < 0 && !j->exited)
+         {
+             reap(j);
+         }
+         if (j->deadline <= now && !j->timed_out && !finished(j))
+         {
+             j->timed_out = true;
+             LOG_WARNING("cgi: %s timed out after %d seconds", j->key.c_str(), m_timeout);
+             if (j->pid > 0 && !j->exited)
+             {
+                 kill(j->pid, SIGKILL);
+             }
+         }
+         if (finished(j))
+         {
+             complete(j);
+         }
+     }
+}
@@ -0,0 +1,133 @@
+/*
+     cgi輸出快取：依腳本設定的ttl與stale期間保存完整的輸出，
+         stale期間回覆舊的輸出並只讓一個請求在背景更新；項目數達上限時先清除已無法使用的項目，再淘汰最早失效的一項
+*/
+#include <openssl/evp.h>
+
+#include "cgi_cache.h"
+
+std::map<std::string, cgi_cache::policy> cgi_cache::m_policies;
+std::map<std::string, cgi_cache::entry> cgi_cache::m_entries;
+locker cgi_cache::m_mutex;
+
+void cgi_cache::configure(const std::string &file, int ttl, int stale, const std::vector<std::string> &vary)
+{
+     policy &p = m_policies[file];
+     p.ttl = ttl;
+     p.stale = stale;
+     p.vary = vary;
+}
+
+const cgi_cache::policy *cgi_cache::find(const std::string &file)
+{
+     std::map<std::string, policy>::const_iterator it = m_policies.find(file);
+     return it == m_policies.end() ? 0 : &it->second;
+}
+
+std::string cgi_cache::key(const std::string &url, const std::vector<const char *> &values, const char *body,
+                           size_t len)
+{
+     std::string k = url;
+     k.push_back('\0');
+     for (size_t i = 0; i < values.size(); ++i)
+     {
+         if (values[i])
+         {
+             k += values[i];
+         }
+         k.push_back('\0');
+     }
+     // 訊息體以摘要代替，快取鍵的長度與請求大小無關
+     unsigned char digest[EVP_MAX_MD_SIZE];
+     unsigned int digest_len = 0;
+     EVP_Digest(body, len, digest, &digest_len, EVP_sha256(), NULL);
+     k.append((const char *)digest, digest_len);
+     return k;
+}
+
+/*
+     未過期時直接傳回；stale期間傳回舊的輸出，第一個請求負責更新；超過stale期間時刪除
+*/
+std::shared_ptr<http_conn::cgi_result> cgi_cache::lookup(const std::string &key, bool &refresh)
+{
+     std::shared_ptr<http_conn::cgi_result> result;
+     refresh = false;
+     time_t now = time(NULL);
+     m_mutex.lock();
+     std::map<std::string, entry>::iterator it = m_entries.find(key);
+     if (it != m_entries.end())
+     {
+         entry &e = it->second;
+         if (now < e.expire)
+         {
+             result = e.result;
+         }
+         else if (now < e.stale_until)
+         {
+             result = e.result;
+             refresh = !e.refreshing;
+             e.refreshing = true;
+         }
+         else
+         {
+             m_entries.erase(it);
+         }
+     }
+     m_mutex.unlock();
+     return result;
+}
+
+void cgi_cache::store(const std::string &key, const policy &p, const std::shared_ptr<http_conn::cgi_result> &result)
+{
+     entry e;
+     e.result = result;
+     e.expire = time(NULL) + p.ttl;
+     e.stale_until = e.expire + p.stale;
+     e.refreshing = false;
+
+     m_mutex.lock();
+     if (m_entries.size() >= MAX_ENTRIES && m_entries.find(key) == m_entries.end())
+     {
+         evict(time(NULL));
+     }
+     m_entries[key] = e;
+     m_mutex.unlock();
+}
+
+/*
+     騰出一個位置：刪除所有超過stale期間的項目；都還可使用時刪除stale_until最早的一項
+     呼叫方需持有m_mutex
+*/
+void cgi_cache::evict(time_t now)
+{
+     std::map<std::string, entry>::iterator oldest = m_entries.end();
+     std::map<std::string, entry>::iterator it = m_entries.begin();
+     while (it != m_entries.end())
+     {
+         if (now >= it->second.stale_until)
+         {
+             it = m_entries.erase(it);
+             continue;
+         }
+         if (oldest == m_entries.end() || it->second.stale_until < oldest->second.stale_until)
+         {
+             oldest = it;
+         }
+         ++it;
+     }
+     if (m_entries.size() >= MAX_ENTRIES && oldest != m_entries.end())
+     {
+         m_entries.erase(oldest);
+     }
+}
+
+void cgi_cache::abandon(const std::string &key)
+{
+     m_mutex.lock();
+     std::map<std::string, entry>::iterator it = m_entries.find(key);
+     if (it != m_entries.end())
+     {
+         it->second.refreshing = false;
+     }
+     m_mutex.unlock();
+}
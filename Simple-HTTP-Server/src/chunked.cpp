@@ -0,0 +1,161 @@
+/*
+     chunked訊息體的增量解碼：
+         分段格式逐位元組以狀態機處理，資料區整段以memmove搬到輸出位置，
+         解碼結果不依賴輸入在哪裡被切開
+*/
+#include <string.h>
+
+#include "chunked.h"
+
+void chunked_decoder::reset()
+{
+     m_state = SIZE;
+     m_size = 0;
+     m_digits = 0;
+     m_line_len = 0;
+}
+
+chunked_decoder::STATUS chunked_decoder::decode(const char *in, size_t len, char *out, size_t &consumed,
+                                                size_t &out_len)
+{
+     size_t i = 0;
+     out_len = 0;
+     while (i < len && m_state != FINISHED && m_state != FAILED)
+     {
+         if (m_state == DATA)
+         {
+             size_t n = len - i;
+             if (n > m_size)
+             {
+                 n = m_size;
+             }
+             if (out + out_len != in + i)
+             {
+                 memmove(out + out_len, in + i, n);
+             }
+             out_len += n;
+             i += n;
+             m_size -= n;
+             if (m_size == 0)
+             {
+                 m_state = DATA_CR;
+             }
+             continue;
+         }
+         char c = in[i++];
+         switch (m_state)
+         {
+         case SIZE:
+         {
+             int v = -1;
+             if (c >= '0' && c <= '9')
+             {
+                 v = c - '0';
+             }
+             else if (c >= 'a' && c <= 'f')
+             {
+                 v = c - 'a' + 10;
+             }
+             else if (c >= 'A' && c <= 'F')
+             {
+                 v = c - 'A' + 10;
+             }
+             if (v >= 0)
+             {
+                 // 15位十六進位已超過任何可接受的大小，避免溢位
+                 if (++m_digits > 15)
+                 {
+                     m_state = FAILED;
+                     break;
+                 }
+                 m_size = m_size * 16 + v;
+             }
+             else if (m_digits == 0)
+             {
+                 m_state = FAILED;
+             }
+             else if (c == ';' || c == ' ' || c == '\t')
+             {
+                 m_line_len = m_digits + 1;
+                 m_state = EXT;
+             }
+             else
+             {
+                 m_state = c == '\r' ? SIZE_LF : FAILED;
+             }
+             break;
+         }
+         case EXT:
+         {
+             if (c == '\r')
+             {
+                 m_state = SIZE_LF;
+             }
+             else if (c == '\n' || ++m_line_len > MAX_LINE)
+             {
+                 m_state = FAILED;
+             }
+             break;
+         }
+         case SIZE_LF:
+         {
+             if (c != '\n')
+             {
+                 m_state = FAILED;
+                 break;
+             }
+             m_digits = 0;
+             m_state = m_size == 0 ? TRAILER_START : DATA;
+             break;
+         }
+         case DATA_CR:
+         {
+             m_state = c == '\r' ? DATA_LF : FAILED;
+             break;
+         }
+         case DATA_LF:
+         {
+             m_state = c == '\n' ? SIZE : FAILED;
+             break;
+         }
+         case TRAILER_START:
+         {
+             // trailer標頭直接略過，遇到空白行結束
+             m_line_len = 1;
+             m_state = c == '\r' ? END_LF : (c == '\n' ? FAILED : TRAILER);
+             break;
+         }
+         case TRAILER:
+         {
+             if (c == '\r')
+             {
+                 m_state = TRAILER_LF;
+             }
+             else if (c == '\n' || ++m_line_len > MAX_LINE)
+             {
+                 m_state = FAILED;
+             }
+             break;
+         }
+         case TRAILER_LF:
+         {
+             m_state = c == '\n' ? TRAILER_START : FAILED;
+             break;
+         }
+         case END_LF:
+         {
+             m_state = c == '\n' ? FINISHED : FAILED;
+             break;
+         }
+         default:
+             m_state = FAILED;
+             break;
+         }
+     }
+     consumed = i;
+     if (m_state == FINISHED)
+     {
+         return DONE;
+     }
+     return m_state == FAILED ? BAD : MORE;
+}
@@ -0,0 +1,277 @@
+/*
+     FastCGI程式池：worker的啟動與重啟，以及請求與回應的記錄編解碼
+*/
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "fastcgi.h"
+#include "log.h"
+
+fastcgi_pool::fastcgi_pool(const std::vector<std::string> &argv, int workers)
+     : m_argv(argv), m_workers(workers), m_pids(workers, -1), m_started(workers, 0), m_listen_fd(-1), m_addr_len(0),
+       m_max_fd(0)
+{
+     for (size_t i = 0; i < m_argv.size(); ++i)
+     {
+         m_exec_argv.push_back(&m_argv[i][0]);
+     }
+     m_exec_argv.push_back(0);
+}
+
+fastcgi_pool::~fastcgi_pool()
+{
+     for (int i = 0; i < m_workers; ++i)
+     {
+         if (m_pids[i] > 0)
+         {
+             kill(m_pids[i], SIGTERM);
+         }
+     }
+     if (m_listen_fd >= 0)
+     {
+         close(m_listen_fd);
+     }
+}
+
+bool fastcgi_pool::start()
+{
+     if (m_argv.empty() || access(m_argv[0].c_str(), X_OK) < 0)
+     {
+         LOG_ERROR("fastcgi: worker %s is not executable", m_argv.empty() ? "" : m_argv[0].c_str());
+         return false;
+     }
+     m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+     if (m_listen_fd < 0)
+     {
+         return false;
+     }
+     // 只指定位址族時核心自動配置唯一的抽象位址，不會在檔案系統留下socket檔
+     memset(&m_addr, 0, sizeof(m_addr));
+     m_addr.sun_family = AF_UNIX;
+     m_addr_len = sizeof(m_addr);
+     if (bind(m_listen_fd, (sockaddr *)&m_addr, sizeof(sa_family_t)) < 0 || listen(m_listen_fd, SOMAXCONN) < 0 ||
+         getsockname(m_listen_fd, (sockaddr *)&m_addr, &m_addr_len) < 0)
+     {
+         close(m_listen_fd);
+         m_listen_fd = -1;
+         return false;
+     }
+     struct rlimit rl;
+     m_max_fd = (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) ? rl.rlim_cur : 65536;
+
+     for (int i = 0; i < m_workers; ++i)
+     {
+         spawn(i);
+     }
+     pthread_t tid;
+     if (pthread_create(&tid, NULL, monitor, this) != 0)
+     {
+         return false;
+     }
+     pthread_detach(tid);
+     return true;
+}
+
+/*
+     啟動第slot個worker：監聽socket成為fd 0，其餘繼承的fd（客戶端連線等）全部關閉
+*/
+void fastcgi_pool::spawn(int slot)
+{
+     m_started[slot] = time(NULL);
+     pid_t pid = fork();
+     if (pid == 0)
+     {
+         dup2(m_listen_fd, 0);
+#ifdef SYS_close_range
+         if (syscall(SYS_close_range, 3, ~0U, 0) < 0)
+#endif
+         {
+             for (int fd = 3; fd < m_max_fd; ++fd)
+             {
+                 close(fd);
+             }
+         }
+         execv(m_exec_argv[0], &m_exec_argv[0]);
+         _exit(127);
+     }
+     m_pids[slot] = pid;
+     if (pid < 0)
+     {
+         LOG_ERROR("fastcgi: fork %s failed: %s", m_argv[0].c_str(), strerror(errno));
+     }
+}
+
+/*
+     定期回收結束的worker並重新啟動，啟動後1秒內就結束的worker延後重啟，避免反覆fork
+*/
+void *fastcgi_pool::monitor(void *arg)
+{
+     fastcgi_pool *pool = (fastcgi_pool *)arg;
+     while (true)
+     {
+         usleep(100 * 1000);
+         for (int i = 0; i < pool->m_workers; ++i)
+         {
+             pid_t pid = pool->m_pids[i];
+             if (pid > 0 && waitpid(pid, NULL, WNOHANG) == 0)
+             {
+                 continue;
+             }
+             if (pid > 0)
+             {
+                 LOG_WARNING("fastcgi: worker %d exited, respawning", pid);
+                 pool->m_pids[i] = -1;
+             }
+             if (time(NULL) - pool->m_started[i] >= 1)
+             {
+                 pool->spawn(i);
+             }
+         }
+     }
+     return NULL;
+}
+
+void fastcgi_pool::put_header(std::string &out, int type, int length, int padding)
+{
+     // version, type, requestId（固定為1）, contentLength, paddingLength, reserved
+     char h[HEADER_LEN] = {VERSION_1, (char)type, 0, 1, (char)(length >> 8), (char)length, (char)padding, 0};
+     out.append(h, HEADER_LEN);
+}
+
+/*
+     將資料切成不超過MAX_CONTENT的記錄，len為0時送出表示結束的空記錄
+*/
+void fastcgi_pool::put_record(std::string &out, int type, const char *data, size_t len)
+{
+     do
+     {
+         size_t n = len < (size_t)MAX_CONTENT ? len : MAX_CONTENT;
+         // 記錄長度補齊到8的倍數
+         int padding = (8 - n % 8) % 8;
+         put_header(out, type, n, padding);
+         out.append(data, n);
+         out.append(padding, '\0');
+         data += n;
+         len -= n;
+     } while (len > 0);
+}
+
+/* 名稱與值的長度：小於128時1位元組，否則4位元組且最高位元為1 */
+void fastcgi_pool::put_length(std::string &out, size_t len)
+{
+     if (len < 128)
+     {
+         out.push_back((char)len);
+         return;
+     }
+     out.push_back((char)(0x80 | (len >> 24)));
+     out.push_back((char)(len >> 16));
+     out.push_back((char)(len >> 8));
+     out.push_back((char)len);
+}
+
+int fastcgi_pool::begin(const param_list &params, const char *body, size_t len, std::string &msg, bool last)
+{
+     // 本機的Unix socket只有監聽佇列全滿時connect才會等待，連上後再改為非阻塞
+     int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+     if (fd < 0)
+     {
+         return -1;
+     }
+     if (connect(fd, (sockaddr *)&m_addr, m_addr_len) < 0)
+     {
+         close(fd);
+         return -1;
+     }
+     fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+     // 整個請求組成一次送出：BEGIN_REQUEST、PARAMS、空PARAMS、STDIN、空STDIN（訊息體收完時）
+     msg.reserve(256 + len + len / MAX_CONTENT * HEADER_LEN);
+     put_header(msg, BEGIN_REQUEST, 8, 0);
+     const char begin[8] = {0, RESPONDER, 0, 0, 0, 0, 0, 0};
+     msg.append(begin, sizeof(begin));
+     std::string pairs;
+     for (size_t i = 0; i < params.size(); ++i)
+     {
+         put_length(pairs, params[i].first.size());
+         put_length(pairs, params[i].second.size());
+         pairs += params[i].first;
+         pairs += params[i].second;
+     }
+     put_record(msg, PARAMS, pairs.data(), pairs.size());
+     if (!pairs.empty())
+     {
+         put_record(msg, PARAMS, 0, 0);
+     }
+     if (!last)
+     {
+         // 空記錄表示訊息體結束，尚未收完時只送出已有的部分
+         if (len > 0)
+         {
+             put_record(msg, STDIN, body, len);
+         }
+         return fd;
+     }
+     put_record(msg, STDIN, body, len);
+     if (len > 0)
+     {
+         put_record(msg, STDIN, 0, 0);
+     }
+     return fd;
+}
+
+void fastcgi_pool::add_stdin(std::string &out, const char *data, size_t len)
+{
+     put_record(out, STDIN, data, len);
+}
+
+bool fastcgi_pool::parse(std::string &in, std::string &out, unsigned int &app_status)
+{
+     size_t pos = 0;
+     bool ended = false;
+     while (!ended && in.size() - pos >= (size_t)HEADER_LEN)
+     {
+         const unsigned char *h = (const unsigned char *)in.data() + pos;
+         size_t n = (h[4] << 8) | h[5];
+         if (in.size() - pos < HEADER_LEN + n + h[6])
+         {
+             break;
+         }
+         const char *content = in.data() + pos + HEADER_LEN;
+         switch (h[1])
+         {
+         case STDOUT:
+             out.append(content, n);
+             break;
+         case STDERR:
+             if (n > 0)
+             {
+                 LOG_WARNING("fastcgi stderr: %.*s", (int)n, content);
+             }
+             break;
+         case END_REQUEST:
+             ended = true;
+             if (n >= 4)
+             {
+                 uint32_t v;
+                 memcpy(&v, content, sizeof(v));
+                 app_status = ntohl(v);
+             }
+             break;
+         default:
+             break;
+         }
+         pos += HEADER_LEN + n + h[6];
+     }
+     in.erase(0, pos);
+     return ended;
+}
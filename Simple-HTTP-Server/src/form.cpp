@@ -0,0 +1,446 @@
+/*
+     表單：
+         POST到已註冊路徑的表單以form_parser串流解析，訊息體與PUT上傳相同，
+         已讀入緩衝區的部分先送入解析器，其餘由process_upload從socket讀出後分段送入；
+         處理器產生的回應與cgi輸出相同，以chunked編碼送出
+*/
+#include <strings.h>
+#include <algorithm>
+
+#include "http_conn.h"
+#include "form.h"
+#include "url.h"
+#include "log.h"
+
+std::map<std::string, form_factory> form::m_handlers;
+
+void form::add_handler(const std::string &path, form_factory factory)
+{
+     m_handlers[path] = factory;
+}
+
+form_factory form::find_handler(const char *path)
+{
+     std::map<std::string, form_factory>::const_iterator it = m_handlers.find(path);
+     return it == m_handlers.end() ? 0 : it->second;
+}
+
+/*
+     在"; key=value; ..."形式的標頭值中取得key的值，值可為token或引號字串
+*/
+static bool header_param(const char *p, const char *end, const char *key, std::string &value)
+{
+     size_t key_len = strlen(key);
+     while (p < end)
+     {
+         const char *semi = (const char *)memchr(p, ';', end - p);
+         if (!semi)
+         {
+             return false;
+         }
+         p = semi + 1;
+         while (p < end && (*p == ' ' || *p == '\t'))
+         {
+             ++p;
+         }
+         const char *eq = (const char *)memchr(p, '=', end - p);
+         if (!eq)
+         {
+             return false;
+         }
+         bool match = (size_t)(eq - p) == key_len && strncasecmp(p, key, key_len) == 0;
+         p = eq + 1;
+         std::string v;
+         if (p < end && *p == '"')
+         {
+             // 引號字串，\之後的字元原樣保留
+             for (++p; p < end && *p != '"'; ++p)
+             {
+                 if (*p == '\\' && p + 1 < end)
+                 {
+                     ++p;
+                 }
+                 v.push_back(*p);
+             }
+             if (p < end)
+             {
+                 ++p;
+             }
+         }
+         else
+         {
+             const char *stop = p;
+             while (stop < end && *stop != ';' && *stop != ' ' && *stop != '\t')
+             {
+                 ++stop;
+             }
+             v.assign(p, stop - p);
+             p = stop;
+         }
+         if (match)
+         {
+             value.swap(v);
+             return true;
+         }
+     }
+     return false;
+}
+
+form_parser::form_parser(form_handler *handler)
+     : m_handler(handler), m_type(URLENCODED), m_state(URL_NAME), m_has_name(false), m_is_file(false)
+{
+}
+
+form_parser::~form_parser()
+{
+     delete m_handler;
+}
+
+bool form_parser::init(const char *content_type)
+{
+     static const char urlencoded[] = "application/x-www-form-urlencoded";
+     static const char multipart[] = "multipart/form-data";
+     if (!content_type)
+     {
+         return false;
+     }
+     const char *end = content_type + strlen(content_type);
+     if (strncasecmp(content_type, urlencoded, sizeof(urlencoded) - 1) == 0)
+     {
+         m_type = URLENCODED;
+         m_state = URL_NAME;
+         return true;
+     }
+     std::string boundary;
+     if (strncasecmp(content_type, multipart, sizeof(multipart) - 1) != 0 ||
+         !header_param(content_type, end, "boundary", boundary) || boundary.empty() || boundary.size() > 70)
+     {
+         return false;
+     }
+     m_type = MULTIPART;
+     m_state = PART_PREAMBLE;
+     m_delimiter = "\r\n--" + boundary;
+     // 第一個分隔線可以在訊息體最開頭，前面補上\r\n後與其餘分隔線相同
+     m_pending = "\r\n";
+     return true;
+}
+
+bool form_parser::feed(const char *data, size_t len)
+{
+     return m_type == URLENCODED ? feed_urlencoded(data, len) : feed_multipart(data, len);
+}
+
+bool form_parser::finish()
+{
+     if (m_type == URLENCODED)
+     {
+         url_field();
+         return true;
+     }
+     return m_state == PART_END;
+}
+
+/*
+     名稱與值以原始形式累積，遇到&時解碼後交給處理器
+*/
+bool form_parser::feed_urlencoded(const char *data, size_t len)
+{
+     const char *end = data + len;
+     while (data < end)
+     {
+         const char *stop = data;
+         if (m_state == URL_NAME)
+         {
+             while (stop < end && *stop != '=' && *stop != '&')
+             {
+                 ++stop;
+             }
+         }
+         else
+         {
+             stop = (const char *)memchr(data, '&', end - data);
+             if (!stop)
+             {
+                 stop = end;
+             }
+         }
+         std::string &field = m_state == URL_NAME ? m_name : m_value;
+         field.append(data, stop - data);
+         if (field.size() > MAX_FIELD_SIZE)
+         {
+             return false;
+         }
+         if (stop == end)
+         {
+             break;
+         }
+         if (*stop == '=')
+         {
+             m_state = URL_VALUE;
+         }
+         else
+         {
+             url_field();
+         }
+         data = stop + 1;
+     }
+     return true;
+}
+
+void form_parser::url_field()
+{
+     // 略過空的欄位（例如&&）
+     if (!m_name.empty() || m_state == URL_VALUE)
+     {
+         url::decode_form(m_name);
+         url::decode_form(m_value);
+         m_handler->on_field(m_name, m_value);
+     }
+     m_name.clear();
+     m_value.clear();
+     m_state = URL_NAME;
+}
+
+/*
+     在未處理的資料中尋找分隔線：找到前的內容交給目前的部分，
+     找不到時保留最後不足一個分隔線長度的資料，其餘可確定不屬於分隔線而先送出
+*/
+bool form_parser::feed_multipart(const char *data, size_t len)
+{
+     m_pending.append(data, len);
+     size_t pos = 0;
+     bool more = true;
+     while (more)
+     {
+         size_t avail = m_pending.size() - pos;
+         switch (m_state)
+         {
+         case PART_PREAMBLE:
+         case PART_DATA:
+         {
+             const char *base = m_pending.data() + pos;
+             const char *hit = (const char *)memmem(base, avail, m_delimiter.data(), m_delimiter.size());
+             size_t n = hit ? hit - base : (avail >= m_delimiter.size() ? avail - m_delimiter.size() + 1 : 0);
+             if (m_state == PART_DATA && n > 0 && !part_data(base, n))
+             {
+                 return false;
+             }
+             pos += n;
+             if (!hit)
+             {
+                 more = false;
+                 break;
+             }
+             if (m_state == PART_DATA)
+             {
+                 part_end();
+             }
+             pos += m_delimiter.size();
+             m_state = PART_DELIMITER;
+             break;
+         }
+         case PART_DELIMITER:
+         {
+             // 結束分隔線之後為"--"，其餘分隔線之後可有空白，再以\r\n結束
+             if (avail < 2)
+             {
+                 more = false;
+                 break;
+             }
+             if (m_pending[pos] == '-' && m_pending[pos + 1] == '-')
+             {
+                 pos += 2;
+                 m_state = PART_END;
+                 break;
+             }
+             size_t eol = m_pending.find("\r\n", pos);
+             if (eol == std::string::npos)
+             {
+                 if (avail > MAX_PART_HEADER)
+                 {
+                     return false;
+                 }
+                 more = false;
+                 break;
+             }
+             if (m_pending.find_first_not_of(" \t", pos) != eol)
+             {
+                 return false;
+             }
+             pos = eol + 2;
+             m_name.clear();
+             m_value.clear();
+             m_filename.clear();
+             m_content_type.clear();
+             m_has_name = false;
+             m_is_file = false;
+             m_state = PART_HEADER;
+             break;
+         }
+         case PART_HEADER:
+         {
+             size_t eol = m_pending.find("\r\n", pos);
+             if (eol == std::string::npos)
+             {
+                 if (avail > MAX_PART_HEADER)
+                 {
+                     return false;
+                 }
+                 more = false;
+                 break;
+             }
+             if (eol == pos)
+             {
+                 // 標頭結束，每個部分都必須有名稱
+                 if (!m_has_name)
+                 {
+                     return false;
+                 }
+                 if (m_is_file)
+                 {
+                     m_handler->on_file_begin(m_name, m_filename, m_content_type);
+                 }
+                 pos += 2;
+                 m_state = PART_DATA;
+                 break;
+             }
+             if (!part_header(m_pending.data() + pos, eol - pos))
+             {
+                 return false;
+             }
+             pos = eol + 2;
+             break;
+         }
+         case PART_END:
+         { // 結束分隔線之後的資料忽略
+             pos = m_pending.size();
+             more = false;
+             break;
+         }
+         default:
+             return false;
+         }
+     }
+     m_pending.erase(0, pos);
+     return true;
+}
+
+/*
+     部分的標頭只處理Content-Disposition與Content-Type
+*/
+bool form_parser::part_header(const char *line, size_t len)
+{
+     static const char disposition[] = "Content-Disposition";
+     static const char type[] = "Content-Type";
+     const char *end = line + len;
+     const char *colon = (const char *)memchr(line, ':', len);
+     if (!colon)
+     {
+         return false;
+     }
+     const char *value = colon + 1;
+     while (value < end && (*value == ' ' || *value == '\t'))
+     {
+         ++value;
+     }
+     size_t name_len = colon - line;
+     if (name_len == sizeof(disposition) - 1 && strncasecmp(line, disposition, name_len) == 0)
+     {
+         if (end - value < 9 || strncasecmp(value, "form-data", 9) != 0)
+         {
+             return false;
+         }
+         m_has_name = header_param(value, end, "name", m_name);
+         m_is_file = header_param(value, end, "filename", m_filename);
+     }
+     else if (name_len == sizeof(type) - 1 && strncasecmp(line, type, name_len) == 0)
+     {
+         m_content_type.assign(value, end - value);
+     }
+     return true;
+}
+
+bool form_parser::part_data(const char *data, size_t len)
+{
+     if (m_is_file)
+     {
+         m_handler->on_file_data(data, len);
+         return true;
+     }
+     m_value.append(data, len);
+     return m_value.size() <= MAX_FIELD_SIZE;
+}
+
+void form_parser::part_end()
+{
+     if (m_is_file)
+     {
+         m_handler->on_file_end();
+     }
+     else
+     {
+         m_handler->on_field(m_name, m_value);
+     }
+}
+
+/*
+     建立解析器並送入緩衝區中已有的訊息體
+     傳回值：
+         訊息體已完整：CGI_REQUEST
+         尚未收完：UPLOAD_REQUEST，之後由process_upload繼續
+         其餘為錯誤
+*/
+http_conn::HTTP_CODE http_conn::do_form_request(form_factory factory)
+{
+     form_parser *parser = new form_parser(factory());
+     if (!parser->init(m_content_type))
+     {
+         delete parser;
+         bad_request();
+         return BAD_REQUEST;
+     }
+     m_form = parser;
+
+     // Content-Length的訊息體在此之前只讀入了一部分；chunked與HTTP/2的訊息體已完整
+     const char *body = m_content_data;
+     size_t have = m_content_length;
+     if (m_upload_left > 0)
+     {
+         body = m_read_buf + m_check_idx;
+         have = std::min((long long)(m_read_idx - m_check_idx), m_upload_left);
+         m_upload_left -= have;
+         m_request_end = m_check_idx + have;
+     }
+     if (have > 0 && !m_form->feed(body, have))
+     {
+         abort_upload();
+         bad_request();
+         return BAD_REQUEST;
+     }
+     if (m_upload_left == 0)
+     {
+         return finish_form();
+     }
+     return UPLOAD_REQUEST;
+}
+
+/*
+     訊息體收完：由處理器產生回應
+*/
+http_conn::HTTP_CODE http_conn::finish_form()
+{
+     form_parser *parser = m_form;
+     m_form = 0;
+     if (!parser->finish())
+     {
+         delete parser;
+         return BAD_REQUEST;
+     }
+     std::shared_ptr<cgi_result> res(new cgi_result());
+     res->code = CGI_REQUEST;
+     parser->handler()->on_complete(res->output);
+     res->set_content_type(parser->handler()->content_type());
+     delete parser;
+     m_cgi = res;
+     return CGI_REQUEST;
+}
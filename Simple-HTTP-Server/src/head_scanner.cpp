@@ -0,0 +1,235 @@
+#include "head_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEAD_SCANNER_X86 1
+#endif
+
+/*
+     結構索引中的字元：行尾與請求行、標頭的分隔字元
+*/
+static inline bool is_mark(char c)
+{
+     return c == '\r' || c == '\n' || c == ' ' || c == '\t' || c == ':';
+}
+
+/*
+     從p[i]開始逐位元組建立索引，out中已有count個偏移；用於不支援SIMD的平台與各實作的尾端
+*/
+static size_t index_tail(const char *p, size_t i, size_t n, int *out, size_t count, size_t max, size_t &scanned)
+{
+     for (; i < n; ++i)
+     {
+         if (is_mark(p[i]))
+         {
+             out[count++] = i;
+             if (count == max)
+             {
+                 scanned = i + 1;
+                 return count;
+             }
+         }
+     }
+     scanned = n;
+     return count;
+}
+
+static size_t index_scalar(const char *p, size_t n, int *out, size_t max, size_t &scanned)
+{
+     return index_tail(p, 0, n, out, 0, max, scanned);
+}
+
+/*
+     逐位元組尋找URL中需要處理的字元，p[n]為字串結尾，可安全地讀取p[i + 1]
+*/
+static size_t find_url_scalar(const char *p, size_t n)
+{
+     for (size_t i = 0; i < n; ++i)
+     {
+         char c = p[i];
+         if (c == '%' || c == '?' || c == '#' || (c == '/' && (p[i + 1] == '/' || p[i + 1] == '.')))
+         {
+             return i;
+         }
+     }
+     return n;
+}
+
+#ifdef HEAD_SCANNER_X86
+/*
+     SSE4.2：pcmpestrm以「等於任一字元」模式一次比對16個位元組，取得符合位置的位元遮罩
+*/
+__attribute__((target("sse4.2")))
+static size_t index_sse42(const char *p, size_t n, int *out, size_t max, size_t &scanned)
+{
+     const __m128i set = _mm_setr_epi8('\r', '\n', ' ', '\t', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+     size_t count = 0;
+     size_t i = 0;
+     for (; i + 16 <= n; i += 16)
+     {
+         __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+         unsigned int mask = (unsigned int)_mm_cvtsi128_si32(
+             _mm_cmpestrm(set, 5, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+         while (mask)
+         {
+             size_t off = i + __builtin_ctz(mask);
+             out[count++] = off;
+             if (count == max)
+             {
+                 scanned = off + 1;
+                 return count;
+             }
+             mask &= mask - 1;
+         }
+     }
+     return index_tail(p, i, n, out, count, max, scanned);
+}
+
+/*
+     AVX2：每次比對32個位元組，五個字元的比對結果合併後依序取出置位的位元
+*/
+__attribute__((target("avx2")))
+static size_t index_avx2(const char *p, size_t n, int *out, size_t max, size_t &scanned)
+{
+     const __m256i cr = _mm256_set1_epi8('\r');
+     const __m256i lf = _mm256_set1_epi8('\n');
+     const __m256i sp = _mm256_set1_epi8(' ');
+     const __m256i tab = _mm256_set1_epi8('\t');
+     const __m256i colon = _mm256_set1_epi8(':');
+     size_t count = 0;
+     size_t i = 0;
+     for (; i + 32 <= n; i += 32)
+     {
+         __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+         __m256i eol = _mm256_or_si256(_mm256_cmpeq_epi8(block, cr), _mm256_cmpeq_epi8(block, lf));
+         __m256i sep = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, sp), _mm256_cmpeq_epi8(block, tab)),
+                                       _mm256_cmpeq_epi8(block, colon));
+         unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(eol, sep));
+         while (mask)
+         {
+             size_t off = i + __builtin_ctz(mask);
+             out[count++] = off;
+             if (count == max)
+             {
+                 scanned = off + 1;
+                 return count;
+             }
+             mask &= mask - 1;
+         }
+     }
+     return index_tail(p, i, n, out, count, max, scanned);
+}
+
+/*
+     URL特殊字元（SSE4.2機器上以SSE2比對）：
+         同時載入錯開一個位元組的區塊，/的位置與下一個位元組是/或.的位置取交集，
+         再與%、?、#的位置合併
+*/
+__attribute__((target("sse4.2")))
+static size_t find_url_sse42(const char *p, size_t n)
+{
+     const __m128i slash = _mm_set1_epi8('/');
+     const __m128i dot = _mm_set1_epi8('.');
+     const __m128i percent = _mm_set1_epi8('%');
+     const __m128i question = _mm_set1_epi8('?');
+     const __m128i hash = _mm_set1_epi8('#');
+     size_t i = 0;
+     for (; i + 16 <= n; i += 16)
+     {
+         __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+         __m128i next = _mm_loadu_si128((const __m128i *)(p + i + 1));
+         __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, percent), _mm_cmpeq_epi8(block, question)),
+                                        _mm_cmpeq_epi8(block, hash));
+         __m128i segment = _mm_and_si128(_mm_cmpeq_epi8(block, slash),
+                                         _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot)));
+         unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(special, segment));
+         if (mask)
+         {
+             return i + __builtin_ctz(mask);
+         }
+     }
+     return i + find_url_scalar(p + i, n - i);
+}
+
+/*
+     URL特殊字元，AVX2每次比對32個位元組
+*/
+__attribute__((target("avx2")))
+static size_t find_url_avx2(const char *p, size_t n)
+{
+     const __m256i slash = _mm256_set1_epi8('/');
+     const __m256i dot = _mm256_set1_epi8('.');
+     const __m256i percent = _mm256_set1_epi8('%');
+     const __m256i question = _mm256_set1_epi8('?');
+     const __m256i hash = _mm256_set1_epi8('#');
+     size_t i = 0;
+     for (; i + 32 <= n; i += 32)
+     {
+         __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+         __m256i next = _mm256_loadu_si256((const __m256i *)(p + i + 1));
+         __m256i special = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(block, percent), _mm256_cmpeq_epi8(block, question)),
+                                           _mm256_cmpeq_epi8(block, hash));
+         __m256i segment = _mm256_and_si256(_mm256_cmpeq_epi8(block, slash),
+                                            _mm256_or_si256(_mm256_cmpeq_epi8(next, slash), _mm256_cmpeq_epi8(next, dot)));
+         unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(special, segment));
+         if (mask)
+         {
+             return i + __builtin_ctz(mask);
+         }
+     }
+     return i + find_url_scalar(p + i, n - i);
+}
+#endif
+
+head_scanner::index_func head_scanner::m_index = head_scanner::select_impl();
+head_scanner::find_url_func head_scanner::m_find_url = head_scanner::select_url_impl();
+
+/*
+     依CPU支援的指令集選擇實作，只在程式啟動時執行一次
+*/
+head_scanner::index_func head_scanner::select_impl()
+{
+#ifdef HEAD_SCANNER_X86
+     __builtin_cpu_init();
+     if (__builtin_cpu_supports("avx2"))
+     {
+         return index_avx2;
+     }
+     if (__builtin_cpu_supports("sse4.2"))
+     {
+         return index_sse42;
+     }
+#endif
+     return index_scalar;
+}
+
+head_scanner::find_url_func head_scanner::select_url_impl()
+{
+#ifdef HEAD_SCANNER_X86
+     __builtin_cpu_init();
+     if (__builtin_cpu_supports("avx2"))
+     {
+         return find_url_avx2;
+     }
+     if (__builtin_cpu_supports("sse4.2"))
+     {
+         return find_url_sse42;
+     }
+#endif
+     return find_url_scalar;
+}
+
+const char *head_scanner::impl_name()
+{
+#ifdef HEAD_SCANNER_X86
+     if (m_index == index_avx2)
+     {
+         return "avx2";
+     }
+     if (m_index == index_sse42)
+     {
+         return "sse4.2";
+     }
+#endif
+     return "scalar";
+}
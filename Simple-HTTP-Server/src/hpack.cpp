@@ -0,0 +1,395 @@
+#include <string.h>
+
+#include "hpack.h"
+
+/* 靜態表（RFC 7541 附錄A），索引由1開始 */
+static const char *static_table[][2] = {
+     {":authority", ""},
+     {":method", "GET"},
+     {":method", "POST"},
+     {":path", "/"},
+     {":path", "/index.html"},
+     {":scheme", "http"},
+     {":scheme", "https"},
+     {":status", "200"},
+     {":status", "204"},
+     {":status", "206"},
+     {":status", "304"},
+     {":status", "400"},
+     {":status", "404"},
+     {":status", "500"},
+     {"accept-charset", ""},
+     {"accept-encoding", "gzip, deflate"},
+     {"accept-language", ""},
+     {"accept-ranges", ""},
+     {"accept", ""},
+     {"access-control-allow-origin", ""},
+     {"age", ""},
+     {"allow", ""},
+     {"authorization", ""},
+     {"cache-control", ""},
+     {"content-disposition", ""},
+     {"content-encoding", ""},
+     {"content-language", ""},
+     {"content-length", ""},
+     {"content-location", ""},
+     {"content-range", ""},
+     {"content-type", ""},
+     {"cookie", ""},
+     {"date", ""},
+     {"etag", ""},
+     {"expect", ""},
+     {"expires", ""},
+     {"from", ""},
+     {"host", ""},
+     {"if-match", ""},
+     {"if-modified-since", ""},
+     {"if-none-match", ""},
+     {"if-range", ""},
+     {"if-unmodified-since", ""},
+     {"last-modified", ""},
+     {"link", ""},
+     {"location", ""},
+     {"max-forwards", ""},
+     {"proxy-authenticate", ""},
+     {"proxy-authorization", ""},
+     {"range", ""},
+     {"referer", ""},
+     {"refresh", ""},
+     {"retry-after", ""},
+     {"server", ""},
+     {"set-cookie", ""},
+     {"strict-transport-security", ""},
+     {"transfer-encoding", ""},
+     {"user-agent", ""},
+     {"vary", ""},
+     {"via", ""},
+     {"www-authenticate", ""}
+};
+static const unsigned long STATIC_TABLE_SIZE = sizeof(static_table) / sizeof(static_table[0]);
+
+/* Huffman編碼表（RFC 7541 附錄B），{編碼, 位元數}，最後一項為EOS */
+static const struct
+{
+     unsigned int code;
+     int bits;
+} huffman_codes[257] = {
+     {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+     {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28}, {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+     {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+     {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+     {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12}, {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+     {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+     {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+     {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8}, {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+     {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+     {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+     {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7}, {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+     {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+     {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+     {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7}, {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+     {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+     {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+     {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20}, {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+     {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+     {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+     {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23}, {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+     {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+     {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+     {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21}, {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+     {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+     {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+     {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27}, {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+     {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+     {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+     {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21}, {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+     {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+     {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+     {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27}, {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+     {0x3fffffff, 30}
+};
+
+/*
+     Huffman解碼樹，第一次使用時由編碼表建立
+     每個節點有0、1兩個子節點，葉節點記錄符號
+*/
+struct huffman_tree
+{
+     short next[513][2];
+     short sym[513];
+
+     huffman_tree()
+     {
+         memset(next, 0, sizeof(next));
+         memset(sym, -1, sizeof(sym));
+         int count = 1;
+         for (int s = 0; s < 257; ++s)
+         {
+             int node = 0;
+             for (int i = huffman_codes[s].bits - 1; i >= 0; --i)
+             {
+                 int bit = (huffman_codes[s].code >> i) & 1;
+                 if (next[node][bit] == 0)
+                 {
+                     next[node][bit] = count++;
+                 }
+                 node = next[node][bit];
+             }
+             sym[node] = s;
+         }
+     }
+};
+
+bool hpack::huffman_decode(const unsigned char *p, size_t len, std::string &s)
+{
+     static const huffman_tree tree;
+     int node = 0;
+     int pad_bits = 0; // 最後一個符號之後讀入的位元數
+     bool pad_ones = true; // 這些位元是否全為1
+     for (size_t i = 0; i < len; ++i)
+     {
+         for (int b = 7; b >= 0; --b)
+         {
+             int bit = (p[i] >> b) & 1;
+             node = tree.next[node][bit];
+             if (node == 0)
+             {
+                 return false;
+             }
+             ++pad_bits;
+             pad_ones = pad_ones && bit;
+             if (tree.sym[node] >= 0)
+             {
+                 if (tree.sym[node] == 256)
+                 {
+                     // 字串中不得出現EOS
+                     return false;
+                 }
+                 s.push_back((char)tree.sym[node]);
+                 node = 0;
+                 pad_bits = 0;
+                 pad_ones = true;
+             }
+         }
+     }
+     // 結尾的填充需為EOS的前綴（全為1）且不超過7位元
+     return pad_bits <= 7 && pad_ones;
+}
+
+bool hpack::decode_int(const unsigned char *&p, const unsigned char *end, int prefix, unsigned long &v)
+{
+     if (p >= end)
+     {
+         return false;
+     }
+     unsigned long mask = (1UL << prefix) - 1;
+     v = *p++ & mask;
+     if (v < mask)
+     {
+         return true;
+     }
+     int m = 0;
+     while (p < end)
+     {
+         unsigned char b = *p++;
+         v += (unsigned long)(b & 0x7f) << m;
+         if (!(b & 0x80))
+         {
+             return true;
+         }
+         m += 7;
+         if (m > 28)
+         {
+             // 超過合理範圍，視為格式錯誤
+             return false;
+         }
+     }
+     return false;
+}
+
+bool hpack::decode_string(const unsigned char *&p, const unsigned char *end, std::string &s)
+{
+     if (p >= end)
+     {
+         return false;
+     }
+     bool huffman = *p & 0x80;
+     unsigned long len = 0;
+     if (!decode_int(p, end, 7, len) || len > (unsigned long)(end - p))
+     {
+         return false;
+     }
+     s.clear();
+     if (huffman)
+     {
+         if (!huffman_decode(p, len, s))
+         {
+             return false;
+         }
+     }
+     else
+     {
+         s.assign((const char *)p, len);
+     }
+     p += len;
+     return true;
+}
+
+bool hpack::lookup(unsigned long index, std::pair<std::string, std::string> &field)
+{
+     if (index == 0)
+     {
+         return false;
+     }
+     if (index <= STATIC_TABLE_SIZE)
+     {
+         field.first = static_table[index - 1][0];
+         field.second = static_table[index - 1][1];
+         return true;
+     }
+     index -= STATIC_TABLE_SIZE + 1;
+     if (index >= m_dynamic.size())
+     {
+         return false;
+     }
+     field = m_dynamic[index];
+     return true;
+}
+
+/*
+     加入動態表，必要時先淘汰最舊的項目；單一項目超過上限時清空整個表
+*/
+void hpack::insert(const std::pair<std::string, std::string> &field)
+{
+     size_t size = field.first.size() + field.second.size() + 32;
+     if (size > m_max_size)
+     {
+         evict(0);
+         return;
+     }
+     evict(m_max_size - size);
+     m_dynamic.push_front(field);
+     m_size += size;
+}
+
+void hpack::evict(size_t limit)
+{
+     while (m_size > limit && !m_dynamic.empty())
+     {
+         m_size -= m_dynamic.back().first.size() + m_dynamic.back().second.size() + 32;
+         m_dynamic.pop_back();
+     }
+}
+
+bool hpack::decode(const unsigned char *data, size_t len, header_list &headers)
+{
+     const unsigned char *p = data;
+     const unsigned char *end = data + len;
+     std::pair<std::string, std::string> field;
+     while (p < end)
+     {
+         unsigned char b = *p;
+         unsigned long index = 0;
+         if (b & 0x80)
+         { // 索引標頭
+             if (!decode_int(p, end, 7, index) || !lookup(index, field))
+             {
+                 return false;
+             }
+             headers.push_back(field);
+             continue;
+         }
+         if ((b & 0xe0) == 0x20)
+         { // 動態表大小更新，不得超過我們宣告的上限
+             if (!decode_int(p, end, 5, index) || index > DEFAULT_TABLE_SIZE)
+             {
+                 return false;
+             }
+             m_max_size = index;
+             evict(m_max_size);
+             continue;
+         }
+         // 字面值：01加入索引（6位元前綴），0000不加入索引、0001永不索引（4位元前綴）
+         bool indexing = (b & 0xc0) == 0x40;
+         if (!decode_int(p, end, indexing ? 6 : 4, index))
+         {
+             return false;
+         }
+         if (index)
+         {
+             if (!lookup(index, field))
+             {
+                 return false;
+             }
+         }
+         else if (!decode_string(p, end, field.first))
+         {
+             return false;
+         }
+         if (!decode_string(p, end, field.second))
+         {
+             return false;
+         }
+         headers.push_back(field);
+         if (indexing)
+         {
+             insert(field);
+         }
+     }
+     return true;
+}
+
+int hpack::encode_int(char *out, int prefix, unsigned char first, unsigned long v)
+{
+     unsigned long mask = (1UL << prefix) - 1;
+     if (v < mask)
+     {
+         out[0] = first | v;
+         return 1;
+     }
+     out[0] = first | mask;
+     v -= mask;
+     int n = 1;
+     while (v >= 128)
+     {
+         out[n++] = (v & 0x7f) | 0x80;
+         v >>= 7;
+     }
+     out[n++] = v;
+     return n;
+}
+
+int hpack::encode_status(char *out, int status)
+{
+     // 靜態表中已有的狀態碼直接以索引表示
+     static const int indexed[][2] = {{200, 8}, {204, 9}, {206, 10}, {304, 11}, {400, 12}, {404, 13}, {500, 14}};
+     for (size_t i = 0; i < sizeof(indexed) / sizeof(indexed[0]); ++i)
+     {
+         if (indexed[i][0] == status)
+         {
+             return encode_int(out, 7, 0x80, indexed[i][1]);
+         }
+     }
+     char value[3] = {(char)('0' + status / 100 % 10), (char)('0' + status / 10 % 10), (char)('0' + status % 10)};
+     return encode_header(out, IDX_STATUS, value, 3);
+}
+
+int hpack::encode_header(char *out, int name_index, const char *value, size_t len)
+{
+     int n = encode_int(out, 4, 0x00, name_index);
+     n += encode_int(out + n, 7, 0x00, len);
+     memcpy(out + n, value, len);
+     return n + len;
+}
+
+int hpack::encode_literal(char *out, const char *name, size_t name_len, const char *value, size_t len)
+{
+     // 不加入動態表、名稱不使用索引（0000 0000），名稱與值都不使用Huffman編碼
+     int n = encode_int(out, 4, 0x00, 0);
+     n += encode_int(out + n, 7, 0x00, name_len);
+     memcpy(out + n, name, name_len);
+     n += name_len;
+     n += encode_int(out + n, 7, 0x00, len);
+     memcpy(out + n, value, len);
+     return n + len;
+}
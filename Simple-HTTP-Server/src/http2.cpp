@@ -0,0 +1,1071 @@
+/*
+     http_conn的HTTP/2（h2c）部分：
+         連線前言或Upgrade: h2c之後，讀取緩衝區中的資料改以訊框解析，
+         每個串流的請求交給與HTTP/1.1相同的dispatch_request處理，
+         回應的DATA訊框依流量控制窗口分批寫出，訊息體仍以iovec直接引用檔案映射或cgi輸出
+*/
+#include "http_conn.h"
+#include "http_format.h"
+#include "log.h"
+
+extern const char *method_names[];
+
+static const char connection_preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const char switching_protocols[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+/*
+     base64url解碼（HTTP2-Settings標頭），結尾的填充可省略
+*/
+static bool base64url_decode(const char *in, std::string &out)
+{
+     unsigned int acc = 0;
+     int bits = 0;
+     for (; *in && *in != '='; ++in)
+     {
+         int c = *in;
+         int v;
+         if (c >= 'A' && c <= 'Z')
+         {
+             v = c - 'A';
+         }
+         else if (c >= 'a' && c <= 'z')
+         {
+             v = c - 'a' + 26;
+         }
+         else if (c >= '0' && c <= '9')
+         {
+             v = c - '0' + 52;
+         }
+         else if (c == '-')
+         {
+             v = 62;
+         }
+         else if (c == '_')
+         {
+             v = 63;
+         }
+         else
+         {
+             return false;
+         }
+         acc = (acc << 6) | v;
+         bits += 6;
+         if (bits >= 8)
+         {
+             bits -= 8;
+             out.push_back((char)((acc >> bits) & 0xff));
+         }
+     }
+     return true;
+}
+
+/*
+     連線開頭是否為HTTP/2連線前言（prior knowledge）
+     至少收到"PRI "才判斷，避免與以P開頭的HTTP/1.1方法混淆
+*/
+bool http_conn::h2_preface()
+{
+     int n = m_read_idx < http2_session::PREFACE_LEN ? m_read_idx : http2_session::PREFACE_LEN;
+     return n >= 4 && memcmp(m_read_buf, connection_preface, n) == 0;
+}
+
+/*
+     切換為HTTP/2，並送出伺服器前言（SETTINGS）
+*/
+void http_conn::h2_start()
+{
+     m_h2.reset(new http2_session());
+     char frame[http2_session::FRAME_HEADER_LEN + 6];
+     http2_session::put_frame_header(frame, 6, http2_session::SETTINGS, 0, 0);
+     frame[9] = 0;
+     frame[10] = http2_session::SETTINGS_MAX_CONCURRENT_STREAMS;
+     http2_session::put_uint32(frame + 11, http2_session::MAX_CONCURRENT_STREAMS);
+     h2_send(frame, sizeof(frame));
+}
+
+/*
+     HTTP/1.1請求帶Upgrade: h2c與HTTP2-Settings時，回覆101並切換為HTTP/2，
+     該請求的處理結果ret成為串流1的回應
+     傳回值：是否已升級
+*/
+bool http_conn::h2_upgrade(HTTP_CODE ret)
+{
+     if (ret == BAD_REQUEST || ret == ENTITY_TOO_LARGE || ret == HEADER_TOO_LARGE)
+     {
+         return false;
+     }
+     const char *upgrade = m_headers.get(http_headers::HDR_UPGRADE);
+     const char *settings = m_headers.get(http_headers::HDR_HTTP2_SETTINGS);
+     if (!upgrade || !settings || strcasecmp(upgrade, "h2c") != 0)
+     {
+         return false;
+     }
+     std::string payload;
+     if (!base64url_decode(settings, payload) || payload.size() % 6 != 0)
+     {
+         return false;
+     }
+     h2_send(switching_protocols, sizeof(switching_protocols) - 1);
+     h2_start();
+     if (!h2_settings((const unsigned char *)payload.data(), payload.size()))
+     {
+         return true;
+     }
+     // 升級的請求已完整讀入，串流1直接進入半關閉（遠端）狀態
+     http2_stream s(1, m_h2->initial_window);
+     s.method = method_names[m_method];
+     s.path = m_url;
+     s.end_stream = true;
+     // 之後讀取緩衝區改放訊框，請求標頭需複製到串流（名稱轉小寫，與HPACK解碼的結果一致），
+     // 串流1的cgi完成或重新整理快取時，Vary與Cookie等標頭仍可取得
+     for (int i = 0; i < m_headers.count(); ++i)
+     {
+         std::string name(m_headers.name(i), m_headers.name_len(i));
+         for (size_t j = 0; j < name.size(); ++j)
+         {
+             name[j] = tolower((unsigned char)name[j]);
+         }
+         // 連線層級的標頭在HTTP/2中不存在
+         if (name == "connection" || name == "upgrade" || name == "http2-settings" || name == "keep-alive" ||
+             name == "transfer-encoding")
+         {
+             continue;
+         }
+         s.headers.push_back(std::make_pair(name, std::string(m_headers.value(i), m_headers.value_len(i))));
+     }
+     const char *content_type = m_headers.get(http_headers::HDR_CONTENT_TYPE);
+     if (content_type)
+     {
+         s.content_type = content_type;
+     }
+     m_h2->last_stream_id = 1;
+     http2_stream &stream = m_h2->streams.insert(std::make_pair(1, s)).first->second;
+     // cgi在背景執行時，完成後由cgi_deliver回應串流1
+     if (ret != CGI_PENDING)
+     {
+         h2_respond(stream, ret);
+     }
+     return true;
+}
+
+/*
+     處理線程的HTTP/2版本：
+         解析讀取緩衝區中所有完整的訊框，處理完成的請求，再依窗口送出回應資料
+         寫入緩衝區或iovec即將用盡時停止解析，剩餘訊框留到這批寫完後再處理
+*/
+void http_conn::process_h2()
+{
+     http2_session &h2 = *m_h2;
+     int pos = 0;
+     if (!h2.preface_done)
+     {
+         int n = m_read_idx < http2_session::PREFACE_LEN ? m_read_idx : http2_session::PREFACE_LEN;
+         if (memcmp(m_read_buf, connection_preface, n) != 0)
+         {
+             h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         else if (n == http2_session::PREFACE_LEN)
+         {
+             h2.preface_done = true;
+             pos = n;
+         }
+     }
+     while (h2.preface_done && !h2.closing && h2_has_room())
+     {
+         if (m_read_idx - pos < http2_session::FRAME_HEADER_LEN)
+         {
+             break;
+         }
+         const unsigned char *p = (const unsigned char *)m_read_buf + pos;
+         int len = (p[0] << 16) | (p[1] << 8) | p[2];
+         if (len > http2_session::DEFAULT_MAX_FRAME_SIZE)
+         {
+             h2_goaway(http2_session::FRAME_SIZE_ERROR);
+             break;
+         }
+         if (m_read_idx - pos < http2_session::FRAME_HEADER_LEN + len)
+         {
+             break;
+         }
+         int stream_id = http2_session::get_uint32(p + 5) & http2_session::MAX_WINDOW;
+         if (!h2_frame(p[3], p[4], stream_id, p + http2_session::FRAME_HEADER_LEN, len))
+         {
+             break;
+         }
+         pos += http2_session::FRAME_HEADER_LEN + len;
+     }
+
+     // 已處理的訊框移出讀取緩衝區
+     int left = m_read_idx - pos;
+     if (pos > 0 && left > 0)
+     {
+         memmove(m_read_buf, m_read_buf + pos, left);
+     }
+     m_read_idx = left;
+     shrink_read_buf(left);
+
+     h2_flush();
+     m_batch_linger = !h2.closing;
+     if (m_bytes_to_send == 0)
+     {
+         if (!rearm())
+         {
+             close_conn();
+         }
+         return;
+     }
+     modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
+
+/*
+     寫入緩衝區與iovec是否還能容納處理一個訊框所產生的回應
+*/
+bool http_conn::h2_has_room()
+{
+     return WRITE_BUFFER_SIZE - m_write_idx >= 256 && m_iv_count + 4 <= 3 * MAX_BATCH_REQUESTS &&
+            m_batch_count < MAX_BATCH_REQUESTS;
+}
+
+/*
+     處理一個完整的訊框
+     傳回值：false表示發生連線錯誤，已送出GOAWAY
+*/
+bool http_conn::h2_frame(int type, int flags, int stream_id, const unsigned char *payload, int len)
+{
+     http2_session &h2 = *m_h2;
+     // 標頭區塊未結束時，只能接著收到同一串流的CONTINUATION
+     if (h2.continuation_stream && (type != http2_session::CONTINUATION || stream_id != h2.continuation_stream))
+     {
+         return h2_goaway(http2_session::PROTOCOL_ERROR);
+     }
+     switch (type)
+     {
+     case http2_session::DATA:
+         return h2_data(flags, stream_id, payload, len);
+
+     case http2_session::HEADERS:
+         return h2_headers(flags, stream_id, payload, len);
+
+     case http2_session::CONTINUATION:
+     {
+         if (!h2.continuation_stream)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         if (h2.header_block.size() + len > (size_t)m_read_buffer_limit)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         h2.header_block.append((const char *)payload, len);
+         if (flags & http2_session::FLAG_END_HEADERS)
+         {
+             return h2_end_headers();
+         }
+         return true;
+     }
+
+     case http2_session::PRIORITY:
+     { // 不支援優先順序，只檢查格式
+         if (stream_id == 0)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         if (len != 5)
+         {
+             h2_reset(stream_id, http2_session::FRAME_SIZE_ERROR);
+         }
+         return true;
+     }
+
+     case http2_session::RST_STREAM:
+     {
+         if (len != 4)
+         {
+             return h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         if (stream_id == 0 || stream_id > h2.last_stream_id)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         // 已加入批次的資料由m_batch_refs持有，可直接移除串流
+         h2.streams.erase(stream_id);
+         return true;
+     }
+
+     case http2_session::SETTINGS:
+     {
+         if (stream_id != 0)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         if (flags & http2_session::FLAG_ACK)
+         {
+             return len == 0 ? true : h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         if (len % 6 != 0)
+         {
+             return h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         if (!h2_settings(payload, len))
+         {
+             return false;
+         }
+         char ack[http2_session::FRAME_HEADER_LEN];
+         http2_session::put_frame_header(ack, 0, http2_session::SETTINGS, http2_session::FLAG_ACK, 0);
+         h2_send(ack, sizeof(ack));
+         return true;
+     }
+
+     case http2_session::PUSH_PROMISE:
+         // 客戶端不得推送
+         return h2_goaway(http2_session::PROTOCOL_ERROR);
+
+     case http2_session::PING:
+     {
+         if (len != 8)
+         {
+             return h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         if (stream_id != 0)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         if (!(flags & http2_session::FLAG_ACK))
+         {
+             char pong[http2_session::FRAME_HEADER_LEN + 8];
+             http2_session::put_frame_header(pong, 8, http2_session::PING, http2_session::FLAG_ACK, 0);
+             memcpy(pong + http2_session::FRAME_HEADER_LEN, payload, 8);
+             h2_send(pong, sizeof(pong));
+         }
+         return true;
+     }
+
+     case http2_session::GOAWAY:
+     {
+         if (len < 8)
+         {
+             return h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         if (stream_id != 0)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         // 已接受的串流照常回應，不再接受新串流
+         h2.goaway = true;
+         return true;
+     }
+
+     case http2_session::WINDOW_UPDATE:
+     {
+         if (len != 4)
+         {
+             return h2_goaway(http2_session::FRAME_SIZE_ERROR);
+         }
+         long increment = http2_session::get_uint32(payload) & http2_session::MAX_WINDOW;
+         if (stream_id == 0)
+         {
+             if (increment == 0)
+             {
+                 return h2_goaway(http2_session::PROTOCOL_ERROR);
+             }
+             h2.send_window += increment;
+             if (h2.send_window > http2_session::MAX_WINDOW)
+             {
+                 return h2_goaway(http2_session::FLOW_CONTROL_ERROR);
+             }
+             return true;
+         }
+         std::map<int, http2_stream>::iterator it = h2.streams.find(stream_id);
+         if (it == h2.streams.end())
+         {
+             // 已關閉的串流仍可能收到WINDOW_UPDATE，直接忽略
+             return stream_id <= h2.last_stream_id ? true : h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         if (increment == 0)
+         {
+             h2_reset(stream_id, http2_session::PROTOCOL_ERROR);
+             return true;
+         }
+         it->second.send_window += increment;
+         if (it->second.send_window > http2_session::MAX_WINDOW)
+         {
+             h2_reset(stream_id, http2_session::FLOW_CONTROL_ERROR);
+         }
+         return true;
+     }
+
+     default:
+         // 未知的訊框類型必須忽略
+         return true;
+     }
+}
+
+/*
+     套用對方的SETTINGS參數
+*/
+bool http_conn::h2_settings(const unsigned char *payload, int len)
+{
+     http2_session &h2 = *m_h2;
+     for (int i = 0; i + 6 <= len; i += 6)
+     {
+         int id = (payload[i] << 8) | payload[i + 1];
+         unsigned long value = http2_session::get_uint32(payload + i + 2);
+         switch (id)
+         {
+         case http2_session::SETTINGS_ENABLE_PUSH:
+         {
+             if (value > 1)
+             {
+                 return h2_goaway(http2_session::PROTOCOL_ERROR);
+             }
+             break;
+         }
+         case http2_session::SETTINGS_INITIAL_WINDOW_SIZE:
+         {
+             if (value > (unsigned long)http2_session::MAX_WINDOW)
+             {
+                 return h2_goaway(http2_session::FLOW_CONTROL_ERROR);
+             }
+             // 初始窗口變更時，所有串流的窗口一併調整差值
+             long delta = (long)value - h2.initial_window;
+             for (std::map<int, http2_stream>::iterator it = h2.streams.begin(); it != h2.streams.end(); ++it)
+             {
+                 it->second.send_window += delta;
+                 if (it->second.send_window > http2_session::MAX_WINDOW)
+                 {
+                     return h2_goaway(http2_session::FLOW_CONTROL_ERROR);
+                 }
+             }
+             h2.initial_window = value;
+             break;
+         }
+         case http2_session::SETTINGS_MAX_FRAME_SIZE:
+         {
+             if (value < (unsigned long)http2_session::DEFAULT_MAX_FRAME_SIZE || value > 0xffffff)
+             {
+                 return h2_goaway(http2_session::PROTOCOL_ERROR);
+             }
+             h2.max_frame_size = value;
+             break;
+         }
+         default:
+             // 回應標頭不使用動態表，HEADER_TABLE_SIZE等其餘參數不影響本端
+             break;
+         }
+     }
+     return true;
+}
+
+/*
+     HEADERS訊框：去除填充與優先權欄位，收集標頭區塊
+*/
+bool http_conn::h2_headers(int flags, int stream_id, const unsigned char *payload, int len)
+{
+     http2_session &h2 = *m_h2;
+     if (stream_id == 0 || stream_id % 2 == 0)
+     {
+         return h2_goaway(http2_session::PROTOCOL_ERROR);
+     }
+     int pad = 0;
+     if (flags & http2_session::FLAG_PADDED)
+     {
+         if (len < 1)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         pad = payload[0];
+         ++payload;
+         --len;
+     }
+     if (flags & http2_session::FLAG_PRIORITY)
+     {
+         if (len < 5)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         payload += 5;
+         len -= 5;
+     }
+     if (pad > len)
+     {
+         return h2_goaway(http2_session::PROTOCOL_ERROR);
+     }
+     h2.header_block.assign((const char *)payload, len - pad);
+     h2.continuation_stream = stream_id;
+     h2.block_end_stream = flags & http2_session::FLAG_END_STREAM;
+     if (flags & http2_session::FLAG_END_HEADERS)
+     {
+         return h2_end_headers();
+     }
+     return true;
+}
+
+/*
+     標頭區塊結束：以HPACK解碼，建立串流；請求已完整時立即處理
+*/
+bool http_conn::h2_end_headers()
+{
+     http2_session &h2 = *m_h2;
+     int stream_id = h2.continuation_stream;
+     h2.continuation_stream = 0;
+
+     // 即使串流將被拒絕也必須解碼，以維持動態表同步
+     hpack::header_list headers;
+     if (!h2.decoder.decode((const unsigned char *)h2.header_block.data(), h2.header_block.size(), headers))
+     {
+         return h2_goaway(http2_session::COMPRESSION_ERROR);
+     }
+     h2.header_block.clear();
+
+     std::map<int, http2_stream>::iterator it = h2.streams.find(stream_id);
+     if (it != h2.streams.end())
+     {
+         // 訊息體之後的trailer，必須結束串流
+         if (it->second.end_stream || !h2.block_end_stream)
+         {
+             h2_reset(stream_id, http2_session::PROTOCOL_ERROR);
+             return true;
+         }
+         it->second.end_stream = true;
+         h2_dispatch(it->second);
+         return true;
+     }
+     if (stream_id <= h2.last_stream_id)
+     {
+         return h2_goaway(http2_session::STREAM_CLOSED);
+     }
+     h2.last_stream_id = stream_id;
+     if (h2.goaway || h2.streams.size() >= (size_t)http2_session::MAX_CONCURRENT_STREAMS)
+     {
+         h2_reset(stream_id, http2_session::REFUSED_STREAM);
+         return true;
+     }
+
+     http2_stream s(stream_id, h2.initial_window);
+     for (size_t i = 0; i < headers.size(); ++i)
+     {
+         if (headers[i].first == ":method")
+         {
+             s.method = headers[i].second;
+         }
+         else if (headers[i].first == ":path")
+         {
+             s.path = headers[i].second;
+         }
+         else if (headers[i].first == "content-type")
+         {
+             s.content_type = headers[i].second;
+         }
+         if (headers[i].first[0] != ':')
+         {
+             s.headers.push_back(headers[i]);
+         }
+     }
+     if (s.method.empty() || s.path.empty())
+     {
+         h2_reset(stream_id, http2_session::PROTOCOL_ERROR);
+         return true;
+     }
+     s.end_stream = h2.block_end_stream;
+     http2_stream &stream = h2.streams.insert(std::make_pair(stream_id, s)).first->second;
+     if (stream.end_stream)
+     {
+         h2_dispatch(stream);
+     }
+     return true;
+}
+
+/*
+     DATA訊框：檢查接收窗口，累積請求訊息體
+     訊息體複製出讀取緩衝區（或超過上限丟棄）即視為已消化，窗口消耗超過一半時才以WINDOW_UPDATE歸還
+*/
+bool http_conn::h2_data(int flags, int stream_id, const unsigned char *payload, int len)
+{
+     http2_session &h2 = *m_h2;
+     if (stream_id == 0)
+     {
+         return h2_goaway(http2_session::PROTOCOL_ERROR);
+     }
+     // 流量控制計入整個訊框，包含填充
+     int size = len;
+     if (flags & http2_session::FLAG_PADDED)
+     {
+         if (len < 1 || payload[0] >= len)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         len -= 1 + payload[0];
+         ++payload;
+     }
+     // 對方送出的資料超過本端公告的連線窗口
+     if (size > h2.recv_window)
+     {
+         return h2_goaway(http2_session::FLOW_CONTROL_ERROR);
+     }
+     h2.recv_window -= size;
+     if (h2.recv_window <= http2_session::DEFAULT_WINDOW / 2)
+     {
+         h2_window_update(0, http2_session::DEFAULT_WINDOW - h2.recv_window);
+         h2.recv_window = http2_session::DEFAULT_WINDOW;
+     }
+
+     std::map<int, http2_stream>::iterator it = h2.streams.find(stream_id);
+     if (it == h2.streams.end() || it->second.end_stream)
+     {
+         if (stream_id > h2.last_stream_id)
+         {
+             return h2_goaway(http2_session::PROTOCOL_ERROR);
+         }
+         h2_reset(stream_id, http2_session::STREAM_CLOSED);
+         return true;
+     }
+     http2_stream &s = it->second;
+     if (size > s.recv_window)
+     {
+         h2_reset(stream_id, http2_session::FLOW_CONTROL_ERROR);
+         return true;
+     }
+     s.recv_window -= size;
+     if (!s.too_large)
+     {
+         if (s.body.size() + len > (size_t)m_read_buffer_limit)
+         {
+             // 與HTTP/1.1相同的上限，超過時丟棄訊息體，結束後回應413
+             s.too_large = true;
+             s.body.clear();
+         }
+         else
+         {
+             s.body.append((const char *)payload, len);
+         }
+     }
+     if (flags & http2_session::FLAG_END_STREAM)
+     {
+         s.end_stream = true;
+         h2_dispatch(s);
+     }
+     else if (s.recv_window <= http2_session::DEFAULT_WINDOW / 2)
+     {
+         h2_window_update(stream_id, http2_session::DEFAULT_WINDOW - s.recv_window);
+         s.recv_window = http2_session::DEFAULT_WINDOW;
+     }
+     return true;
+}
+
+/*
+     將串流的請求交給HTTP/1.1相同的處理函數，再產生回應
+*/
+void http_conn::h2_dispatch(http2_stream &s)
+{
+     HTTP_CODE ret = BAD_REQUEST;
+     bool known = true;
+     if (s.method == "GET")
+     {
+         m_method = GET;
+     }
+     else if (s.method == "POST")
+     {
+         m_method = POST;
+     }
+     else if (s.method == "HEAD")
+     {
+         m_method = HEAD;
+     }
+     else if (s.method == "OPTIONS")
+     {
+         m_method = OPTIONS;
+     }
+     else
+     {
+         known = false;
+         // PUT上傳、DELETE等方法在HTTP/2上不支援，回覆405與Allow
+         if (!s.method.empty())
+         {
+             ret = METHOD_NOT_ALLOWED;
+         }
+     }
+     bool asterisk = known && m_method == OPTIONS && s.path == "*";
+     if (s.too_large)
+     {
+         ret = ENTITY_TOO_LARGE;
+     }
+     else if (known && (asterisk || (s.path[0] == '/' && url::normalize(&s.path[0], &m_query) >= 0)))
+     {
+         m_url = &s.path[0];
+         m_content_data = const_cast<char *>(s.body.data());
+         m_content_length = s.body.size();
+         m_content_type = s.content_type.empty() ? 0 : &s.content_type[0];
+         LOG_INFO("[%ld h2 %s %s]", pthread_self(), method_names[m_method], m_url);
+         m_h2_stream = s.id;
+         ret = dispatch_request();
+         m_h2_stream = 0;
+     }
+     // cgi在背景執行時串流保持開啟，完成後由cgi_deliver回應
+     if (ret != CGI_PENDING)
+     {
+         h2_respond(s, ret);
+     }
+     m_file.reset();
+     m_cgi.reset();
+     m_file_address = 0;
+     m_url = 0;
+     m_query = 0;
+     m_content_data = 0;
+     m_content_length = 0;
+     m_content_type = 0;
+}
+
+/*
+     送出串流的回應HEADERS，訊息體留待h2_flush依窗口送出
+     沒有訊息體的回應在HEADERS上結束串流；cgi輸出的第一段之後還有後續片段時串流保持開啟
+*/
+void http_conn::h2_respond(http2_stream &s, HTTP_CODE ret)
+{
+     int status = 200;
+     const char *body = 0;
+     size_t body_len = 0;
+     bool allow = false;
+     bool location = false;
+     bool cgi = false;
+     std::shared_ptr<void> ref;
+     switch (ret)
+     {
+     case FILE_REQUEST:
+     {
+         body = m_file_address;
+         body_len = m_file_stat.st_size;
+         ref = m_file;
+         break;
+     }
+     case CGI_REQUEST:
+     {
+         status = m_cgi->status;
+         body = m_cgi->output.data();
+         body_len = m_cgi->output.size();
+         ref = m_cgi;
+         cgi = true;
+         break;
+     }
+     case OPTIONS_REQUEST:
+     {
+         allow = true;
+         break;
+     }
+     case MOVED_REQUEST:
+     case FOUND_REQUEST:
+     {
+         status = ret == MOVED_REQUEST ? 301 : 302;
+         location = true;
+         break;
+     }
+     default:
+     {
+         allow = ret == METHOD_NOT_ALLOWED;
+         body = error_body(ret, status);
+         if (!body)
+         {
+             body = error_body(INTERNAL_ERROR, status);
+         }
+         body_len = strlen(body);
+         break;
+     }
+     }
+
+     // 重新導向的Location與cgi的標頭長度不定，只有此時才配置較大的緩衝區
+     char stack_frame[http2_session::FRAME_HEADER_LEN + 128];
+     std::string large_frame;
+     char *frame = stack_frame;
+     if (location)
+     {
+         large_frame.resize(sizeof(stack_frame) + m_location.size() + 8);
+         frame = &large_frame[0];
+     }
+     else if (cgi && !m_cgi->headers.empty())
+     {
+         large_frame.resize(sizeof(stack_frame) + m_cgi->header_lines.size() + m_cgi->headers.size() * 16);
+         frame = &large_frame[0];
+     }
+     char *block = frame + http2_session::FRAME_HEADER_LEN;
+     int n = hpack::encode_status(block, status);
+     char num[24];
+     // cgi的輸出還在產生時長度無法事先得知，以END_STREAM表示結束
+     if (!cgi || m_cgi->last)
+     {
+         n += hpack::encode_header(block + n, hpack::IDX_CONTENT_LENGTH, num, http_format::format_dec(num, body_len));
+     }
+     // Date標頭去掉"Date: "與\r\n即為值
+     char date[http_format::DATE_HEADER_LEN + 1];
+     http_format::date_header(date);
+     n += hpack::encode_header(block + n, hpack::IDX_DATE, date + 6, http_format::DATE_HEADER_LEN - 8);
+     if (allow)
+     {
+         n += hpack::encode_header(block + n, hpack::IDX_ALLOW, m_h2_allow.data(), m_h2_allow.size());
+     }
+     if (location)
+     {
+         n += hpack::encode_header(block + n, hpack::IDX_LOCATION, m_location.data(), m_location.size());
+     }
+     if (cgi)
+     {
+         for (size_t i = 0; i < m_cgi->headers.size(); ++i)
+         {
+             const std::string &name = m_cgi->headers[i].first;
+             const std::string &value = m_cgi->headers[i].second;
+             if (name == "content-type")
+             {
+                 n += hpack::encode_header(block + n, hpack::IDX_CONTENT_TYPE, value.data(), value.size());
+             }
+             else if (name == "location")
+             {
+                 n += hpack::encode_header(block + n, hpack::IDX_LOCATION, value.data(), value.size());
+             }
+             else
+             {
+                 n += hpack::encode_literal(block + n, name.data(), name.size(), value.data(), value.size());
+             }
+         }
+     }
+
+     size_t left = s.method == "HEAD" ? 0 : body_len;
+     bool streaming = cgi && !m_cgi->last && s.method != "HEAD";
+     int flags = http2_session::FLAG_END_HEADERS;
+     if (left == 0 && !streaming)
+     {
+         flags |= http2_session::FLAG_END_STREAM;
+     }
+     http2_session::put_frame_header(frame, n, http2_session::HEADERS, flags, s.id);
+     if (!h2_send(frame, http2_session::FRAME_HEADER_LEN + n))
+     {
+         // 標頭無法加入批次時不能只送出訊息體，改以RST_STREAM結束串流
+         LOG_ERROR("[%ld h2 stream %d HEADERS dropped]", pthread_self(), s.id);
+         h2_reset(s.id, http2_session::INTERNAL_ERROR);
+         return;
+     }
+     s.responded = true;
+     s.data = body;
+     s.left = left;
+     s.ref = ref;
+     s.streaming = streaming;
+     if (s.left == 0 && !s.streaming)
+     {
+         int id = s.id;
+         m_h2->streams.erase(id);
+     }
+}
+
+/*
+     將一段cgi輸出交給對應的串流：第一段送出HEADERS，之後的片段排入串流，由h2_flush依窗口送出
+     h2c升級的請求以HTTP/1.1啟動，對應串流1；串流已被重設時丟棄
+*/
+void http_conn::h2_cgi_output(int stream_id, const std::shared_ptr<cgi_result> &piece)
+{
+     std::map<int, http2_stream>::iterator it = m_h2->streams.find(stream_id ? stream_id : 1);
+     if (it == m_h2->streams.end())
+     {
+         return;
+     }
+     http2_stream &s = it->second;
+     if (piece->head)
+     {
+         m_cgi = piece;
+         h2_respond(s, piece->code);
+         m_cgi.reset();
+         return;
+     }
+     if (!s.streaming)
+     {
+         return;
+     }
+     // 已送出標頭後才失敗，以RST_STREAM讓客戶端知道回應不完整
+     if (piece->code != CGI_REQUEST)
+     {
+         h2_reset(s.id, http2_session::INTERNAL_ERROR);
+         return;
+     }
+     if (!piece->output.empty())
+     {
+         http2_chunk chunk = {piece->output.data(), piece->output.size(), piece};
+         s.chunks.push_back(chunk);
+     }
+     if (piece->last)
+     {
+         s.streaming = false;
+         // 之前的資料都已送出，以空的DATA訊框結束串流
+         if (s.left == 0 && s.chunks.empty())
+         {
+             char header[http2_session::FRAME_HEADER_LEN];
+             http2_session::put_frame_header(header, 0, http2_session::DATA, http2_session::FLAG_END_STREAM, s.id);
+             if (!h2_send(header, sizeof(header)))
+             {
+                 h2_reset(s.id, http2_session::INTERNAL_ERROR);
+                 return;
+             }
+             m_h2->streams.erase(it);
+         }
+     }
+}
+
+/*
+     依連線與串流窗口、對方的最大訊框大小，將各串流待送的訊息體切成DATA訊框加入批次
+     串流式回應在目前的資料送完後接著送出下一個片段
+*/
+void http_conn::h2_flush()
+{
+     http2_session &h2 = *m_h2;
+     std::map<int, http2_stream>::iterator it = h2.streams.begin();
+     while (it != h2.streams.end() && h2.send_window > 0 && m_batch_count < MAX_BATCH_REQUESTS)
+     {
+         http2_stream &s = it->second;
+         if (!s.responded || (s.left == 0 && s.chunks.empty()) || s.send_window <= 0)
+         {
+             ++it;
+             continue;
+         }
+         bool sent = false;
+         while (s.send_window > 0 && h2.send_window > 0 && m_iv_count + 2 <= 3 * MAX_BATCH_REQUESTS &&
+                WRITE_BUFFER_SIZE - m_write_idx >= http2_session::FRAME_HEADER_LEN)
+         {
+             if (s.left == 0)
+             {
+                 // 換到下一個片段前，先保留已加入批次的片段
+                 if (s.chunks.empty() || (sent && m_batch_count + 1 >= MAX_BATCH_REQUESTS))
+                 {
+                     break;
+                 }
+                 if (sent && s.ref)
+                 {
+                     m_batch_refs[m_batch_count++] = s.ref;
+                 }
+                 sent = false;
+                 s.data = s.chunks.front().data;
+                 s.left = s.chunks.front().len;
+                 s.ref = s.chunks.front().ref;
+                 s.chunks.pop_front();
+             }
+             size_t n = s.left;
+             if (n > (size_t)h2.max_frame_size)
+             {
+                 n = h2.max_frame_size;
+             }
+             if (n > (size_t)s.send_window)
+             {
+                 n = s.send_window;
+             }
+             if (n > (size_t)h2.send_window)
+             {
+                 n = h2.send_window;
+             }
+             bool end = n == s.left && s.chunks.empty() && !s.streaming;
+             char header[http2_session::FRAME_HEADER_LEN];
+             http2_session::put_frame_header(header, n, http2_session::DATA, end ? http2_session::FLAG_END_STREAM : 0, s.id);
+             if (!h2_send(header, sizeof(header)))
+             {
+                 break;
+             }
+             add_iv((char *)s.data, n);
+             s.data += n;
+             s.left -= n;
+             s.send_window -= n;
+             h2.send_window -= n;
+             sent = true;
+         }
+         // 加入批次的資料需保留到writev完成，即使串流先被移除
+         if (sent && s.ref)
+         {
+             m_batch_refs[m_batch_count++] = s.ref;
+         }
+         if (s.left == 0 && s.chunks.empty() && !s.streaming)
+         {
+             it = h2.streams.erase(it);
+         }
+         else
+         {
+             ++it;
+         }
+     }
+}
+
+/*
+     是否有串流的回應資料可在窗口內繼續送出
+*/
+bool http_conn::h2_want_write()
+{
+     if (!m_h2 || m_h2->send_window <= 0)
+     {
+         return false;
+     }
+     for (std::map<int, http2_stream>::iterator it = m_h2->streams.begin(); it != m_h2->streams.end(); ++it)
+     {
+         if (it->second.responded && (it->second.left > 0 || !it->second.chunks.empty()) && it->second.send_window > 0)
+         {
+             return true;
+         }
+     }
+     return false;
+}
+
+/*
+     將一個完整的訊框複製到寫入緩衝區並加入批次
+     寫入緩衝區放不下（例如cgi的大量標頭）時複製到獨立的緩衝區，由m_batch_refs持有到writev完成
+     傳回值：false表示iovec或批次已滿，訊框沒有送出
+*/
+bool http_conn::h2_send(const char *frame, int len)
+{
+     if (m_iv_count >= 3 * MAX_BATCH_REQUESTS)
+     {
+         return false;
+     }
+     int start = m_write_idx;
+     if (add_bytes(frame, len))
+     {
+         add_iv(m_write_buf + start, len);
+         return true;
+     }
+     if (m_batch_count >= MAX_BATCH_REQUESTS)
+     {
+         return false;
+     }
+     std::shared_ptr<std::string> copy(new std::string(frame, len));
+     add_iv(&(*copy)[0], len);
+     m_batch_refs[m_batch_count++] = copy;
+     return true;
+}
+
+/*
+     以RST_STREAM結束串流
+*/
+void http_conn::h2_reset(int stream_id, int code)
+{
+     char frame[http2_session::FRAME_HEADER_LEN + 4];
+     http2_session::put_frame_header(frame, 4, http2_session::RST_STREAM, 0, stream_id);
+     http2_session::put_uint32(frame + http2_session::FRAME_HEADER_LEN, code);
+     h2_send(frame, sizeof(frame));
+     m_h2->streams.erase(stream_id);
+}
+
+/*
+     歸還接收窗口
+*/
+void http_conn::h2_window_update(int stream_id, int increment)
+{
+     char frame[http2_session::FRAME_HEADER_LEN + 4];
+     http2_session::put_frame_header(frame, 4, http2_session::WINDOW_UPDATE, 0, stream_id);
+     http2_session::put_uint32(frame + http2_session::FRAME_HEADER_LEN, increment);
+     h2_send(frame, sizeof(frame));
+}
+
+/*
+     連線錯誤：送出GOAWAY，寫完後關閉連線
+     傳回值固定為false，方便在h2_frame中直接傳回
+*/
+bool http_conn::h2_goaway(int code)
+{
+     char frame[http2_session::FRAME_HEADER_LEN + 8];
+     http2_session::put_frame_header(frame, 8, http2_session::GOAWAY, 0, 0);
+     http2_session::put_uint32(frame + http2_session::FRAME_HEADER_LEN, m_h2->last_stream_id);
+     http2_session::put_uint32(frame + http2_session::FRAME_HEADER_LEN + 4, code);
+     h2_send(frame, sizeof(frame));
+     m_h2->closing = true;
+     LOG_INFO("[%ld h2 GOAWAY %d]", pthread_self(), code);
+     return false;
+}
@@ -1,5 +1,11 @@
 #include "http_conn.h"
 #include "log.h"
+#include "buffer_pool.h"
+#include "head_scanner.h"
+#include "stat_cache.h"
+#include "http_format.h"
+#include "cgi.h"
+#include "cgi_cache.h"
 
 #define DEBUG 2
 
@@ -10,8 +16,71 @@ const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file from this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_405_form = "The request method is not supported for this resource.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request is larger than the server is willing to process.\n";
+const char *error_431_form = "The request header fields are larger than the server is willing to process.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the requested file.\n";
+const char *error_504_form = "The script did not finish in time.\n";
+/* 預先組好的狀態行，回應時直接複製 */
+struct status_line
+{
+     int status;
+     const char *line;
+     int len;
+};
+#define STATUS_LINE(code, title) {code, "HTTP/1.1 " #code " " title "\r\n", sizeof("HTTP/1.1 " #code " " title "\r\n") - 1}
+static const status_line status_lines[] = {
+     STATUS_LINE(200, "OK"),
+     STATUS_LINE(201, "Created"),
+     STATUS_LINE(301, "Moved Permanently"),
+     STATUS_LINE(302, "Found"),
+     STATUS_LINE(400, "Bad Request"),
+     STATUS_LINE(403, "Forbidden"),
+     STATUS_LINE(404, "Not Found"),
+     STATUS_LINE(405, "Method Not Allowed"),
+     STATUS_LINE(413, "Payload Too Large"),
+     STATUS_LINE(431, "Request Header Fields Too Large"),
+     STATUS_LINE(500, "Internal Error"),
+     STATUS_LINE(504, "Gateway Timeout")};
+
+/* 固定的標頭片段 */
+#define FRAGMENT(s) s, sizeof(s) - 1
+static const char content_length_prefix[] = "Content-Length: ";
+static const char connection_keep_alive[] = "Connection: keep-alive\r\n";
+static const char connection_close[] = "Connection: close\r\n";
+static const char keep_alive_prefix[] = "Keep-Alive: max=";
+static const char transfer_chunked[] = "Transfer-Encoding: chunked\r\n";
+static const char crlf[] = "\r\n";
+static const char last_chunk[] = "0\r\n\r\n";
+static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+static const char location_prefix[] = "Location: ";
+
+/*
+     預先組好的錯誤回應，啟動時由init_error_responses產生，之後唯讀並由所有連線共用
+     head依m_linger分為close與keep-alive兩種版本，Keep-Alive與Date在兩者之間由各連線寫入
+*/
+struct error_response
+{
+     http_conn::HTTP_CODE code;
+     int status;
+     const char *form;
+     std::string head[2]; // 狀態行 + Content-Length + Connection
+     std::string tail; // 空白行 + 訊息體
+};
+static error_response error_responses[] = {
+     {http_conn::BAD_REQUEST, 400, error_400_form},
+     {http_conn::FORBIDDEN_REQUEST, 403, error_403_form},
+     {http_conn::NO_RESOURCE, 404, error_404_form},
+     {http_conn::METHOD_NOT_ALLOWED, 405, error_405_form},
+     {http_conn::ENTITY_TOO_LARGE, 413, error_413_form},
+     {http_conn::HEADER_TOO_LARGE, 431, error_431_form},
+     {http_conn::INTERNAL_ERROR, 500, error_500_form},
+     {http_conn::GATEWAY_TIMEOUT, 504, error_504_form}};
+
+/* 請求方法名稱，順序與METHOD一致 */
+const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
 /* 網站根目錄 */
 const char *doc_root = "../template/web";
 const char *cgi_root = "../template/cgi";
@@ -65,18 +134,80 @@ void removefd(int epollfd, int fd)
 
 /*
      向epollfd中修改fd，新增屬性ev
-     event.events = ev | EPOLLIN | EPOLLONESHOT | EPOLLRDHUP;
+     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+     等待EPOLLOUT時不監聽EPOLLIN，避免回應尚未送出時又開始處理新請求而覆寫寫入緩衝區
 */
 void modfd(int epollfd, int fd, int ev)
 {
      epoll_event event;
      event.data.fd = fd;
-     event.events = ev | EPOLLIN | EPOLLONESHOT | EPOLLRDHUP;
-     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
+     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+     if (epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT)
+     {
+         // 連線交給執行緒池前已移出epoll（見push_wakeup），重新加入
+         epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+     }
 }
 
 int http_conn::m_user_count = 0;
 int http_conn::m_epollfd = -1;
+int http_conn::m_read_buffer_limit = 64 * 1024;
+int http_conn::m_max_keep_alive_requests = 100;
+singleflight<http_conn::file_result> http_conn::m_file_flight;
+int http_conn::m_wake_fd = -1;
+std::atomic<unsigned long> http_conn::m_next_conn_id(0);
+std::string http_conn::m_h2_allow = "OPTIONS";
+std::vector<http_conn *> http_conn::m_wakeups;
+locker http_conn::m_wake_mutex;
+
+/*
+     產生所有錯誤回應的共用位元組，需在建立路由表之後、開始服務前呼叫一次（405的Allow取自路由表）
+*/
+void http_conn::init_error_responses()
+{
+     for (size_t i = 0; i < sizeof(error_responses) / sizeof(error_responses[0]); ++i)
+     {
+         error_response &r = error_responses[i];
+         std::string head;
+         for (size_t j = 0; j < sizeof(status_lines) / sizeof(status_lines[0]); ++j)
+         {
+             if (status_lines[j].status == r.status)
+             {
+                 head.assign(status_lines[j].line, status_lines[j].len);
+             }
+         }
+         char len[24];
+         head.append(FRAGMENT(content_length_prefix));
+         head.append(len, http_format::format_dec(len, strlen(r.form)));
+         head.append(FRAGMENT(crlf));
+         if (r.status == 405)
+         {
+             head += router::allow_header();
+         }
+         r.head[0] = head + connection_close;
+         r.head[1] = head + connection_keep_alive;
+         r.tail = std::string(crlf) + r.form;
+     }
+     // HTTP/2只支援GET、HEAD、POST與OPTIONS
+     m_h2_allow = router::allow_value(router::methods() &
+                                      (router::M_GET | router::M_HEAD | router::M_POST | router::M_OPTIONS));
+}
+
+/*
+     取得錯誤回應的狀態碼與訊息體，code不是錯誤時傳回0
+*/
+const char *http_conn::error_body(HTTP_CODE code, int &status)
+{
+     for (size_t i = 0; i < sizeof(error_responses) / sizeof(error_responses[0]); ++i)
+     {
+         if (error_responses[i].code == code)
+         {
+             status = error_responses[i].status;
+             return error_responses[i].form;
+         }
+     }
+     return 0;
+}
 
 /*
      是否關閉與客戶端的連接套接字
@@ -85,6 +216,41 @@ void http_conn::close_conn(bool real_close)
 {
      if (real_close && (m_sockfd != -1))
      {
+         // 先停止推送，之後其他執行緒的push()不會再存取此連線
+         m_push_mutex.lock();
+         m_push_enabled = false;
+         m_push_queue.clear();
+         m_push_bytes = 0;
+         // 背景執行中的cgi完成時不再交給此連線
+         m_cgi_running = 0;
+         m_cgi_done.clear();
+         m_push_mutex.unlock();
+         if (m_ws)
+         {
+             websocket_conn ws = {this, m_conn_id};
+             m_ws->on_close(ws);
+             m_ws = 0;
+         }
+         if (m_sse)
+         {
+             sse::unsubscribe(m_sse, this);
+             m_sse = 0;
+         }
+         // 上傳途中斷線，丟棄暫存檔與解析中的表單
+         if (uploading())
+         {
+             abort_upload();
+         }
+         if (m_ssl)
+         {
+             // 握手完成後才送出close_notify，不等待對方回應
+             if (!m_tls_handshake)
+             {
+                 SSL_shutdown(m_ssl);
+             }
+             SSL_free(m_ssl);
+             m_ssl = 0;
+         }
          removefd(m_epollfd, m_sockfd);
          m_sockfd = -1;
          m_user_count--;
@@ -102,10 +268,136 @@ void http_conn::init(int sockfd, const sockaddr_in &addr)
      m_address = addr;
      int res = 1;
      setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &res, sizeof(res));
+     // fd會被重複使用，需清除上一個連線殘留的狀態
+     m_push_mutex.lock();
+     m_conn_id = ++m_next_conn_id;
+     m_push_enabled = false;
+     m_push_state = PUSH_BUSY;
+     m_push_wake = false;
+     m_push_overflow = false;
+     m_push_queue.clear();
+     m_push_bytes = 0;
+     m_cgi_running = 0;
+     m_cgi_done.clear();
+     m_push_mutex.unlock();
+     init();
      addFd(m_epollfd, m_sockfd, true);
      m_user_count++;
 }
 
+/*
+     在TLS埠接受的連線：建立SSL物件，之後的讀寫事件先用於完成握手
+*/
+bool http_conn::tls_accept()
+{
+     m_ssl = tls::accept(m_sockfd);
+     m_tls_handshake = true;
+     m_ktls_send = false;
+     return m_ssl != 0;
+}
+
+/*
+     非阻塞地推進TLS握手
+     傳回值：
+         1：握手完成
+         0：尚未完成，已依需要重新註冊讀或寫事件
+         -1：握手失敗
+*/
+int http_conn::tls_handshake()
+{
+     int ret = SSL_do_handshake(m_ssl);
+     if (ret == 1)
+     {
+         m_tls_handshake = false;
+         // 金鑰已交給kTLS時，回應可直接writev，由核心加密
+         m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+         LOG_INFO("[%ld tls %s, ktls send: %d, resumed: %d]", pthread_self(), SSL_get_version(m_ssl), m_ktls_send,
+                  (int)SSL_session_reused(m_ssl));
+         return 1;
+     }
+     switch (SSL_get_error(m_ssl, ret))
+     {
+     case SSL_ERROR_WANT_READ:
+         modfd(m_epollfd, m_sockfd, EPOLLIN);
+         return 0;
+     case SSL_ERROR_WANT_WRITE:
+         modfd(m_epollfd, m_sockfd, EPOLLOUT);
+         return 0;
+     default:
+         return -1;
+     }
+}
+
+/*
+     從TLS連線讀取解密後的資料，傳回值與recv相同，無資料時為-1且errno為EAGAIN
+*/
+int http_conn::tls_read(char *buf, int len)
+{
+     int ret = SSL_read(m_ssl, buf, len);
+     if (ret > 0)
+     {
+         return ret;
+     }
+     switch (SSL_get_error(m_ssl, ret))
+     {
+     case SSL_ERROR_WANT_READ:
+         errno = EAGAIN;
+         return -1;
+     case SSL_ERROR_ZERO_RETURN:
+         return 0;
+     default:
+         errno = EIO;
+         return -1;
+     }
+}
+
+/*
+     OpenSSL中是否還有已解密、尚未讀入讀取緩衝區的資料
+     讀取緩衝區達上限時SSL_read已把整個TLS記錄從socket取走，這些資料不會再觸發EPOLLIN
+*/
+bool http_conn::tls_buffered()
+{
+     return m_ssl && !m_tls_handshake && SSL_pending(m_ssl) > 0;
+}
+
+/*
+     等待讀事件；TLS還有已解密的資料時改註冊立即觸發的EPOLLOUT，由write()交回執行緒池讀取
+*/
+void http_conn::arm_read()
+{
+     modfd(m_epollfd, m_sockfd, tls_buffered() ? EPOLLOUT : EPOLLIN);
+}
+
+/*
+     沒有kTLS時以SSL_write依序送出m_iv，傳回值與writev相同
+     SSL_write需以相同內容重試，因此遇到WANT_WRITE時只回報已完成的部分，由write()推進iovec
+*/
+int http_conn::tls_writev()
+{
+     int total = 0;
+     for (int i = 0; i < m_iv_count; ++i)
+     {
+         size_t off = 0;
+         while (off < m_iv[i].iov_len)
+         {
+             int ret = SSL_write(m_ssl, (char *)m_iv[i].iov_base + off, m_iv[i].iov_len - off);
+             if (ret <= 0)
+             {
+                 if (total > 0)
+                 {
+                     return total;
+                 }
+                 int err = SSL_get_error(m_ssl, ret);
+                 errno = (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) ? EAGAIN : EIO;
+                 return -1;
+             }
+             off += ret;
+             total += ret;
+         }
+     }
+     return total;
+}
+
 /*
      私有函數，初始化內部變數參數
 */
@@ -113,25 +405,154 @@ void http_conn::init()
 {
      m_chek_state = CHECK_STATE_REQUESTLINE;
      m_linger = false;
+     m_http10 = false;
+     m_continue_sent = false;
 
      m_method = GET;
      m_url = 0;
+     m_query = 0;
      m_version = 0;
      m_content_length = 0;
+     m_content_data = 0;
+     m_chunked = false;
+     m_upload_left = 0;
+     m_headers.bind(&m_read_buf);
+     m_headers.clear();
      m_host = 0;
+     m_content_type = 0;
      m_start_line = 0;
      m_check_idx = 0;
      m_read_idx = 0;
+     m_mark_count = 0;
+     m_mark_next = 0;
+     m_scan_idx = 0;
+     m_line_begin = -1;
      m_write_idx = 0;
+     m_request_end = 0;
+     m_bytes_to_send = 0;
+     m_bytes_have_send = 0;
+     m_pipelined = false;
 
+     shrink_read_buf(0);
      memset(m_read_buf, '\0', READ_BUFFER_SIZE);
      memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
      memset(m_real_file, '\0', FILENAME_LEN);
-     memset(m_cgi_buf, '\0', WRITE_BUFFER_SIZE);
+     m_iv_count = 0;
+     m_batch_linger = false;
+     m_pending_write = NO_REQUEST;
+     m_request_count = 0;
+     m_h2.reset();
+     m_upgrade_websocket = false;
+     m_connection_upgrade = false;
+     m_ws_pending = 0;
+     m_ws = 0;
+     m_ws_opcode = 0;
+     m_ws_message.clear();
+     m_ws_closing = false;
+     m_sse_pending = 0;
+     m_sse = 0;
+     unmap();
+}
+
+/*
+     目前請求的回應已加入批次後重設解析狀態，
+     並將緩衝區中已讀入但尚未處理的pipeline請求搬移到緩衝區開頭
+*/
+void http_conn::next_request()
+{
+     int left = m_read_idx - m_request_end;
+     if (left > 0)
+     {
+         memmove(m_read_buf, m_read_buf + m_request_end, left);
+     }
+     else
+     {
+         left = 0;
+     }
+     // 大請求處理完後，剩餘資料放得下時換回連線內建的小緩衝區
+     shrink_read_buf(left);
+     // 索引中屬於後續請求的偏移隨資料平移，已掃描的部分不需重新掃描
+     int kept = 0;
+     for (int i = m_mark_next; i < m_mark_count; ++i)
+     {
+         if (m_marks[i] >= m_request_end)
+         {
+             m_marks[kept++] = m_marks[i] - m_request_end;
+         }
+     }
+     m_mark_count = kept;
+     m_mark_next = 0;
+     m_scan_idx = m_scan_idx > m_request_end ? m_scan_idx - m_request_end : 0;
+     m_line_begin = -1;
+
+     m_chek_state = CHECK_STATE_REQUESTLINE;
+     m_linger = false;
+     m_http10 = false;
+     m_continue_sent = false;
+     m_method = GET;
+     m_url = 0;
+     m_query = 0;
+     m_version = 0;
+     m_content_length = 0;
+     m_content_data = 0;
+     m_chunked = false;
+     m_upload_left = 0;
+     m_upgrade_websocket = false;
+     m_connection_upgrade = false;
+     m_headers.clear();
+     m_host = 0;
+     m_content_type = 0;
+     m_start_line = 0;
+     m_check_idx = 0;
+     m_read_idx = left;
+     m_request_end = 0;
+}
+
+/*
+     請求格式錯誤時無法再找到下一個請求的邊界，
+     丟棄緩衝區剩餘資料並在回應後關閉連線
+*/
+void http_conn::bad_request()
+{
+     m_request_end = m_read_idx;
+     m_linger = false;
+}
+
+/*
+     解析Connection標頭，值為以逗號分隔的選項，close優先於keep-alive
+     upgrade選項表示Upgrade標頭有效（WebSocket握手）
+*/
+void http_conn::parse_connection(const char *value)
+{
+     bool close = false;
+     while (*value)
+     {
+         value += strspn(value, " \t,");
+         size_t len = strcspn(value, " \t,");
+         if (len == 5 && strncasecmp(value, "close", 5) == 0)
+         {
+             close = true;
+         }
+         else if (len == 10 && strncasecmp(value, "keep-alive", 10) == 0)
+         {
+             m_linger = true;
+         }
+         else if (len == 7 && strncasecmp(value, "upgrade", 7) == 0)
+         {
+             m_connection_upgrade = true;
+         }
+         value += len;
+     }
+     if (close)
+     {
+         m_linger = false;
+     }
 }
 
 /*
      檢查m_read_buf中合法的一行。
+     行尾與分隔字元取自結構索引，不再逐字元檢查；索引用完時才從上次掃描結束處接著以SIMD建立，
+     請求頭的每個位元組只掃描一次。一行中的空白、\t與第一個冒號記錄在m_line_*，供解析請求行與標頭
      傳回值：
          LINE_OK：合法一行，\r\n皆被置為\0，idx指向下一行開始
          LINE_BAD: 非法一行
@@ -139,40 +560,143 @@ void http_conn::init()
 */
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-     char temp;
-     for (; m_check_idx < m_read_idx; ++m_check_idx)
+     if (m_line_begin != m_start_line)
      {
-         temp = m_read_buf[m_check_idx];
+         m_line_begin = m_start_line;
+         m_line_sep_count = 0;
+         m_line_colon = -1;
+     }
+     while (true)
+     {
+         if (m_mark_next == m_mark_count)
+         {
+             if (m_scan_idx >= m_read_idx)
+             {
+                 m_check_idx = m_read_idx;
+                 return LINE_OPEN;
+             }
+             size_t scanned = 0;
+             m_mark_count = head_scanner::index(m_read_buf + m_scan_idx, m_read_idx - m_scan_idx, m_marks, MAX_HEAD_MARKS, scanned);
+             for (int i = 0; i < m_mark_count; ++i)
+             {
+                 m_marks[i] += m_scan_idx;
+             }
+             m_mark_next = 0;
+             m_scan_idx += scanned;
+             continue;
+         }
+         int pos = m_marks[m_mark_next];
+         char temp = m_read_buf[pos];
+         if (pos < m_check_idx)
+         {
+             // 上一行\r\n中的\n
+             ++m_mark_next;
+             continue;
+         }
+         if (temp == ' ' || temp == '\t')
+         {
+             if (m_line_sep_count < MAX_LINE_SEPS)
+             {
+                 m_line_seps[m_line_sep_count++] = pos;
+             }
+             ++m_mark_next;
+             continue;
+         }
+         if (temp == ':')
+         {
+             if (m_line_colon < 0)
+             {
+                 m_line_colon = pos;
+             }
+             ++m_mark_next;
+             continue;
+         }
+         m_check_idx = pos;
          if (temp == '\r')
          {
              if ((m_check_idx + 1) == m_read_idx)
              {
+                 // 保留此偏移，收到下一個位元組後重新判斷
                  return LINE_OPEN;
              }
              else if (m_read_buf[m_check_idx + 1] == '\n')
              {
                  m_read_buf[m_check_idx++] = '\0';
                  m_read_buf[m_check_idx++] = '\0';
+                 ++m_mark_next;
                  return LINE_OK;
              }
              return LINE_BAD;
          }
-         else if (temp == '\n')
+         // 前面沒有\r的\n
+         return LINE_BAD;
+     }
+}
+
+/*
+     讀取緩衝區已滿時，從緩衝區池取得兩倍大小的緩衝區並搬移資料，最大不超過m_read_buffer_limit
+     解析器以索引記錄位置，已解析出的指標則依新位址重新定位，擴充前後解析狀態保持一致
+     傳回值：
+         擴充成功：true
+         已達上限：false
+*/
+bool http_conn::grow_read_buf()
+{
+     if (m_read_size >= m_read_buffer_limit)
+     {
+         return false;
+     }
+     int size = m_read_size * 2;
+     if (size > m_read_buffer_limit)
+     {
+         size = m_read_buffer_limit;
+     }
+     char *buf = buffer_pool::acquire(size);
+     memcpy(buf, m_read_buf, m_read_idx);
+     rebase_read_buf(buf);
+     if (m_read_buf != m_read_inline)
+     {
+         buffer_pool::release(m_read_buf, m_read_size);
+     }
+     m_read_buf = buf;
+     m_read_size = size;
+     return true;
+}
+
+/*
+     緩衝區中只剩left位元組時，若目前使用池中的緩衝區，則搬回內建緩衝區並歸還
+*/
+void http_conn::shrink_read_buf(int left)
+{
+     if (m_read_buf == m_read_inline || left > READ_BUFFER_SIZE)
+     {
+         return;
+     }
+     memcpy(m_read_inline, m_read_buf, left);
+     rebase_read_buf(m_read_inline);
+     buffer_pool::release(m_read_buf, m_read_size);
+     m_read_buf = m_read_inline;
+     m_read_size = READ_BUFFER_SIZE;
+}
+
+/*
+     將指向舊讀取緩衝區的指標改為指向buf中相同的偏移
+*/
+void http_conn::rebase_read_buf(char *buf)
+{
+     char **ptrs[] = {&m_url, &m_query, &m_version, &m_host, &m_content_type, &m_content_data};
+     for (size_t i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); ++i)
+     {
+         char *p = *ptrs[i];
+         if (p && p >= m_read_buf && p < m_read_buf + m_read_size)
          {
-             if ((m_check_idx > 1) && (m_read_buf[m_check_idx - 1] == '\r'))
-             {
-                 m_read_buf[m_check_idx - 1] = '\0';
-                 m_read_buf[m_check_idx++] = '\0';
-                 return LINE_OK;
-             }
-             return LINE_BAD;
+             *ptrs[i] = buf + (p - m_read_buf);
          }
      }
-     return LINE_OPEN;
 }
 
 /*
-     從m_sockfd讀取盡可能多的資料到m_read_buf中
+     從m_sockfd讀取盡可能多的資料到m_read_buf中，緩衝區不足時自動擴充
      傳回值：
          讀取成功：true
          讀取錯誤：false
@@ -183,23 +707,51 @@ bool http_conn::read()
      {
          printf("start read data form socket:\n");
      }
-     if (m_read_idx >= READ_BUFFER_SIZE)
+     push_claim();
+     if (m_ssl && m_tls_handshake)
+     {
+         // 握手尚未完成時handshaking()為true，呼叫方不會交給執行緒池
+         int ret = tls_handshake();
+         if (ret <= 0)
+         {
+             return ret == 0;
+         }
+     }
+     if (uploading())
+     {
+         // 串流中的訊息體由process_upload直接從socket讀取
+         return true;
+     }
+     if (m_read_idx >= m_read_size && !grow_read_buf())
      {
          if (DEBUG==1)
          {
              printf("讀取緩衝區不足:\n");
          }
-         return false;
+         // HTTP/1.x的請求交給process_read回覆431或413後關閉，其餘協定無法再接收
+         return !m_h2 && !m_ws && !m_sse;
      }
 
      int bytes_read = 0;
      while (true)
      {
+         if (m_read_idx >= m_read_size && !grow_read_buf())
+         {
+             // 已達上限，先處理已讀入的請求，其餘資料留在socket中稍後再讀
+             break;
+         }
          if (DEBUG==1)
          {
-             printf("目前緩衝區大小：%d, 已使用：%d, 剩餘：%d:\n", READ_BUFFER_SIZE, m_read_idx, READ_BUFFER_SIZE - m_read_idx);
+             printf("目前緩衝區大小：%d, 已使用：%d, 剩餘：%d:\n", m_read_size, m_read_idx, m_read_size - m_read_idx);
+         }
+         if (m_ssl)
+         {
+             bytes_read = tls_read(m_read_buf + m_read_idx, m_read_size - m_read_idx);
+         }
+         else
+         {
+             bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - m_read_idx, 0);
          }
-         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
          if (bytes_read == -1)
          {
              if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -223,13 +775,14 @@ bool http_conn::read()
      }
      if (DEBUG==1)
      {
-         printf("%s\n", m_read_buf);
+         printf("%.*s\n", m_read_idx, m_read_buf);
      }
      return true;
 }
 
 /*
      解析HTTP請求行，取得請求方法、目標URL，以及HTTP版本號
+     text為parse_line切出的一行，行尾的\r\n已置為\0，長度由m_check_idx推得
      傳回值：
          成功：NO_REQUEST
          失敗：BAD_REQUEST
@@ -241,11 +794,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
              Method Url HTTP_version
              GET /index HTTP/1.1
      */
-     m_url = strpbrk(text, " \t");
-     if (!m_url)
+     // 方法與URL、URL與版本之間的分隔字元取自parse_line記錄的位置
+     if (m_line_sep_count == 0)
      {
          return BAD_REQUEST;
      }
+     m_url = m_read_buf + m_line_seps[0];
      *m_url++ = '\0';
 
      char *method = text;
@@ -261,20 +815,46 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
          }
          m_method = POST;
      }
+     else if (strcasecmp(method, "HEAD") == 0)
+     {
+         m_method = HEAD;
+     }
+     else if (strcasecmp(method, "PUT") == 0)
+     {
+         m_method = PUT;
+     }
+     else if (strcasecmp(method, "OPTIONS") == 0)
+     {
+         m_method = OPTIONS;
+     }
      else
      {
          return BAD_REQUEST;
      }
 
      m_url += strspn(m_url, " \t");
-     m_version = strpbrk(m_url, " \t");
-     if (!m_version)
+     int sep = 1;
+     while (sep < m_line_sep_count && m_read_buf + m_line_seps[sep] < m_url)
+     {
+         ++sep;
+     }
+     if (sep == m_line_sep_count)
      {
          return BAD_REQUEST;
      }
+     m_version = m_read_buf + m_line_seps[sep];
      *m_version++ = '\0';
      m_version += strspn(m_version, " \t");
-     if (strcasecmp(m_version, "HTTP/1.1") != 0)
+     // HTTP/1.1預設保持連線，HTTP/1.0需明確帶Connection: keep-alive
+     if (strcasecmp(m_version, "HTTP/1.1") == 0)
+     {
+         m_linger = true;
+     }
+     else if (strcasecmp(m_version, "HTTP/1.0") == 0)
+     {
+         m_http10 = true;
+     }
+     else
      {
          return BAD_REQUEST;
      }
@@ -285,7 +865,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
          m_url = strchr(m_url, '/');
      }
 
-     if (!m_url || m_url[0] != '/')
+     // OPTIONS *：詢問整個伺服器支援的方法
+     bool asterisk = m_method == OPTIONS && m_url && strcmp(m_url, "*") == 0;
+     if (!asterisk && (!m_url || m_url[0] != '/'))
+     {
+         return BAD_REQUEST;
+     }
+     // 解碼並正規化，同一資源只有一種路徑，也不會以..離開網站根目錄
+     if (!asterisk && url::normalize(m_url, &m_query) < 0)
      {
          return BAD_REQUEST;
      }
@@ -294,7 +881,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
 }
 
 /*
-     傳入text，解析text所表示的header代表的資訊並記錄在變數中
+     傳入text，將標頭以偏移記錄到m_headers，並處理決定訊息體格式與連線狀態的標頭
+     其餘標頭只做記錄，需要時再由m_headers查詢並解析
      傳回值：
          如果存在content_lenth > 0，則傳回NO_REQUEST
              否則返回 GET_REQUEST
@@ -304,6 +892,23 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
 {
      if (text[0] == '\0')
      {
+         if (m_chunked)
+         {
+             // 同時帶有Content-Length時以chunked為準
+             m_chunk.reset();
+             if (m_method == PUT)
+             {
+                 // PUT的訊息體邊收邊解碼寫入暫存檔，長度不受讀取緩衝區限制
+                 m_upload_left = UPLOAD_CHUNKED;
+                 return GET_REQUEST;
+             }
+             // 其餘chunked訊息體在緩衝區內就地解碼，解碼結果由訊息體起點依序往前緊縮
+             m_upload_left = 0;
+             m_chunk_in = m_check_idx;
+             m_chunk_out = m_check_idx;
+             m_chek_state = CHECK_STATE_CONTETE;
+             return NO_REQUEST;
+         }
          if (m_content_length != 0 || m_method == http_conn::POST)
          {
              m_chek_state = CHECK_STATE_CONTETE;
@@ -311,52 +916,176 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
          }
          return GET_REQUEST;
      }
-     else if (strncasecmp(text, "Connection:", 11) == 0)
+
+     // 名稱：值，名稱與冒號之間不允許空白；冒號的位置取自parse_line
+     char *end = m_read_buf + m_check_idx - 2;
+     char *colon = m_line_colon >= 0 ? m_read_buf + m_line_colon : 0;
+     if (!colon || colon == text || colon[-1] == ' ' || colon[-1] == '\t')
      {
-         text += 11;
-         text += strspn(text, " \t");
-         if (strcasecmp(text, "keep-alive") == 0)
-         {
-             m_linger = true;
-         }
+         return BAD_REQUEST;
      }
-     else if (strncasecmp(text, "Content-Length:", 15) == 0)
+     char *value = colon + 1;
+     value += strspn(value, " \t");
+     char *value_end = end;
+     while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
      {
-         text += 15;
-         text += strspn(text, " \t");
-         m_content_length = atol(text);
+         --value_end;
      }
-     else if (strncasecmp(text, "Host:", 5) == 0)
+     *colon = '\0';
+     *value_end = '\0';
+
+     int id = m_headers.add(text - m_read_buf, colon - text, value - m_read_buf, value_end - value);
+     switch (id)
      {
-         text += 5;
-         text += strspn(text, " \t");
-         m_host = text;
+     case -1:
+     { // 標頭數量過多
+         return BAD_REQUEST;
      }
-
-     return NO_REQUEST;
-}
-
-/*
-     解析text傳入的post的body數據
-*/
-http_conn::HTTP_CODE http_conn::parse_content(char *text)
-{
-     if (m_read_idx >= (m_content_length + m_check_idx))
+     case http_headers::HDR_CONNECTION:
      {
-         text[m_content_length] = '\0';
-         // 如果是GET請求則直接忽略
-         if (m_method == http_conn::GET){
-             if(DEBUG==1){
-                 printf("!!!!! return GET_REQUEST\n");
-             }
-             return GET_REQUEST;
+         parse_connection(value);
+         break;
+     }
+     case http_headers::HDR_CONTENT_LENGTH:
+     {
+         long length = 0;
+         if (!m_headers.get_int(http_headers::HDR_CONTENT_LENGTH, length))
+         {
+             return BAD_REQUEST;
          }
-         else if (m_method == http_conn::POST)
+         // 重複的Content-Length必須一致，否則無法判斷訊息體邊界
+         if (strcmp(m_headers.get(http_headers::HDR_CONTENT_LENGTH), value) != 0)
          {
-             if(DEBUG==1){
-                 printf("!!!!! return POST_REQUEST\n");
-             }
-             // 記錄POST請求
+             return BAD_REQUEST;
+         }
+         // PUT與已註冊表單的訊息體邊收邊處理，不需完整放入讀取緩衝區
+         if (m_method == PUT || (m_method == POST && form::find_handler(m_url)))
+         {
+             m_upload_left = length;
+             break;
+         }
+         // 訊息體需完整放入讀取緩衝區，超過上限的請求無法處理；POST給cgi時改為邊收邊送入cgi的標準輸入
+         if (length > m_read_buffer_limit - m_check_idx)
+         {
+             size_t prefix;
+             const route *r = m_method == POST ? router::find(m_method, m_url, prefix) : 0;
+             if (r && (r->kind == route::CGI || r->kind == route::FASTCGI))
+             {
+                 m_upload_left = length;
+                 break;
+             }
+             return ENTITY_TOO_LARGE;
+         }
+         m_content_length = length;
+         break;
+     }
+     case http_headers::HDR_TRANSFER_ENCODING:
+     {
+         // chunked必須是最後一個編碼，同時出現時以Transfer-Encoding為準並忽略Content-Length
+         int len = value_end - value;
+         if (len < 7 || strncasecmp(value_end - 7, "chunked", 7) != 0)
+         {
+             return BAD_REQUEST;
+         }
+         m_chunked = true;
+         break;
+     }
+     case http_headers::HDR_HOST:
+     {
+         m_host = value;
+         break;
+     }
+     case http_headers::HDR_CONTENT_TYPE:
+     {
+         m_content_type = value;
+         break;
+     }
+     case http_headers::HDR_UPGRADE:
+     {
+         if (strcasecmp(value, "websocket") == 0)
+         {
+             m_upgrade_websocket = true;
+         }
+         break;
+     }
+     default:
+         break;
+     }
+
+     return NO_REQUEST;
+}
+
+/*
+     就地解碼chunked訊息體，可分多次呼叫，狀態保存在m_chunk中
+     解碼後的資料從訊息體起點（m_check_idx）連續存放，長度寫入m_content_length
+     傳回值：
+         GET_REQUEST：訊息體（含trailer）已完整，m_request_end指向下一個請求
+         NO_REQUEST：資料尚未收齊
+         BAD_REQUEST：格式錯誤
+         ENTITY_TOO_LARGE：目前chunk的資料已無法放入讀取緩衝區
+*/
+http_conn::HTTP_CODE http_conn::parse_chunked()
+{
+     size_t consumed = 0;
+     size_t out_len = 0;
+     chunked_decoder::STATUS status = m_chunk.decode(m_read_buf + m_chunk_in, m_read_idx - m_chunk_in,
+                                                     m_read_buf + m_chunk_out, consumed, out_len);
+     m_chunk_in += consumed;
+     m_chunk_out += out_len;
+     if (status == chunked_decoder::BAD)
+     {
+         return BAD_REQUEST;
+     }
+     if (status == chunked_decoder::DONE)
+     {
+         m_content_length = m_chunk_out - m_check_idx;
+         m_request_end = m_chunk_in;
+         return GET_REQUEST;
+     }
+     // chunk其餘的原始資料與結尾的\r\n需在緩衝區上限內，不必等到緩衝區填滿
+     if (m_chunk_in + m_chunk.remaining() + 2 > (unsigned long long)m_read_buffer_limit)
+     {
+         return ENTITY_TOO_LARGE;
+     }
+     return NO_REQUEST;
+}
+
+/*
+     解析text傳入的post的body數據，支援Content-Length與chunked兩種訊息體
+*/
+http_conn::HTTP_CODE http_conn::parse_content(char *text)
+{
+     bool complete = false;
+     if (m_chunked)
+     {
+         HTTP_CODE status = parse_chunked();
+         if (status == BAD_REQUEST || status == ENTITY_TOO_LARGE)
+         {
+             return status;
+         }
+         complete = (status == GET_REQUEST);
+     }
+     else if (m_read_idx >= (m_content_length + m_check_idx))
+     {
+         m_request_end = m_check_idx + m_content_length;
+         complete = true;
+     }
+     if (complete)
+     {
+         // 訊息體之後可能緊接著下一個pipeline請求，不可寫入'\0'，一律以m_content_length界定
+         // 如果不是POST請求則直接忽略訊息體
+         if (m_method != http_conn::POST){
+             if(DEBUG==1){
+                 printf("!!!!! return GET_REQUEST\n");
+             }
+             return GET_REQUEST;
+         }
+         else if (m_method == http_conn::POST)
+         {
+             if(DEBUG==1){
+                 printf("!!!!! return POST_REQUEST\n");
+             }
+             // 記錄POST請求
              m_content_data = text;
              return POST_REQUEST;
          }
@@ -406,6 +1135,7 @@ http_conn::HTTP_CODE http_conn::process_read()
              ret = parse_request_line(text);
              if (ret == BAD_REQUEST)
              {
+                 bad_request();
                  LOG_INFO("[%ld BAD_STATE_REQUESTLINE %s]", pthread_self(), m_url);
                  return BAD_REQUEST;
              }
@@ -415,17 +1145,19 @@ http_conn::HTTP_CODE http_conn::process_read()
          case CHECK_STATE_HEADER:
          {
              ret = parse_headers(text);
-             if (ret == BAD_REQUEST)
+             if (ret == BAD_REQUEST || ret == ENTITY_TOO_LARGE)
              {
+                 bad_request();
                  LOG_INFO("[%ld BAD_STATE_HEADER %s]", pthread_self(), m_url);
-                 return BAD_REQUEST;
+                 return ret;
              }
              else if (ret == GET_REQUEST)
              {
                  if(DEBUG == 2)
-                     printf("GET %s\n", m_url);
-                 LOG_INFO("[%ld GET %s]", pthread_self(), m_url);
-                 return do_request();
+                     printf("%s %s\n", method_names[m_method], m_url);
+                 LOG_INFO("[%ld %s %s]", pthread_self(), method_names[m_method], m_url);
+                 m_request_end = m_check_idx;
+                 return dispatch_request();
              }
              break;
          }
@@ -435,16 +1167,22 @@ http_conn::HTTP_CODE http_conn::process_read()
              if(DEBUG==1){
                  printf("CHECK_STATE_CONTETE = %d!\n", ret);
              }
-             if (ret == GET_REQUEST)
+             if (ret == BAD_REQUEST || ret == ENTITY_TOO_LARGE)
+             {
+                 bad_request();
+                 LOG_INFO("[%ld BAD_STATE_CONTENT %s]", pthread_self(), m_url);
+                 return ret;
+             }
+             else if (ret == GET_REQUEST)
              {
                  if(DEBUG==1){
                      printf("STATE = GET!\n");
                  }
                  if(DEBUG == 2){
-                     printf("GET : %s\n", m_url);
+                     printf("%s : %s\n", method_names[m_method], m_url);
                  }
-                 LOG_INFO("[%ld GET %s]", pthread_self(), m_url);
-                 return do_request();
+                 LOG_INFO("[%ld %s %s]", pthread_self(), method_names[m_method], m_url);
+                 return dispatch_request();
              }
              else if (ret == POST_REQUEST)
              {
@@ -455,167 +1193,142 @@ http_conn::HTTP_CODE http_conn::process_read()
                      printf("POST : %s\n", m_url);
                  }
                  LOG_INFO("[%ld POST %s]", pthread_self(), m_url);
-                 return do_cgi_request();
+                 return dispatch_request();
              }
              line_status = LINE_OPEN;
              break;
          }
          default:
          {
+             bad_request();
              return INTERNAL_ERROR;
          }
          }
      }
+     if (line_status == LINE_BAD)
+     {
+         bad_request();
+         return BAD_REQUEST;
+     }
+     // 目前的請求已佔滿讀取緩衝區且無法再擴充，不可能收完：以錯誤回應告知客戶端後關閉連線
+     if (m_read_idx >= m_read_size && m_read_size >= m_read_buffer_limit)
+     {
+         bad_request();
+         LOG_INFO("[%ld REQUEST_TOO_LARGE %s]", pthread_self(), m_url ? m_url : "");
+         return m_chek_state == CHECK_STATE_CONTETE ? ENTITY_TOO_LARGE : HEADER_TOO_LARGE;
+     }
      return NO_REQUEST;
 }
 
 /*
-     尋找cgi檔案是否存在，並執行
+     依請求方法分派：
+         OPTIONS回覆允許的方法、POST到已註冊的表單路徑由表單處理器處理
+         帶Upgrade: websocket與Connection: Upgrade的請求進行WebSocket握手
+         HTTP/1.x的GET請求SSE頻道路徑時訂閱該頻道
+         其餘請求依路由表處理（src/router.cpp）
 */
-http_conn::HTTP_CODE http_conn::do_cgi_request()
+http_conn::HTTP_CODE http_conn::dispatch_request()
 {
-     if(DEBUG==1){
-         printf("《==== POST請求處理 ====》\n");
-     }
-     // 確定cgi檔案路徑
-     strcpy(m_real_file, cgi_root);
-     int len = strlen(cgi_root);
-     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-
-     if (DEBUG==1)
+     if (m_upgrade_websocket && m_connection_upgrade)
      {
-         printf("CGI路徑: %s\n", m_real_file);
+         return do_websocket_request();
      }
-
-     // 資源不存在
-     if (stat(m_real_file, &m_file_stat) < 0)
+     if (m_method == GET && !m_h2)
      {
-         return NO_RESOURCE;
-     }
-     // 禁止讀
-     if (!(m_file_stat.st_mode & S_IROTH))
-     { // S_IROTH 其它讀
-         return FORBIDDEN_REQUEST;
+         m_sse_pending = sse::find_channel(m_url);
+         if (m_sse_pending)
+         {
+             return SSE_REQUEST;
+         }
      }
-     // 如果是路徑
-     if (S_ISDIR(m_file_stat.st_mode))
+     switch (m_method)
      {
-         return BAD_REQUEST;
+     case OPTIONS:
+         return OPTIONS_REQUEST;
+     case POST:
+     {
+         form_factory factory = form::find_handler(m_url);
+         if (factory)
+         {
+             return do_form_request(factory);
+         }
+         break;
      }
-     // 讀取檔案 映射到記憶體空間
-     if (DEBUG==1)
+     default:
+         break;
+     }
+     HTTP_CODE ret = do_route();
+     // 送入cgi的訊息體未被接收（例如腳本不存在），剩餘的訊息體無法略過，回應後關閉連線
+     if (m_upload_left > 0 && !uploading())
      {
-         printf("find cgi successful!, post data = %s\n", m_content_data);
+         bad_request();
      }
-     return execute_cgi();
+     return ret;
 }
 
 /*
-     已確定cgi檔案存在，現在執行cgi程式
+     m_real_file = root + path，過長時截斷
 */
-http_conn::HTTP_CODE http_conn::execute_cgi()
+void http_conn::real_file(const char *root, const char *path)
 {
-     /*
-         本函數實作想法如下：
-             1.在目前子執行緒中，fork一個子程序，並使用管道連接
-             2、關閉子進程中不必要的連接，並將管道讀寫檔案描述子重新導向為stdin和stdout
-             3.子程序執行execl，切換為cgi程式開始執行
-             4.cgi程式從stdin讀取數據，從stdout回傳數據
-             5、cgi程式執行完畢，應回收子程序並且關閉管道釋放資源
-     */
+     int len = strlen(root);
+     memcpy(m_real_file, root, len);
+     strncpy(m_real_file + len, path, FILENAME_LEN - len - 1);
+     m_real_file[FILENAME_LEN - 1] = '\0';
+}
 
-     // 01 pipe與fork
-     int cgi_out[2]; // cgi程式讀取管道
-     int cgi_in[2]; // cgi程式輸入管道
-     pid_t pid; // 進程號
+/*
+     HEAD請求：由快取的檔案狀態產生回應，不開啟也不映射檔案
+*/
+http_conn::HTTP_CODE http_conn::do_head_request(const char *root, const char *path)
+{
+     real_file(root, path);
 
-     // 建立管道
-     if(pipe(cgi_in) < 0){
-         return INTERNAL_ERROR; // 伺服器內部錯誤
-     }
-     if(pipe(cgi_out) < 0){
-         return INTERNAL_ERROR; // 伺服器內部錯誤
-     }
-     if(DEBUG==1){
-         printf("thread: %ld, call: execute_cgi, msg: pipe create successful!\n", pthread_self());
+     if (stat_cache::get(m_real_file, m_file_stat) < 0)
+     {
+         return NO_RESOURCE;
      }
-     if((pid = fork()) == 0){/* 該部分為子程序 */
-         close(cgi_out[0]); // pipe為單向通訊
-         close(cgi_in[1]);
-
-         dup2(cgi_out[1], 1); // dup2 stdin
-         dup2(cgi_in[0], 0); // dup2 stdout
-        
-         // 透過環境變數設定Content-Length傳遞
-         char content_env[30];
-         sprintf(content_env, "CONTENT_LENGTH=%d", m_content_length);
-         putenv(content_env);
-         execl(m_real_file, m_real_file, NULL);
-
-         if(DEBUG==1){
-             printf("thread: %ld, call: execute_cgi, msg: execute cgi failed!\n", pthread_self());
-         }
-         exit(1); // 執行成功時不應該到這
-
-     }else{/* 該部分為父程序 */
-         close(cgi_out[1]);
-         close(cgi_in[0]);
+     return check_file(m_file_stat);
+}
 
-         // 傳送content內容，因為pipe向cgi是帶有快取的，所以可以直接寫入
-         if(DEBUG==1){
-             printf("thread: %ld, call: execute_cgi, msg: main process close pipe!\n", pthread_self());
-             printf("write data : %ld : %s!\n", strlen(m_content_data), m_content_data);
-         }
-         int ret = writePipe(cgi_in[1], m_content_data, strlen(m_content_data));
-         if(DEBUG==1){
-             if(ret < 0){
-                 printf("error : %s\n", strerror(errno));
-             }
-             //printf("thread: %ld, call: execute_cgi, msg: write data %d bytes!\n", pthread_self(), ret);
-         }
-         while (readPipe(cgi_out[0], m_cgi_buf + strlen(m_cgi_buf), WRITE_BUFFER_SIZE - strlen(m_cgi_buf) - 1) > 0)
-         {
-             // 不斷讀取管道中資料並存入快取區中
-             if(DEBUG==1){
-                 printf("thread: %ld, call: execute_cgi, msg: recv cgi data : %s", pthread_self(), m_cgi_buf);
-             }
-         }
-         close(cgi_in[1]);
-         close(cgi_out[0]);
-         int status = 0;
-         waitpid(pid, &status, 0);
-         if(status > 0){
-             return INTERNAL_ERROR;
-         }
+/*
+     依檔案狀態判斷是否可以回傳該檔案
+     傳回值：
+         FILE_REQUEST：可取得
+         FORBIDDEN_REQUEST、BAD_REQUEST：不可取得
+*/
+http_conn::HTTP_CODE http_conn::check_file(const struct stat &st)
+{
+     // 禁止讀
+     if (!(st.st_mode & S_IROTH))
+     { // S_IROTH 其它讀
+         return FORBIDDEN_REQUEST;
      }
-     if(DEBUG==1){
-         printf("cgi exec successful!\n");
+     // 如果是路徑
+     if (S_ISDIR(st.st_mode))
+     {
+         return BAD_REQUEST;
      }
-     return CGI_REQUEST;
+     return FILE_REQUEST;
 }
 
 /*
-     目前僅支援GET請求，解析URL，判斷其是否可獲取
-     讀取靜態文件，將其透過記憶體映射從內核態到用戶態，減少IO操作次數
-     傳回值：
-         FILE_REQUEST: 可取得（資料已載入至記憶體)
-         BAD_REQUEST： 不可取得
+     尋找cgi檔案是否存在，並執行
 */
-http_conn::HTTP_CODE http_conn::do_request()
+http_conn::HTTP_CODE http_conn::do_cgi_request(const char *root, const char *path, fastcgi_pool *pool)
 {
      if(DEBUG==1){
-         printf("《==== GET請求處理 ====》\n");
+         printf("《==== POST請求處理 ====》\n");
      }
-     strcpy(m_real_file, doc_root);
-     int len = strlen(doc_root);
-     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+     // 確定cgi檔案路徑
+     real_file(root, path);
 
      if (DEBUG==1)
      {
-         printf("路徑: %s\n", m_real_file);
+         printf("CGI路徑: %s\n", m_real_file);
      }
 
-     // 資源不存在 m_real_file
+     // 資源不存在
      if (stat(m_real_file, &m_file_stat) < 0)
      {
          return NO_RESOURCE;
@@ -631,215 +1344,969 @@ http_conn::HTTP_CODE http_conn::do_request()
          return BAD_REQUEST;
      }
      // 讀取檔案 映射到記憶體空間
-     int fd = open(m_real_file, O_RDONLY);
-     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ,
-                                   MAP_PRIVATE, fd, 0);
-     close(fd);
-     return FILE_REQUEST;
-}
-
-/*
-     釋放記憶體中的檔案映射
-*/
-void http_conn::unmap()
-{
-     if (m_file_address)
+     if (DEBUG==1)
      {
-         munmap(m_file_address, m_file_stat.st_size);
-         m_file_address = 0;
+         printf("find cgi successful!, post data = %.*s\n", m_content_length, m_content_data);
      }
+     return execute_cgi(pool);
 }
 
 /*
-     將記憶體中的資料寫入請求方
+     已確定cgi檔案存在，交給主執行緒在背景執行（src/cgi.cpp），執行緒池不等待子程序
+     相同腳本與相同輸入的並發請求只會執行一次，其餘請求共享其輸出
+     有pool時交給FastCGI程式池執行，否則fork執行
+     設定快取的腳本（cgi_cache）命中時直接以快取的輸出回應，不啟動任何程式
 */
-bool http_conn::write()
+http_conn::HTTP_CODE http_conn::execute_cgi(fastcgi_pool *pool)
 {
-     int temp = 0;
-     int bytes_have_send = 0;
-     int bytes_to_send = m_write_idx;
-     if (bytes_to_send == 0)
+     if (m_upload_left > 0)
      {
-         modfd(m_epollfd, m_sockfd, EPOLLIN);
-         init();
-         return true;
+         return stream_cgi(pool);
      }
-     while (1)
+     std::string file(m_real_file);
+     std::string content(m_content_data, m_content_length);
+     const cgi_cache::policy *cache = cgi_cache::find(file);
+     std::string cache_key;
+     if (cache)
      {
-         temp = writev(m_sockfd, m_iv, m_iv_count);
-         if (temp <= -1)
+         std::vector<const char *> values;
+         for (size_t i = 0; i < cache->vary.size(); ++i)
          {
-             if (errno == EAGAIN)
-             {
-                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
-                 return true;
-             }
-             unmap();
-             return false;
+             values.push_back(request_header(cache->vary[i].c_str()));
          }
-         bytes_to_send -= temp;
-         bytes_have_send += temp;
-         if (bytes_to_send <= bytes_have_send)
+         std::string url(m_url);
+         if (m_query)
          {
-             unmap();
-             if (m_linger)
-             {
-                 init();
-                 modfd(m_epollfd, m_sockfd, EPOLLIN);
-                 return true;
-             }
-             else
-             {
-                 modfd(m_epollfd, m_sockfd, EPOLLIN);
-                 return false;
-             }
+             url.push_back('?');
+             url += m_query;
+         }
+         cache_key = cgi_cache::key(url, values, m_content_data, m_content_length);
+         // 舊的輸出照常回應，更新在背景執行，完成前的請求都不需要等待
+         bool refresh;
+         m_cgi = cgi_cache::lookup(cache_key, refresh);
+         if (refresh && !cgi::run(0, 0, 0, file, content, pool, cache_key, cache))
+         {
+             cgi_cache::abandon(cache_key);
+         }
+         if (m_cgi)
+         {
+             return CGI_REQUEST;
          }
      }
+     // 啟動前先計入，結果不會在登記前送達而被丟棄
+     m_push_mutex.lock();
+     ++m_cgi_running;
+     m_push_mutex.unlock();
+     if (!cgi::run(this, m_conn_id, m_h2 ? m_h2_stream : 0, file, content, pool, cache_key, cache))
+     {
+         m_push_mutex.lock();
+         --m_cgi_running;
+         m_push_mutex.unlock();
+         return INTERNAL_ERROR;
+     }
+     if(DEBUG==1){
+         printf("cgi started!\n");
+     }
+     return CGI_PENDING;
 }
 
 /*
-     將formt格式資料寫入回應中
+     訊息體超過讀取緩衝區的cgi請求：以已讀入的部分啟動cgi，其餘由process_upload邊收邊送入其標準輸入
+     cgi尚未寫入的內容過多時暫停讀取socket，寫入後再恢復，每條連線的記憶體用量與訊息體大小無關；
+     訊息體收完後與一般的cgi請求相同，等待輸出
 */
-bool http_conn::add_response(const char *formt, ...)
+http_conn::HTTP_CODE http_conn::stream_cgi(fastcgi_pool *pool)
 {
-     if (m_write_idx >= WRITE_BUFFER_SIZE)
+     long long total = m_upload_left;
+     size_t have = std::min((long long)(m_read_idx - m_check_idx), m_upload_left);
+     m_upload_left -= have;
+     m_request_end = m_check_idx + have;
+     std::string content(m_read_buf + m_check_idx, have);
+     m_push_mutex.lock();
+     ++m_cgi_running;
+     m_upload_paused = false;
+     m_push_mutex.unlock();
+     m_cgi_input = cgi::stream(this, m_conn_id, m_real_file, content, total, pool);
+     if (!m_cgi_input)
      {
-         return false;
+         m_push_mutex.lock();
+         --m_cgi_running;
+         m_push_mutex.unlock();
+         bad_request();
+         return INTERNAL_ERROR;
      }
-     va_list arg_list;
-     va_start(arg_list, formt);
-     int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, formt, arg_list);
-     if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+     if (m_upload_left == 0)
      {
-         return false;
+         cgi::close_input(m_cgi_input);
+         m_cgi_input.reset();
+         return CGI_PENDING;
      }
-     m_write_idx += len;
-     va_end(arg_list);
-     return true;
+     LOG_INFO("[%ld POST %s streaming %lld bytes to cgi]", pthread_self(), m_url, m_upload_left);
+     return UPLOAD_REQUEST;
 }
 
 /*
-     將狀態行寫入到回應的請求行中
+     目前請求中名稱為name（不分大小寫）的標頭，不存在時傳回0；HTTP/2時取自處理中的串流
 */
-bool http_conn::add_status_line(int status, const char *title)
+const char *http_conn::request_header(const char *name)
 {
-     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+     if (!m_h2 || m_h2_stream == 0)
+     {
+         return m_headers.get(name);
+     }
+     std::map<int, http2_stream>::iterator it = m_h2->streams.find(m_h2_stream);
+     if (it == m_h2->streams.end())
+     {
+         return 0;
+     }
+     const hpack::header_list &headers = it->second.headers;
+     for (size_t i = 0; i < headers.size(); ++i)
+     {
+         if (strcasecmp(headers[i].first.c_str(), name) == 0)
+         {
+             return headers[i].second.c_str();
+         }
+     }
+     return 0;
 }
 
 /*
-     將請求頭寫入到回應中
+     背景執行的cgi產生一段輸出，由主執行緒呼叫
+     片段排入連線後，連線閒置時喚醒主執行緒寫出；處理中時由擁有連線的執行緒在閒置前取出
 */
-bool http_conn::add_headers(int content_len)
+bool http_conn::cgi_output(unsigned long id, int stream, const std::shared_ptr<cgi_result> &piece)
 {
-     add_content_length(content_len);
-     add_linger();
-     add_blank_line();
+     bool notify = false;
+     m_push_mutex.lock();
+     if (m_conn_id != id || m_cgi_running == 0)
+     {
+         m_push_mutex.unlock();
+         return false;
+     }
+     m_cgi_done.push_back(std::make_pair(stream, piece));
+     if (m_push_state == PUSH_IDLE && !m_push_wake)
+     {
+         m_push_wake = true;
+         notify = true;
+     }
+     m_push_mutex.unlock();
+     if (notify)
+     {
+         wake();
+     }
      return true;
 }
 
-
-
-/*
-     寫入Content-Length大小
-*/
-bool http_conn::add_content_length(int content_len)
-{
-     return add_response("Content-Length: %d\r\n", content_len);
-}
-
 /*
-     寫入Connection狀態
+     主執行緒：串流送入cgi的內容已寫入子程序，暫停讀取的連線繼續接收訊息體
 */
-bool http_conn::add_linger()
+void http_conn::cgi_resume(unsigned long id)
 {
-     return add_response("Connection: %s\r\n", (m_linger == true) ? "keep-alive" : "close");
+     bool notify = false;
+     m_push_mutex.lock();
+     if (m_conn_id == id && m_upload_paused)
+     {
+         // 閒置時由主執行緒取得擁有權後重新註冊讀事件（rearm）
+         m_upload_paused = false;
+         if (m_push_state == PUSH_IDLE && !m_push_wake)
+         {
+             m_push_wake = true;
+             notify = true;
+         }
+     }
+     m_push_mutex.unlock();
+     if (notify)
+     {
+         wake();
+     }
 }
 
 /*
-     寫入空白行
+     將已收到的cgi輸出加入批次：
+         HTTP/1.1第一段送出狀態與標頭，之後每段為一個chunk；cgi請求之後的pipeline請求在最後一段送出後才繼續解析；
+         HTTP/2交給對應的串流，串流已被重設時丟棄
+     片段在寫出後才釋放，cgi依此暫停或恢復讀取輸出，客戶端讀取過慢時子程序也隨之暫停
+     傳回值：回應無法加入批次或標頭送出後cgi失敗時為false，需關閉連線
 */
-bool http_conn::add_blank_line()
+bool http_conn::cgi_deliver()
 {
-     return add_response("%s", "\r\n");
-}
-
-/*
-     追加內容 Content內容
+     if (m_cgi_running == 0)
+     {
+         return true;
+     }
+     std::vector<std::pair<int, std::shared_ptr<cgi_result>>> done;
+     m_push_mutex.lock();
+     done.swap(m_cgi_done);
+     m_push_mutex.unlock();
+     size_t i = 0;
+     int finished = 0;
+     bool ok = true;
+     bool aborted = false;
+     // 寫入緩衝區或iovec不足時，其餘片段留到這批寫完
+     for (; i < done.size() && ok && !aborted && cgi_has_room(*done[i].second); ++i)
+     {
+         const std::shared_ptr<cgi_result> &piece = done[i].second;
+         if (piece->last)
+         {
+             ++finished;
+         }
+         if (m_h2)
+         {
+             h2_cgi_output(done[i].first, piece);
+             continue;
+         }
+         if (piece->last && uploading())
+         {
+             // cgi已結束但訊息體還沒收完，剩餘的訊息體無法略過，回應後關閉連線
+             m_linger = false;
+         }
+         m_cgi = piece;
+         if (piece->head)
+         {
+             ok = process_wirte(piece->code);
+         }
+         else if (piece->code != CGI_REQUEST)
+         {
+             // 標頭已送出，無法再改為錯誤回應：寫出批次中已有的資料後關閉連線，客戶端收不到結尾的chunk
+             m_linger = false;
+             m_batch_linger = false;
+             ok = m_bytes_to_send > 0;
+             aborted = true;
+         }
+         else if (m_http10)
+         {
+             // HTTP/1.0的後續輸出直接送出，最後關閉連線；結束時沒有資料可寫則直接關閉
+             add_iv((char *)piece->output.data(), piece->output.size());
+             ok = !piece->last || m_bytes_to_send > 0;
+         }
+         else
+         {
+             ok = add_chunk((char *)piece->output.data(), piece->output.size()) && (!piece->last || add_last_chunk());
+         }
+         if (ok && !aborted)
+         {
+             m_batch_refs[m_batch_count++] = piece;
+             m_batch_linger = true;
+             if (piece->last)
+             {
+                 m_batch_linger = m_linger;
+                 if (!uploading())
+                 {
+                     next_request();
+                 }
+             }
+         }
+         m_cgi.reset();
+     }
+     m_push_mutex.lock();
+     m_cgi_done.insert(m_cgi_done.begin(), done.begin() + i, done.end());
+     m_cgi_running -= finished;
+     m_push_mutex.unlock();
+     if (m_h2 && i > 0)
+     {
+         h2_flush();
+     }
+     return ok;
+}
+
+/*
+     批次是否還能容納一段cgi輸出：chunk的框架或DATA訊框寫入m_write_buf，資料本身以iovec引用
+     第一段的標頭在HTTP/2時需編碼進寫入緩衝區，批次為空時一定放得下（cgi限制了標頭區塊的大小）
 */
-bool http_conn::add_content(const char *content)
+bool http_conn::cgi_has_room(const cgi_result &piece)
 {
-     return add_response("%s", content);
+     size_t need = 256 + (piece.head ? 2 * piece.header_lines.size() : 0);
+     return (m_write_idx == 0 || WRITE_BUFFER_SIZE - m_write_idx >= (int)need) &&
+            m_iv_count + 8 <= 3 * MAX_BATCH_REQUESTS && m_batch_count < MAX_BATCH_REQUESTS;
 }
 
 /*
-     採用狀態機進行資料的回复
+     GET請求：root下的靜態檔案，判斷其是否可獲取
+     讀取靜態文件，將其透過記憶體映射從內核態到用戶態，減少IO操作次數
+     傳回值：
+         FILE_REQUEST: 可取得（資料已載入至記憶體)
+         BAD_REQUEST： 不可取得
 */
-bool http_conn::process_wirte(HTTP_CODE ret)
+http_conn::HTTP_CODE http_conn::do_request(const char *root, const char *path)
 {
-     switch (ret)
+     if(DEBUG==1){
+         printf("《==== GET請求處理 ====》\n");
+     }
+     real_file(root, path);
+
+     if (DEBUG==1)
      {
-     case INTERNAL_ERROR:
-     { // 伺服器內部錯誤，傳回500狀態碼 和 詳細資訊
-         add_status_line(500, error_500_title);
-         add_headers(strlen(error_500_form));
-         if (!add_content(error_500_form))
+         printf("路徑: %s\n", m_real_file);
+     }
+
+     // 同一檔案的並發請求只由一個執行緒stat並mmap，其餘共享該映射
+     m_file = m_file_flight.do_call(m_real_file, std::bind(&http_conn::load_file, std::string(m_real_file)));
+     m_file_stat = m_file->st;
+     m_file_address = m_file->address;
+     return m_file->code;
+}
+
+/*
+     檢查並載入靜態文件，由single-flight的領頭執行緒呼叫
+     傳回值中的code：
+         FILE_REQUEST: 可取得（資料已載入至記憶體)
+         NO_RESOURCE、FORBIDDEN_REQUEST、BAD_REQUEST、INTERNAL_ERROR： 不可取得
+*/
+std::shared_ptr<http_conn::file_result> http_conn::load_file(const std::string &file)
+{
+     std::shared_ptr<file_result> res(new file_result());
+     // 資源不存在
+     if (stat(file.c_str(), &res->st) < 0)
+     {
+         res->code = NO_RESOURCE;
+         return res;
+     }
+     res->code = check_file(res->st);
+     if (res->code != FILE_REQUEST)
+     {
+         return res;
+     }
+     // 讀取檔案 映射到記憶體空間
+     if (res->st.st_size > 0)
+     {
+         int fd = open(file.c_str(), O_RDONLY);
+         if (fd < 0)
          {
-             return false;
+             res->code = INTERNAL_ERROR;
+             return res;
          }
-         break;
+         void *address = mmap(0, res->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         close(fd);
+         if (address == MAP_FAILED)
+         {
+             res->code = INTERNAL_ERROR;
+             return res;
+         }
+         res->address = (char *)address;
      }
+     res->code = FILE_REQUEST;
+     return res;
+}
+
+/*
+     釋放目前請求與整個批次所引用的檔案映射及cgi輸出
+*/
+void http_conn::unmap()
+{
+     // 映射由file_result共享持有，最後一個使用者釋放時才會munmap
+     // 延後寫入的回應仍需要目前請求的檔案或cgi輸出
+     if (m_pending_write == NO_REQUEST)
+     {
+         m_file.reset();
+         m_cgi.reset();
+         m_file_address = 0;
+     }
+     for (int i = 0; i < m_batch_count; ++i)
+     {
+         m_batch_refs[i].reset();
+     }
+     m_batch_count = 0;
+}
 
-     case BAD_REQUEST:
-     { // 請求錯誤，回傳400狀態碼
-         add_status_line(400, err_400_title);
-         add_headers(strlen(error_400_form));
-         if (!add_content(error_400_form))
+/*
+     將記憶體中的資料寫入請求方，一次writev送出整個批次的回應
+     批次寫完後若緩衝區中還有pipeline請求，設定m_pipelined，交由呼叫方重新排入執行緒池
+*/
+bool http_conn::write()
+{
+     int temp = 0;
+     push_claim();
+     if (m_ssl && m_tls_handshake)
+     {
+         int ret = tls_handshake();
+         if (ret == 1)
+         {
+             arm_read();
+         }
+         return ret >= 0;
+     }
+     if (m_bytes_to_send == 0)
+     {
+         // 只為讀取TLS中已解密的資料而觸發，交給執行緒池讀入後處理
+         m_pipelined = tls_buffered();
+         return m_pipelined || rearm();
+     }
+     while (1)
+     {
+         if (m_ssl && !m_ktls_send)
+         {
+             temp = tls_writev();
+         }
+         else
          {
+             temp = writev(m_sockfd, m_iv, m_iv_count);
+         }
+         if (temp <= -1)
+         {
+             if (errno == EAGAIN)
+             {
+                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                 return true;
+             }
+             unmap();
              return false;
          }
-         break;
+         m_bytes_to_send -= temp;
+         m_bytes_have_send += temp;
+         if (m_bytes_to_send <= 0)
+         {
+             unmap();
+             m_write_idx = 0;
+             m_iv_count = 0;
+             m_bytes_to_send = 0;
+             m_bytes_have_send = 0;
+             if (m_batch_linger)
+             {
+                 // HTTP/1.1等待cgi時之後的請求需等其回應送出
+                 m_pipelined = (m_read_idx > 0 && (m_h2 || m_cgi_running == 0)) || m_pending_write != NO_REQUEST ||
+                               h2_want_write() || (tls_buffered() && (m_h2 || m_cgi_running == 0));
+                 if (m_pipelined)
+                 {
+                     return true;
+                 }
+                 // 寫完期間排入的推送資料直接組成下一批送出
+                 int pushed = push_drain();
+                 if (pushed < 0)
+                 {
+                     return false;
+                 }
+                 if (pushed > 0)
+                 {
+                     continue;
+                 }
+                 return rearm();
+             }
+             else
+             {
+                 modfd(m_epollfd, m_sockfd, EPOLLIN);
+                 return false;
+             }
+         }
+         // 部分寫入：略過已送出的iovec，避免下次writev重送
+         int i = 0;
+         while (i < m_iv_count && (size_t)temp >= m_iv[i].iov_len)
+         {
+             temp -= m_iv[i].iov_len;
+             ++i;
+         }
+         if (i > 0)
+         {
+             memmove(m_iv, m_iv + i, (m_iv_count - i) * sizeof(struct iovec));
+             m_iv_count -= i;
+         }
+         m_iv[0].iov_base = (char *)m_iv[0].iov_base + temp;
+         m_iv[0].iov_len -= temp;
      }
+}
 
-     case NO_RESOURCE:
-     { // 請求資源不存在 回傳404狀態碼
-         add_status_line(404, error_404_title);
-         add_headers(strlen(error_404_form));
-         if (!add_content(error_404_form))
+/*
+     將已編碼好的資料排入推送佇列（WebSocket訊息等），可在任何執行緒呼叫
+     id需與目前連線相同，避免fd被重複使用後送到新的連線；資料唯讀，可同時排入多條連線
+     連線閒置等待讀事件時，由主執行緒透過eventfd喚醒後寫出
+     傳回值：連線已關閉或佇列溢位時為false，溢位的連線會在主執行緒中關閉
+*/
+bool http_conn::push(unsigned long id, const std::shared_ptr<std::string> &data)
+{
+     bool wake = false;
+     m_push_mutex.lock();
+     if (!m_push_enabled || m_conn_id != id || m_push_overflow)
+     {
+         m_push_mutex.unlock();
+         return false;
+     }
+     if (m_push_queue.size() >= MAX_PUSH_QUEUE || m_push_bytes + data->size() > MAX_PUSH_BYTES)
+     {
+         // 客戶端讀取過慢，不再累積資料，由擁有連線的執行緒關閉
+         m_push_overflow = true;
+         m_push_queue.clear();
+         m_push_bytes = 0;
+     }
+     else
+     {
+         m_push_queue.push_back(data);
+         m_push_bytes += data->size();
+     }
+     if (m_push_state == PUSH_IDLE && !m_push_wake)
+     {
+         m_push_wake = true;
+         wake = true;
+     }
+     bool ok = !m_push_overflow;
+     m_push_mutex.unlock();
+
+     if (wake)
+     {
+         this->wake();
+     }
+     return ok;
+}
+
+/*
+     將閒置的連線加入喚醒清單，由主執行緒處理
+*/
+void http_conn::wake()
+{
+     // 清單原本為空時才需要通知，廣播給大量連線時只觸發一次eventfd
+     m_wake_mutex.lock();
+     bool notify = m_wakeups.empty();
+     m_wakeups.push_back(this);
+     m_wake_mutex.unlock();
+     if (notify)
+     {
+         uint64_t one = 1;
+         writePipe(m_wake_fd, &one, sizeof(one));
+     }
+}
+
+/*
+     取出待喚醒的連線，由主執行緒在處理完epoll事件後呼叫
+*/
+void http_conn::take_wakeups(std::vector<http_conn *> &conns)
+{
+     uint64_t count;
+     readPipe(m_wake_fd, &count, sizeof(count));
+     m_wake_mutex.lock();
+     conns.swap(m_wakeups);
+     m_wake_mutex.unlock();
+}
+
+/*
+     主執行緒處理推送與cgi完成的喚醒：連線仍閒置時取得擁有權，將佇列內容與cgi回應寫出
+     連線已在處理中時不做任何事，佇列由處理中的執行緒在結束前取出
+*/
+bool http_conn::push_wakeup()
+{
+     m_pipelined = false;
+     m_push_mutex.lock();
+     m_push_wake = false;
+     if ((!m_push_enabled && m_cgi_running == 0) || m_push_state != PUSH_IDLE)
+     {
+         m_push_mutex.unlock();
+         return true;
+     }
+     m_push_state = PUSH_BUSY;
+     m_push_mutex.unlock();
+     if (push_drain() < 0 || !cgi_deliver())
+     {
+         return false;
+     }
+     bool ok = write();
+     if (ok && m_pipelined)
+     {
+         // 閒置時註冊的讀事件仍有效，交給執行緒池前先移出epoll，避免主執行緒同時讀取
+         epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_sockfd, 0);
+     }
+     return ok;
+}
+
+/*
+     連線切換為推送模式（WebSocket），由目前處理連線的執行緒呼叫
+*/
+void http_conn::push_enable()
+{
+     m_push_mutex.lock();
+     m_push_enabled = true;
+     m_push_state = PUSH_BUSY;
+     m_push_mutex.unlock();
+}
+
+/*
+     主執行緒收到讀寫事件時取得推送連線的擁有權，之後的push()不再喚醒
+*/
+void http_conn::push_claim()
+{
+     if (m_push_enabled || m_cgi_running)
+     {
+         m_push_mutex.lock();
+         m_push_state = PUSH_BUSY;
+         m_push_mutex.unlock();
+     }
+}
+
+/*
+     將推送佇列中的資料以iovec直接引用加入目前批次
+     傳回值：加入的項目數，佇列曾溢位時為-1
+*/
+int http_conn::push_drain()
+{
+     int count = 0;
+     m_push_mutex.lock();
+     if (m_push_overflow)
+     {
+         m_push_mutex.unlock();
+         return -1;
+     }
+     while (!m_push_queue.empty() && m_batch_count < MAX_BATCH_REQUESTS && m_iv_count < 3 * MAX_BATCH_REQUESTS &&
+            m_bytes_to_send < MAX_BATCH_BYTES)
+     {
+         std::shared_ptr<std::string> &data = m_push_queue.front();
+         add_iv((char *)data->data(), data->size());
+         m_push_bytes -= data->size();
+         m_batch_refs[m_batch_count++] = std::move(data);
+         m_push_queue.pop_front();
+         ++count;
+     }
+     m_push_mutex.unlock();
+     return count;
+}
+
+/*
+     沒有待寫資料時註冊讀事件
+     推送連線與等待cgi的連線需在鎖內確認佇列為空才進入閒置，之後的push()與cgi_output()會喚醒主執行緒
+     HTTP/1.1等待cgi時不註冊讀事件，之後的pipeline請求需等cgi回應送出後才處理；
+     訊息體串流送入cgi時照常註冊，但cgi尚未寫入的內容過多而暫停時不註冊，由cgi_resume喚醒
+     傳回值：true表示已進入閒置；false表示佇列還有資料（或已溢位）或cgi已完成，需先寫出
+*/
+bool http_conn::wait_read()
+{
+     if (!m_push_enabled && m_cgi_running == 0)
+     {
+         arm_read();
+         return true;
+     }
+     m_push_mutex.lock();
+     bool idle = m_push_queue.empty() && !m_push_overflow && m_cgi_done.empty();
+     if (idle)
+     {
+         m_push_state = PUSH_IDLE;
+         // 在鎖內重新註冊，避免喚醒的主執行緒先寫出並註冊EPOLLOUT後又被覆蓋
+         if (m_push_enabled || m_h2 || m_cgi_running == 0 || (m_cgi_input && !m_upload_paused))
+         {
+             arm_read();
+         }
+     }
+     m_push_mutex.unlock();
+     return idle;
+}
+
+/*
+     批次處理結束時依是否有待寫資料重新註冊事件
+     傳回值：推送佇列溢位時為false，需關閉連線
+*/
+bool http_conn::rearm()
+{
+     while (m_bytes_to_send == 0)
+     {
+         if (wait_read())
+         {
+             return true;
+         }
+         if (push_drain() < 0 || !cgi_deliver())
          {
              return false;
          }
-         break;
      }
+     modfd(m_epollfd, m_sockfd, EPOLLOUT);
+     return true;
+}
+
+/*
+     將formt格式資料寫入回應中
+*/
+bool http_conn::add_response(const char *formt, ...)
+{
+     if (m_write_idx >= WRITE_BUFFER_SIZE)
+     {
+         return false;
+     }
+     va_list arg_list;
+     va_start(arg_list, formt);
+     int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, formt, arg_list);
+     if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
+     {
+         return false;
+     }
+     m_write_idx += len;
+     va_end(arg_list);
+     return true;
+}
+
+/*
+     將len個位元組直接複製到寫入緩衝區
+*/
+bool http_conn::add_bytes(const char *data, int len)
+{
+     if (m_write_idx + len > WRITE_BUFFER_SIZE)
+     {
+         return false;
+     }
+     memcpy(m_write_buf + m_write_idx, data, len);
+     m_write_idx += len;
+     return true;
+}
+
+/*
+     將狀態行寫入到回應的請求行中，常用狀態碼直接複製預先組好的字串
+*/
+bool http_conn::add_status_line(int status, const char *title)
+{
+     for (size_t i = 0; i < sizeof(status_lines) / sizeof(status_lines[0]); ++i)
+     {
+         if (status_lines[i].status == status)
+         {
+             return add_bytes(status_lines[i].line, status_lines[i].len);
+         }
+     }
+     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+}
+
+/*
+     將請求頭寫入到回應中
+*/
+bool http_conn::add_headers(int content_len)
+{
+     return add_content_length(content_len) && add_linger() && add_date() && add_blank_line();
+}
+
+/*
+     以chunked編碼寫入請求頭，訊息體長度不需事先知道
+*/
+bool http_conn::add_chunked_headers()
+{
+     return add_bytes(FRAGMENT(transfer_chunked)) && add_linger() && add_date() && add_blank_line();
+}
+
+/*
+     加入一個chunk：大小行與結尾\r\n寫入m_write_buf，資料本身以iovec引用
+     呼叫前需先以add_iv加入目前回應在m_write_buf中的標頭部分
+*/
+bool http_conn::add_chunk(char *data, size_t len)
+{
+     if (len == 0)
+     {
+         // 長度0代表結束，不可當作一般chunk送出
+         return true;
+     }
+     char size_line[20];
+     int n = http_format::format_hex(size_line, len);
+     size_line[n++] = '\r';
+     size_line[n++] = '\n';
+     int start = m_write_idx;
+     if (!add_bytes(size_line, n))
+     {
+         return false;
+     }
+     add_iv(m_write_buf + start, m_write_idx - start);
+     add_iv(data, len);
+     start = m_write_idx;
+     if (!add_blank_line())
+     {
+         return false;
+     }
+     add_iv(m_write_buf + start, m_write_idx - start);
+     return true;
+}
+
+/*
+     加入結尾的0長度chunk
+*/
+bool http_conn::add_last_chunk()
+{
+     int start = m_write_idx;
+     if (!add_bytes(FRAGMENT(last_chunk)))
+     {
+         return false;
+     }
+     add_iv(m_write_buf + start, m_write_idx - start);
+     return true;
+}
+
+/*
+     寫入Content-Length大小
+*/
+bool http_conn::add_content_length(int content_len)
+{
+     char line[sizeof(content_length_prefix) + 24];
+     memcpy(line, content_length_prefix, sizeof(content_length_prefix) - 1);
+     int n = sizeof(content_length_prefix) - 1;
+     n += http_format::format_dec(line + n, content_len);
+     line[n++] = '\r';
+     line[n++] = '\n';
+     return add_bytes(line, n);
+}
+
+/*
+     寫入Connection狀態，保持連線時一併告知剩餘可用的請求數
+*/
+bool http_conn::add_linger()
+{
+     if (m_linger)
+     {
+         return add_bytes(FRAGMENT(connection_keep_alive)) && add_keep_alive();
+     }
+     return add_bytes(FRAGMENT(connection_close));
+}
+
+/*
+     寫入Keep-Alive: max=剩餘請求數
+*/
+bool http_conn::add_keep_alive()
+{
+     char line[sizeof(keep_alive_prefix) + 24];
+     memcpy(line, keep_alive_prefix, sizeof(keep_alive_prefix) - 1);
+     int n = sizeof(keep_alive_prefix) - 1;
+     n += http_format::format_dec(line + n, m_max_keep_alive_requests - m_request_count);
+     line[n++] = '\r';
+     line[n++] = '\n';
+     return add_bytes(line, n);
+}
+
+/*
+     寫入Date，每秒只格式化一次並由所有執行緒共用
+*/
+bool http_conn::add_date()
+{
+     if (m_write_idx + http_format::DATE_HEADER_LEN > WRITE_BUFFER_SIZE)
+     {
+         return false;
+     }
+     m_write_idx += http_format::date_header(m_write_buf + m_write_idx);
+     return true;
+}
+
+/*
+     寫入空白行
+*/
+bool http_conn::add_blank_line()
+{
+     return add_bytes(FRAGMENT(crlf));
+}
+
+/*
+     訊息體尚未收完時，依Expect: 100-continue回覆一次100 Continue（HTTP/1.0客戶端不認得1xx，不送出）
+*/
+void http_conn::add_continue()
+{
+     if (m_continue_sent || m_http10)
+     {
+         return;
+     }
+     const char *expect = m_headers.get(http_headers::HDR_EXPECT);
+     if (!expect || strcasecmp(expect, "100-continue") != 0)
+     {
+         return;
+     }
+     int start = m_write_idx;
+     if (add_bytes(FRAGMENT(continue_100)))
+     {
+         add_iv(m_write_buf + start, m_write_idx - start);
+         m_continue_sent = true;
+         // 之後還要接收訊息體，寫完後不可關閉連線
+         m_batch_linger = true;
+     }
+}
+
+/*
+     追加內容 Content內容，HEAD請求只回傳標頭
+*/
+bool http_conn::add_content(const char *content)
+{
+     if (m_method == HEAD)
+     {
+         return true;
+     }
+     return add_bytes(content, strlen(content));
+}
 
-     case FORBIDDEN_REQUEST:
-     { // 權限不允許 回傳403狀態碼
-         add_status_line(403, error_403_title);
-         add_headers(strlen(error_403_form));
-         if (!add_content(error_403_form))
+/*
+     將一段待送出的資料加入iovec，與前一段在記憶體中相鄰時直接合併
+*/
+void http_conn::add_iv(char *base, size_t len)
+{
+     if (len == 0)
+     {
+         return;
+     }
+     if (m_iv_count > 0)
+     {
+         struct iovec &last = m_iv[m_iv_count - 1];
+         if ((char *)last.iov_base + last.iov_len == base)
+         {
+             last.iov_len += len;
+             m_bytes_to_send += len;
+             return;
+         }
+     }
+     m_iv[m_iv_count].iov_base = base;
+     m_iv[m_iv_count].iov_len = len;
+     m_iv_count++;
+     m_bytes_to_send += len;
+}
+
+/*
+     以iovec直接引用預先組好的錯誤回應，只有Date寫入m_write_buf
+*/
+bool http_conn::add_error_response(HTTP_CODE ret)
+{
+     for (size_t i = 0; i < sizeof(error_responses) / sizeof(error_responses[0]); ++i)
+     {
+         const error_response &r = error_responses[i];
+         if (r.code != ret)
+         {
+             continue;
+         }
+         const std::string &head = r.head[m_linger ? 1 : 0];
+         int start = m_write_idx;
+         if ((m_linger && !add_keep_alive()) || !add_date())
          {
              return false;
          }
-         break;
+         add_iv((char *)head.data(), head.size());
+         add_iv(m_write_buf + start, m_write_idx - start);
+         // HEAD請求只送出空白行
+         add_iv((char *)r.tail.data(), m_method == HEAD ? 2 : r.tail.size());
+         return true;
      }
+     return false;
+}
+
+/*
+     採用狀態機進行資料的回复
+     回應附加在目前批次之後：標頭寫入m_write_buf，檔案與cgi輸出以iovec直接引用
+*/
+bool http_conn::process_wirte(HTTP_CODE ret)
+{
+     int start = m_write_idx;
+     switch (ret)
+     {
+     case INTERNAL_ERROR: // 伺服器內部錯誤，傳回500狀態碼 和 詳細資訊
+     case BAD_REQUEST: // 請求錯誤，回傳400狀態碼
+     case NO_RESOURCE: // 請求資源不存在 回傳404狀態碼
+     case ENTITY_TOO_LARGE: // 訊息體超過讀取緩衝區上限 回傳413狀態碼
+     case HEADER_TOO_LARGE: // 請求行或標頭超過讀取緩衝區上限 回傳431狀態碼
+     case FORBIDDEN_REQUEST: // 權限不允許 回傳403狀態碼
+     case GATEWAY_TIMEOUT: // cgi逾時 回傳504狀態碼
+     case METHOD_NOT_ALLOWED: // 不支援的方法 回傳405狀態碼與Allow
+         return add_error_response(ret);
 
      case FILE_REQUEST:
      { // 取得了文件
-         add_status_line(200, ok_200_title);
+         if (!add_status_line(200, ok_200_title))
+         {
+             return false;
+         }
          if (m_file_stat.st_size != 0)
          {
-             add_headers(m_file_stat.st_size);
-             m_iv[0].iov_base = m_write_buf;
-             m_iv[0].iov_len = m_write_idx;
-             m_iv[1].iov_base = m_file_address;
-             m_iv[1].iov_len = m_file_stat.st_size;
-             m_iv_count = 2;
+             if (!add_headers(m_file_stat.st_size))
+             {
+                 return false;
+             }
+             add_iv(m_write_buf + start, m_write_idx - start);
+             if (m_method != HEAD)
+             {
+                 add_iv(m_file_address, m_file_stat.st_size);
+             }
              return true;
          }
          else
          {
              const char *ok_string = "<html><body></body></html>";
-             add_headers(strlen(ok_string));
-             if (!add_content(ok_string))
+             if (!add_headers(strlen(ok_string)) || !add_content(ok_string))
              {
                  return false;
              }
@@ -847,44 +2314,273 @@ bool http_conn::process_wirte(HTTP_CODE ret)
          break;
      }
     
-     case CGI_REQUEST:
-     {// 取得了cgi
-         add_status_line(200, ok_200_title);
-         add_headers(strlen(m_cgi_buf));
-         add_response(m_cgi_buf);
-         m_iv[0].iov_base = m_write_buf;
-         m_iv[0].iov_len = m_write_idx;
-         m_iv_count = 1;
+     case OPTIONS_REQUEST:
+     { // 回覆允許的方法，不帶訊息體
+         if (!add_status_line(200, ok_200_title) || !add_bytes(router::allow_header().data(), router::allow_header().size()) || !add_headers(0))
+         {
+             return false;
+         }
+         break;
+     }
+
+     case WEBSOCKET_REQUEST:
+     { // 握手成功，回覆101後此連線改以WebSocket訊框收發
+         m_linger = true;
+         if (!add_websocket_accept())
+         {
+             return false;
+         }
+         add_iv(m_write_buf + start, m_write_idx - start);
+         ws_start();
          return true;
      }
 
+     case CREATED_REQUEST:
+     { // PUT建立了新檔案
+         if (!add_status_line(201, "Created") || !add_headers(0))
+         {
+             return false;
+         }
+         break;
+     }
+
+     case UPDATED_REQUEST:
+     { // PUT取代了既有檔案
+         if (!add_status_line(200, ok_200_title) || !add_headers(0))
+         {
+             return false;
+         }
+         break;
+     }
+
+     case MOVED_REQUEST:
+     case FOUND_REQUEST:
+     { // 路由重新導向，Location與標頭一起寫入m_write_buf
+         if (!add_status_line(ret == MOVED_REQUEST ? 301 : 302, ret == MOVED_REQUEST ? "Moved Permanently" : "Found") ||
+             !add_bytes(FRAGMENT(location_prefix)) || !add_bytes(m_location.data(), m_location.size()) ||
+             !add_bytes(FRAGMENT(crlf)) || !add_headers(0))
+         {
+             return false;
+         }
+         break;
+     }
+
+     case SSE_REQUEST:
+     { // 事件串流沒有長度，之後不再解析請求，只送出頻道發布的事件
+         m_linger = true;
+         if (!add_sse_headers())
+         {
+             return false;
+         }
+         add_iv(m_write_buf + start, m_write_idx - start);
+         sse_start();
+         return true;
+     }
+
+     case CGI_REQUEST:
+     {// 取得了cgi輸出的第一段，狀態與其他標頭取自cgi
+         if (!add_status_line(m_cgi->status, m_cgi->reason.c_str()))
+         {
+             return false;
+         }
+         add_iv(m_write_buf + start, m_write_idx - start);
+         if (!m_cgi->header_lines.empty())
+         {
+             add_iv((char *)m_cgi->header_lines.data(), m_cgi->header_lines.size());
+         }
+         start = m_write_idx;
+         if (m_cgi->last)
+         {
+             // 輸出已完整（快取命中、行程內端點與表單、短的cgi輸出），長度已知
+             if (!add_headers(m_cgi->output.size()))
+             {
+                 return false;
+             }
+             add_iv(m_write_buf + start, m_write_idx - start);
+             add_iv((char *)m_cgi->output.data(), m_cgi->output.size());
+             return true;
+         }
+         if (m_http10)
+         {
+             // HTTP/1.0不支援chunked，長度無法事先得知時以關閉連線表示訊息體結束
+             m_linger = false;
+             if (!add_linger() || !add_date() || !add_blank_line())
+             {
+                 return false;
+             }
+             add_iv(m_write_buf + start, m_write_idx - start);
+             add_iv((char *)m_cgi->output.data(), m_cgi->output.size());
+             return true;
+         }
+         // 輸出長度無法事先得知，以chunked編碼回傳
+         if (!add_chunked_headers())
+         {
+             return false;
+         }
+         add_iv(m_write_buf + start, m_write_idx - start);
+         if (!add_chunk((char *)m_cgi->output.data(), m_cgi->output.size()))
+         {
+             return false;
+         }
+         return !m_cgi->last || add_last_chunk();
+     }
+
      default:
          return false;
      }
 
-     m_iv[0].iov_base = m_write_buf;
-     m_iv[0].iov_len = m_write_idx;
-     m_iv_count = 1;
-     return false;
+     add_iv(m_write_buf + start, m_write_idx - start);
+     return true;
 }
 
 /*
      處理線程：讀 + 寫
+     依序解析緩衝區中所有完整的請求，將回應收集成一個批次，由write()一次送出
+     批次在請求數、位元組數或寫入緩衝區剩餘空間達上限，或遇到需關閉連線的回應時結束
 */
 void http_conn::process()
 {
-     HTTP_CODE read_ret = process_read();
-     if (read_ret == NO_REQUEST)
+     m_pipelined = false;
+     if (uploading())
      {
-         modfd(m_epollfd, m_sockfd, EPOLLIN);
+         process_upload();
          return;
      }
-
-     bool write_ret = process_wirte(read_ret);
-     if (!read_ret)
+     // 上次讀取因緩衝區達上限而停止時，剩餘的TLS資料留在OpenSSL中，先讀入已處理完騰出的空間
+     if (tls_buffered() && !read())
      {
          close_conn();
+         return;
+     }
+     // 連線一開始就收到HTTP/2前言（prior knowledge）
+     if (!m_h2 && m_request_count == 0 && h2_preface())
+     {
+         h2_start();
+     }
+     if (m_h2)
+     {
+         process_h2();
+         return;
+     }
+     if (m_ws)
+     {
+         process_ws();
+         return;
+     }
+     if (m_sse)
+     {
+         process_sse();
+         return;
+     }
+     int count = 0;
+     while (true)
+     {
+         // 上一批放不下的回應先寫入，其請求已解析並計數過
+         HTTP_CODE read_ret = m_pending_write;
+         m_pending_write = NO_REQUEST;
+         if (read_ret == NO_REQUEST)
+         {
+             read_ret = process_read();
+             if (read_ret == NO_REQUEST)
+             {
+                 // 標頭已收完、訊息體尚未收完：送出100 Continue，客戶端才會送出訊息體
+                 if (m_chek_state == CHECK_STATE_CONTETE)
+                 {
+                     add_continue();
+                 }
+                 break;
+             }
+             // 單一連線處理的請求數達上限後，回應完即關閉
+             if (++m_request_count >= m_max_keep_alive_requests)
+             {
+                 m_linger = false;
+             }
+         }
+         // Upgrade: h2c，此請求的回應改由HTTP/2串流1送出，之後的資料以HTTP/2解析
+         if (h2_upgrade(read_ret))
+         {
+             m_file.reset();
+             m_cgi.reset();
+             m_file_address = 0;
+             next_request();
+             process_h2();
+             return;
+         }
+         // cgi在背景執行：先送出批次中的回應，完成後由cgi_deliver回應並繼續解析之後的請求
+         if (read_ret == CGI_PENDING)
+         {
+             m_batch_linger = true;
+             break;
+         }
+         // PUT或表單的訊息體尚未收完：先送出批次中的回應（與100 Continue），之後改由process_upload接收
+         if (read_ret == UPLOAD_REQUEST)
+         {
+             add_continue();
+             m_batch_linger = true;
+             break;
+         }
+
+         // 記下批次目前的位置，回應寫到一半放不下時可以撤回
+         int write_idx = m_write_idx;
+         int iv_count = m_iv_count;
+         size_t last_len = iv_count > 0 ? m_iv[iv_count - 1].iov_len : 0;
+         int bytes_to_send = m_bytes_to_send;
+         bool write_ret = process_wirte(read_ret);
+         if (!write_ret)
+         {
+             if (bytes_to_send == 0)
+             {
+                 close_conn();
+                 return;
+             }
+             // 寫入緩衝區被批次中先前的回應佔滿：撤回這個回應，先送出批次，寫完後再寫入
+             m_write_idx = write_idx;
+             m_iv_count = iv_count;
+             if (iv_count > 0)
+             {
+                 m_iv[iv_count - 1].iov_len = last_len;
+             }
+             m_bytes_to_send = bytes_to_send;
+             m_pending_write = read_ret;
+             m_batch_linger = true;
+             break;
+         }
+         // 本回應引用的檔案映射或cgi輸出需保留到批次寫完
+         if (m_file)
+         {
+             m_batch_refs[m_batch_count++] = m_file;
+         }
+         else if (m_cgi)
+         {
+             m_batch_refs[m_batch_count++] = m_cgi;
+         }
+         m_file.reset();
+         m_cgi.reset();
+         m_file_address = 0;
+         m_batch_linger = m_linger;
+         next_request();
+         ++count;
+
+         // 切換為WebSocket或SSE後不再以HTTP解析
+         if (!m_batch_linger || m_push_enabled || count >= MAX_BATCH_REQUESTS || m_bytes_to_send >= MAX_BATCH_BYTES ||
+             WRITE_BUFFER_SIZE - m_write_idx < WRITE_BUFFER_SIZE / 4)
+         {
+             break;
+         }
+     }
+
+     if (uploading() && m_bytes_to_send == 0)
+     {
+         process_upload();
+         return;
+     }
+     if (m_bytes_to_send == 0)
+     {
+         if (!rearm())
+         {
+             close_conn();
+         }
+         return;
      }
      modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
-
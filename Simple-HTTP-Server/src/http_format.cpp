@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "http_format.h"
+
+char http_format::m_date[2][DATE_HEADER_LEN + 1];
+std::atomic<int> http_format::m_date_slot(0);
+std::atomic<long> http_format::m_date_sec(-1);
+std::atomic_flag http_format::m_date_updating = ATOMIC_FLAG_INIT;
+
+/* 00~99的兩位數字表，一次轉換兩位 */
+static const char digit_pairs[201] =
+     "00010203040506070809"
+     "10111213141516171819"
+     "20212223242526272829"
+     "30313233343536373839"
+     "40414243444546474849"
+     "50515253545556575859"
+     "60616263646566676869"
+     "70717273747576777879"
+     "80818283848586878889"
+     "90919293949596979899";
+
+int http_format::format_dec(char *buf, unsigned long v)
+{
+     char tmp[20];
+     char *p = tmp + sizeof(tmp);
+     while (v >= 100)
+     {
+         int i = (v % 100) * 2;
+         v /= 100;
+         *--p = digit_pairs[i + 1];
+         *--p = digit_pairs[i];
+     }
+     if (v >= 10)
+     {
+         int i = v * 2;
+         *--p = digit_pairs[i + 1];
+         *--p = digit_pairs[i];
+     }
+     else
+     {
+         *--p = '0' + v;
+     }
+     int len = tmp + sizeof(tmp) - p;
+     memcpy(buf, p, len);
+     return len;
+}
+
+int http_format::format_hex(char *buf, unsigned long v)
+{
+     static const char digits[] = "0123456789abcdef";
+     char tmp[16];
+     char *p = tmp + sizeof(tmp);
+     do
+     {
+         *--p = digits[v & 0xf];
+         v >>= 4;
+     } while (v);
+     int len = tmp + sizeof(tmp) - p;
+     memcpy(buf, p, len);
+     return len;
+}
+
+void http_format::format_date(time_t t, char *buf)
+{
+     static const char *days = "SunMonTueWedThuFriSat";
+     static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+     struct tm tm;
+     gmtime_r(&t, &tm);
+     char *p = buf;
+     memcpy(p, "Date: ", 6);
+     p += 6;
+     memcpy(p, days + tm.tm_wday * 3, 3);
+     p += 3;
+     *p++ = ',';
+     *p++ = ' ';
+     memcpy(p, digit_pairs + tm.tm_mday * 2, 2);
+     p += 2;
+     *p++ = ' ';
+     memcpy(p, months + tm.tm_mon * 3, 3);
+     p += 3;
+     *p++ = ' ';
+     int year = tm.tm_year + 1900;
+     memcpy(p, digit_pairs + (year / 100) * 2, 2);
+     memcpy(p + 2, digit_pairs + (year % 100) * 2, 2);
+     p += 4;
+     *p++ = ' ';
+     memcpy(p, digit_pairs + tm.tm_hour * 2, 2);
+     p += 2;
+     *p++ = ':';
+     memcpy(p, digit_pairs + tm.tm_min * 2, 2);
+     p += 2;
+     *p++ = ':';
+     memcpy(p, digit_pairs + tm.tm_sec * 2, 2);
+     p += 2;
+     memcpy(p, " GMT\r\n", 6);
+}
+
+/*
+     秒數改變時由搶到更新權的執行緒格式化到另一份緩衝區後再切換，
+     其他執行緒不等待，繼續使用上一秒的結果
+*/
+int http_format::date_header(char *buf)
+{
+     time_t now = time(NULL);
+     if (m_date_sec.load(std::memory_order_acquire) != now && !m_date_updating.test_and_set(std::memory_order_acquire))
+     {
+         int next = 1 - m_date_slot.load(std::memory_order_relaxed);
+         format_date(now, m_date[next]);
+         m_date_slot.store(next, std::memory_order_release);
+         m_date_sec.store(now, std::memory_order_release);
+         m_date_updating.clear(std::memory_order_release);
+     }
+     if (m_date_sec.load(std::memory_order_acquire) < 0)
+     {
+         // 第一次更新尚未完成時自行格式化
+         format_date(now, buf);
+         return DATE_HEADER_LEN;
+     }
+     memcpy(buf, m_date[m_date_slot.load(std::memory_order_acquire)], DATE_HEADER_LEN);
+     return DATE_HEADER_LEN;
+}
@@ -0,0 +1,225 @@
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "http_headers.h"
+
+/*
+     完美雜湊：以長度、首字元與尾字元（轉小寫）計算槽位，
+     已知標頭兩兩不碰撞由下方static_assert在編譯期驗證，新增標頭時若碰撞會編譯失敗
+*/
+static const int HASH_SIZE = 128;
+
+constexpr const char *known_names[http_headers::HDR_COUNT] = {
+     "",
+     "connection",
+     "content-length",
+     "host",
+     "transfer-encoding",
+     "content-type",
+     "upgrade",
+     "keep-alive",
+     "if-modified-since",
+     "if-none-match",
+     "cookie",
+     "user-agent",
+     "accept",
+     "accept-encoding",
+     "expect",
+     "sec-websocket-key",
+     "sec-websocket-version",
+     "http2-settings",
+     "range",
+     "last-event-id",
+     "authorization",
+     "date",
+     "referer",
+     "te",
+     "origin",
+     "cache-control",
+     "pragma",
+     "accept-language",
+     "if-match",
+     "if-unmodified-since",
+     "content-encoding",
+     "x-forwarded-for",
+     "sec-websocket-protocol",
+     "sec-websocket-extensions"};
+
+constexpr size_t const_strlen(const char *s, size_t i = 0)
+{
+     return s[i] ? const_strlen(s, i + 1) : i;
+}
+
+constexpr unsigned int header_hash(const char *s, size_t len)
+{
+     return (unsigned int)(len + (s[0] | 0x20) * 3 + (s[len - 1] | 0x20) * 61) % HASH_SIZE;
+}
+
+constexpr unsigned int known_hash(int id)
+{
+     return header_hash(known_names[id], const_strlen(known_names[id]));
+}
+
+constexpr bool unique_from(int i, int j)
+{
+     return j >= http_headers::HDR_COUNT ? true : (known_hash(i) != known_hash(j) && unique_from(i, j + 1));
+}
+
+constexpr bool all_unique(int i)
+{
+     return i >= http_headers::HDR_COUNT ? true : (unique_from(i, i + 1) && all_unique(i + 1));
+}
+
+static_assert(all_unique(1), "http_headers: known header names collide in header_hash");
+
+/*
+     雜湊槽位到HEADER_ID的對照表，程式啟動時依known_names填入
+*/
+struct header_table
+{
+     unsigned char slot[HASH_SIZE];
+     unsigned char len[http_headers::HDR_COUNT];
+     header_table()
+     {
+         memset(slot, 0, sizeof(slot));
+         for (int id = 1; id < http_headers::HDR_COUNT; ++id)
+         {
+             slot[known_hash(id)] = id;
+             len[id] = const_strlen(known_names[id]);
+         }
+     }
+};
+static const header_table table;
+
+http_headers::HEADER_ID http_headers::lookup(const char *name, size_t len)
+{
+     if (len == 0)
+     {
+         return HDR_UNKNOWN;
+     }
+     int id = table.slot[header_hash(name, len)];
+     if (id != HDR_UNKNOWN && table.len[id] == len && strncasecmp(name, known_names[id], len) == 0)
+     {
+         return (HEADER_ID)id;
+     }
+     return HDR_UNKNOWN;
+}
+
+/*
+     只重設本次請求出現過的已知標頭，不需逐一清除整張表
+*/
+void http_headers::clear()
+{
+     for (int i = 0; i < m_count; ++i)
+     {
+         m_first[m_entries[i].id] = -1;
+     }
+     m_count = 0;
+}
+
+int http_headers::add(int name_off, int name_len, int value_off, int value_len)
+{
+     if (m_count >= MAX_HEADERS)
+     {
+         return -1;
+     }
+     HEADER_ID id = lookup(*m_base + name_off, name_len);
+     entry &e = m_entries[m_count];
+     e.name_off = name_off;
+     e.name_len = name_len;
+     e.value_off = value_off;
+     e.value_len = value_len;
+     e.id = id;
+     e.parsed = false;
+     if (id != HDR_UNKNOWN && m_first[id] < 0)
+     {
+         m_first[id] = m_count;
+     }
+     m_count++;
+     return id;
+}
+
+const char *http_headers::get(const char *name) const
+{
+     size_t len = strlen(name);
+     HEADER_ID id = lookup(name, len);
+     if (id != HDR_UNKNOWN)
+     {
+         return get(id);
+     }
+     for (int i = 0; i < m_count; ++i)
+     {
+         if (m_entries[i].name_len == (int)len && strncasecmp(*m_base + m_entries[i].name_off, name, len) == 0)
+         {
+             return value(i);
+         }
+     }
+     return 0;
+}
+
+/*
+     只接受純十進位數字，第一次讀取時解析並保存結果
+*/
+bool http_headers::get_int(HEADER_ID id, long &out)
+{
+     if (m_first[id] < 0)
+     {
+         return false;
+     }
+     entry &e = m_entries[m_first[id]];
+     if (!e.parsed)
+     {
+         const char *v = *m_base + e.value_off;
+         long n = 0;
+         e.valid = e.value_len > 0 && e.value_len <= 18;
+         for (int i = 0; e.valid && i < e.value_len; ++i)
+         {
+             if (v[i] < '0' || v[i] > '9')
+             {
+                 e.valid = false;
+             }
+             n = n * 10 + (v[i] - '0');
+         }
+         e.number = n;
+         e.parsed = true;
+     }
+     out = e.number;
+     return e.valid;
+}
+
+/*
+     解析IMF-fixdate格式，例如：Sun, 06 Nov 1994 08:49:37 GMT
+*/
+bool http_headers::get_date(HEADER_ID id, time_t &out)
+{
+     if (m_first[id] < 0)
+     {
+         return false;
+     }
+     entry &e = m_entries[m_first[id]];
+     if (!e.parsed)
+     {
+         static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+         char mon[4] = {0};
+         struct tm tm;
+         memset(&tm, 0, sizeof(tm));
+         e.valid = false;
+         if (sscanf(*m_base + e.value_off, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+                    &tm.tm_mday, mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6)
+         {
+             const char *m = strstr(months, mon);
+             if (m && (m - months) % 3 == 0)
+             {
+                 tm.tm_mon = (m - months) / 3;
+                 tm.tm_year -= 1900;
+                 e.number = timegm(&tm);
+                 e.valid = true;
+             }
+         }
+         e.parsed = true;
+     }
+     out = e.number;
+     return e.valid;
+}
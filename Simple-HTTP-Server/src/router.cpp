@@ -0,0 +1,200 @@
+/*
+     路由表與http_conn的路由分派：
+         WebSocket、SSE、表單與OPTIONS由dispatch_request先行處理，
+         其餘請求依路由表交給靜態檔案、cgi、行程內端點、重新導向或PUT上傳
+*/
+#include "http_conn.h"
+#include "router.h"
+#include "log.h"
+
+extern const char *method_names[];
+
+router::node router::m_root("");
+unsigned router::m_methods = 0;
+std::string router::m_allow = "Allow: OPTIONS\r\n";
+
+/*
+     路徑中是否有以.開頭的路徑段（.htaccess、上傳中的.upload-XXXXXX暫存檔等），這類檔案不對外提供也不可上傳
+*/
+static bool hidden_path(const char *path)
+{
+     // 路徑已正規化，不會再有.與..路徑段
+     return strstr(path, "/.") != 0;
+}
+
+router::node *router::child(const node *n, char c)
+{
+     for (size_t i = 0; i < n->children.size(); ++i)
+     {
+         if (n->children[i]->label[0] == c)
+         {
+             return n->children[i];
+         }
+     }
+     return 0;
+}
+
+void router::add(const std::string &prefix, unsigned methods, const route &r)
+{
+     std::string key = prefix;
+     while (!key.empty() && key[key.size() - 1] == '/')
+     {
+         key.erase(key.size() - 1);
+     }
+     node *n = &m_root;
+     size_t pos = 0;
+     while (pos < key.size())
+     {
+         node *next = child(n, key[pos]);
+         if (!next)
+         {
+             next = new node(key.substr(pos));
+             n->children.push_back(next);
+             n = next;
+             break;
+         }
+         size_t common = 0;
+         while (common < next->label.size() && pos + common < key.size() &&
+                next->label[common] == key[pos + common])
+         {
+             ++common;
+         }
+         if (common < next->label.size())
+         {
+             // 從分歧處拆開節點，原節點成為新節點的子節點
+             node *mid = new node(next->label.substr(0, common));
+             next->label.erase(0, common);
+             mid->children.push_back(next);
+             for (size_t i = 0; i < n->children.size(); ++i)
+             {
+                 if (n->children[i] == next)
+                 {
+                     n->children[i] = mid;
+                 }
+             }
+             next = mid;
+         }
+         n = next;
+         pos += common;
+     }
+     // 路由表只在啟動時建立，路由與節點一直保留到程式結束
+     const route *stored = new route(r);
+     for (int m = 0; m < MAX_METHODS; ++m)
+     {
+         if (methods & (1u << m))
+         {
+             n->routes[m] = stored;
+         }
+     }
+     m_methods |= methods;
+     m_allow = "Allow: " + allow_value(router::methods()) + "\r\n";
+}
+
+std::string router::allow_value(unsigned mask)
+{
+     std::string value;
+     for (int m = 0; m < MAX_METHODS; ++m)
+     {
+         if (mask & (1u << m))
+         {
+             if (!value.empty())
+             {
+                 value += ", ";
+             }
+             value += method_names[m];
+         }
+     }
+     return value;
+}
+
+const route *router::find(int method, const char *path, size_t &prefix_len)
+{
+     if (method < 0 || method >= MAX_METHODS)
+     {
+         return 0;
+     }
+     const route *best = 0;
+     const node *n = &m_root;
+     size_t pos = 0;
+     while (true)
+     {
+         // 前綴必須結束在路徑段的邊界上
+         if (n->routes[method] && (path[pos] == '/' || path[pos] == '\0'))
+         {
+             best = n->routes[method];
+             prefix_len = pos;
+         }
+         if (path[pos] == '\0')
+         {
+             break;
+         }
+         n = child(n, path[pos]);
+         if (!n || strncmp(path + pos, n->label.data(), n->label.size()) != 0)
+         {
+             break;
+         }
+         pos += n->label.size();
+     }
+     return best;
+}
+
+/*
+     依路由表處理請求
+*/
+http_conn::HTTP_CODE http_conn::do_route()
+{
+     size_t prefix = 0;
+     const route *r = router::find(m_method, m_url, prefix);
+     if (!r)
+     {
+         return NO_RESOURCE;
+     }
+     const char *rest = m_url + prefix;
+     switch (r->kind)
+     {
+     case route::STATIC:
+     {
+         if (hidden_path(rest))
+         {
+             return NO_RESOURCE;
+         }
+         return m_method == HEAD ? do_head_request(r->target.c_str(), rest) : do_request(r->target.c_str(), rest);
+     }
+     case route::UPLOAD:
+     {
+         if (hidden_path(rest))
+         {
+             return FORBIDDEN_REQUEST;
+         }
+         return do_put_request(r->target.c_str(), rest);
+     }
+     case route::CGI:
+         return do_cgi_request(r->target.c_str(), rest);
+     case route::FASTCGI:
+         return do_cgi_request(r->target.c_str(), rest, r->pool);
+     case route::NATIVE:
+     {
+         // 回應與完整的cgi輸出相同，以Content-Length送出
+         route_request req = {m_method, m_url, rest, m_query, m_content_data, (size_t)m_content_length};
+         std::shared_ptr<cgi_result> res(new cgi_result());
+         res->code = CGI_REQUEST;
+         r->handler->handle(req, res->output);
+         res->set_content_type(r->handler->content_type());
+         m_cgi = res;
+         return CGI_REQUEST;
+     }
+     case route::REDIRECT:
+     {
+         m_location = r->target;
+         m_location += rest;
+         if (m_query)
+         {
+             m_location.push_back('?');
+             m_location += m_query;
+         }
+         return r->status == 301 ? MOVED_REQUEST : FOUND_REQUEST;
+     }
+     default:
+         return INTERNAL_ERROR;
+     }
+}
@@ -0,0 +1,143 @@
+/*
+     Server-Sent Events：
+         訂閱連線回覆標頭後不再解析請求，只經由推送佇列送出事件；
+         事件在發布時編碼一次，所有訂閱者的iovec都指向同一份緩衝區，最後一個寫完的連線釋放它
+*/
+#include "http_conn.h"
+#include "sse.h"
+#include "http_format.h"
+#include "log.h"
+
+static const char event_stream_headers[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                                           "Cache-Control: no-cache\r\n";
+
+std::map<std::string, sse_channel *> sse::m_channels;
+
+sse_channel *sse::add_channel(const std::string &path)
+{
+     sse_channel *&channel = m_channels[path];
+     if (!channel)
+     {
+         channel = new sse_channel(path);
+     }
+     return channel;
+}
+
+sse_channel *sse::find_channel(const char *path)
+{
+     std::map<std::string, sse_channel *>::const_iterator it = m_channels.find(path);
+     return it == m_channels.end() ? 0 : it->second;
+}
+
+void sse::subscribe(sse_channel *channel, http_conn *conn, unsigned long id)
+{
+     channel->mutex.lock();
+     channel->subscribers[conn] = id;
+     channel->mutex.unlock();
+}
+
+void sse::unsubscribe(sse_channel *channel, http_conn *conn)
+{
+     channel->mutex.lock();
+     channel->subscribers.erase(conn);
+     channel->mutex.unlock();
+}
+
+std::shared_ptr<std::string> sse::encode(unsigned long id, const std::string &event, const std::string &data)
+{
+     std::shared_ptr<std::string> out = std::make_shared<std::string>();
+     out->reserve(data.size() + event.size() + 48);
+     char num[24];
+     out->append("id: ", 4);
+     out->append(num, http_format::format_dec(num, id));
+     out->push_back('\n');
+     if (!event.empty())
+     {
+         // 事件名稱中的CR、LF會結束該欄位並讓其後的內容成為新的欄位，直接去除
+         out->append("event: ", 7);
+         for (size_t i = 0; i < event.size(); ++i)
+         {
+             if (event[i] != '\r' && event[i] != '\n')
+             {
+                 out->push_back(event[i]);
+             }
+         }
+         out->push_back('\n');
+     }
+     // 接收端以\r\n、\r或\n分行，每一行各自成為一個data欄位
+     size_t start = 0;
+     while (true)
+     {
+         size_t end = data.find_first_of("\r\n", start);
+         out->append("data: ", 6);
+         out->append(data, start, end == std::string::npos ? std::string::npos : end - start);
+         out->push_back('\n');
+         if (end == std::string::npos)
+         {
+             break;
+         }
+         start = end + (data.compare(end, 2, "\r\n") == 0 ? 2 : 1);
+     }
+     out->push_back('\n');
+     return out;
+}
+
+int sse::publish(const std::string &path, const std::string &event, const std::string &data)
+{
+     sse_channel *channel = find_channel(path.c_str());
+     return channel ? publish(channel, event, data) : -1;
+}
+
+int sse::publish(sse_channel *channel, const std::string &event, const std::string &data)
+{
+     int count = 0;
+     channel->mutex.lock();
+     std::shared_ptr<std::string> buf = encode(++channel->last_id, event, data);
+     std::unordered_map<http_conn *, unsigned long>::iterator it = channel->subscribers.begin();
+     while (it != channel->subscribers.end())
+     {
+         if (it->first->push(it->second, buf))
+         {
+             ++count;
+             ++it;
+         }
+         else
+         {
+             it = channel->subscribers.erase(it);
+         }
+     }
+     channel->mutex.unlock();
+     return count;
+}
+
+/*
+     寫入事件串流的回應標頭，訊息體持續到連線關閉為止
+*/
+bool http_conn::add_sse_headers()
+{
+     return add_bytes(event_stream_headers, sizeof(event_stream_headers) - 1) && add_date() && add_blank_line();
+}
+
+/*
+     回應標頭加入批次後開始訂閱
+*/
+void http_conn::sse_start()
+{
+     m_sse = m_sse_pending;
+     m_sse_pending = 0;
+     push_enable();
+     sse::subscribe(m_sse, this, m_conn_id);
+}
+
+/*
+     訂閱連線收到的資料沒有意義，直接丟棄
+*/
+void http_conn::process_sse()
+{
+     m_read_idx = 0;
+     shrink_read_buf(0);
+     if (push_drain() < 0 || !rearm())
+     {
+         close_conn();
+     }
+}
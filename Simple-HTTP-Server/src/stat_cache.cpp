@@ -0,0 +1,62 @@
+#include "stat_cache.h"
+
+std::map<std::string, stat_cache::entry> stat_cache::m_entries;
+locker stat_cache::m_mutex;
+
+/*
+     命中且未過期時直接傳回快取，否則呼叫stat並更新快取
+*/
+int stat_cache::get(const std::string &path, struct stat &st)
+{
+     time_t now = time(NULL);
+     m_mutex.lock();
+     std::map<std::string, entry>::iterator it = m_entries.find(path);
+     if (it != m_entries.end() && it->second.expire > now)
+     {
+         st = it->second.st;
+         int ret = it->second.ret;
+         m_mutex.unlock();
+         return ret;
+     }
+     m_mutex.unlock();
+
+     entry e;
+     e.ret = stat(path.c_str(), &e.st);
+     e.expire = now + TTL;
+     st = e.st;
+
+     m_mutex.lock();
+     if (m_entries.size() >= MAX_ENTRIES && m_entries.find(path) == m_entries.end())
+     {
+         evict(now);
+     }
+     m_entries[path] = e;
+     m_mutex.unlock();
+     return e.ret;
+}
+
+/*
+     騰出一個位置：刪除所有已過期的項目；都還有效時刪除最早過期的一項
+*/
+void stat_cache::evict(time_t now)
+{
+     std::map<std::string, entry>::iterator oldest = m_entries.end();
+     std::map<std::string, entry>::iterator it = m_entries.begin();
+     while (it != m_entries.end())
+     {
+         if (it->second.expire <= now)
+         {
+             it = m_entries.erase(it);
+             continue;
+         }
+         if (oldest == m_entries.end() || it->second.expire < oldest->second.expire)
+         {
+             oldest = it;
+         }
+         ++it;
+     }
+     if (m_entries.size() >= MAX_ENTRIES && oldest != m_entries.end())
+     {
+         m_entries.erase(oldest);
+     }
+}
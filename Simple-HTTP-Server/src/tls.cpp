@@ -0,0 +1,76 @@
+#include <openssl/err.h>
+
+#include "tls.h"
+#include "log.h"
+
+SSL_CTX *tls::m_ctx = 0;
+
+/* 本伺服器支援的ALPN協定，長度前綴格式 */
+static const unsigned char alpn_protos[] = "\x02h2\x08http/1.1";
+
+bool tls::init(const char *cert_file, const char *key_file)
+{
+     SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+     if (!ctx)
+     {
+         return false;
+     }
+     SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+     // 核心支援時握手後改用kTLS；不接受重新協商，避免讀取途中需要寫入
+     SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+     // 非阻塞寫入：允許部分寫入，重試時iovec位置可能已移動
+     SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+     if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1 ||
+         SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+         SSL_CTX_check_private_key(ctx) != 1)
+     {
+         LOG_ERROR("tls: load certificate %s / key %s failed: %s", cert_file, key_file,
+                   ERR_error_string(ERR_get_error(), NULL));
+         SSL_CTX_free(ctx);
+         return false;
+     }
+
+     // session恢復：TLS 1.2以session ID查詢伺服器端快取，TLS 1.3與1.2皆可使用session ticket
+     static const unsigned char sid_ctx[] = "Simple-HTTP-Server";
+     SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+     SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+     SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+     SSL_CTX_set_num_tickets(ctx, 1);
+
+     SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+     m_ctx = ctx;
+     return true;
+}
+
+SSL *tls::accept(int fd)
+{
+     if (!m_ctx)
+     {
+         return 0;
+     }
+     SSL *ssl = SSL_new(m_ctx);
+     if (!ssl)
+     {
+         return 0;
+     }
+     if (SSL_set_fd(ssl, fd) != 1)
+     {
+         SSL_free(ssl);
+         return 0;
+     }
+     SSL_set_accept_state(ssl);
+     return ssl;
+}
+
+int tls::select_alpn(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+                     const unsigned char *in, unsigned int inlen, void *arg)
+{
+     unsigned char *selected = 0;
+     if (SSL_select_next_proto(&selected, outlen, alpn_protos, sizeof(alpn_protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+     {
+         return SSL_TLSEXT_ERR_NOACK;
+     }
+     *out = selected;
+     return SSL_TLSEXT_ERR_OK;
+}
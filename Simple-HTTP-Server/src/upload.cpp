@@ -0,0 +1,377 @@
+/*
+     http_conn的PUT上傳部分：
+         訊息體寫入目標所在目錄的暫存檔，收完後以rename原子地取代目標，讀取中的GET不會看到不完整的檔案；
+         已讀入緩衝區的部分直接寫入，其餘由執行緒池以splice經pipe從socket搬到檔案，不經過使用者空間，
+         每條連線的記憶體用量與檔案大小無關；chunked訊息體需去除分段格式，改經由使用者空間邊收邊解碼；
+     表單與POST給cgi的大訊息體也由process_upload接收，分別送入解析器與cgi的標準輸入
+*/
+#include <algorithm>
+
+#include "http_conn.h"
+#include "cgi.h"
+#include "log.h"
+
+/*
+     完整寫入len位元組，檔案寫入不會遇到EAGAIN
+*/
+static bool write_all(int fd, const char *data, size_t len)
+{
+     while (len > 0)
+     {
+         ssize_t n = ::write(fd, data, len);
+         if (n < 0)
+         {
+             if (errno == EINTR)
+             {
+                 continue;
+             }
+             return false;
+         }
+         data += n;
+         len -= n;
+     }
+     return true;
+}
+
+/*
+     PUT請求：在UPLOAD路由的root目錄下建立暫存檔，並寫入緩衝區中已有的訊息體
+     傳回值：
+         訊息體已完整：CREATED_REQUEST或UPDATED_REQUEST
+         尚未收完：UPLOAD_REQUEST，之後由process_upload繼續
+         其餘為錯誤
+*/
+http_conn::HTTP_CODE http_conn::do_put_request(const char *root, const char *path)
+{
+     size_t len = strlen(path);
+     if (len == 0 || path[len - 1] == '/')
+     {
+         bad_request();
+         return BAD_REQUEST;
+     }
+     m_upload_target = std::string(root) + path;
+     struct stat st;
+     m_upload_created = stat(m_upload_target.c_str(), &st) < 0;
+     if (!m_upload_created && !S_ISREG(st.st_mode))
+     {
+         bad_request();
+         return BAD_REQUEST;
+     }
+     // 暫存檔與目標在同一個目錄（同一個檔案系統），rename才是原子的
+     m_upload_tmp = m_upload_target.substr(0, m_upload_target.rfind('/') + 1) + ".upload-XXXXXX";
+     m_upload_fd = mkostemp(&m_upload_tmp[0], O_CLOEXEC);
+     if (m_upload_fd < 0)
+     {
+         bad_request();
+         return (errno == ENOENT || errno == ENOTDIR) ? NO_RESOURCE : INTERNAL_ERROR;
+     }
+     // 暫存檔維持mkostemp的0600，收完後才開放讀取，上傳中的內容不會被GET取得
+     m_upload_pipe[0] = m_upload_pipe[1] = -1;
+
+     // 寫入已讀入緩衝區的部分；chunked時就地解碼，結束位置之後可能是下一個請求
+     char *body = m_read_buf + m_check_idx;
+     size_t have = m_read_idx - m_check_idx;
+     if (m_chunked)
+     {
+         size_t consumed = 0;
+         HTTP_CODE ret = write_chunked(body, have, consumed);
+         if (ret != NO_REQUEST && ret != GET_REQUEST)
+         {
+             abort_upload();
+             bad_request();
+             return ret;
+         }
+         m_request_end = m_check_idx + consumed;
+         if (ret == GET_REQUEST)
+         {
+             m_upload_left = 0;
+             return finish_upload();
+         }
+         LOG_INFO("[%ld PUT %s streaming chunked body]", pthread_self(), m_url);
+         return UPLOAD_REQUEST;
+     }
+     have = std::min((long long)have, m_upload_left);
+     m_upload_left -= have;
+     m_request_end = m_check_idx + have;
+     if (!write_all(m_upload_fd, body, have))
+     {
+         abort_upload();
+         bad_request();
+         return INTERNAL_ERROR;
+     }
+     if (m_upload_left == 0)
+     {
+         return finish_upload();
+     }
+     if (!m_ssl)
+     {
+         if (pipe2(m_upload_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+         {
+             abort_upload();
+             bad_request();
+             return INTERNAL_ERROR;
+         }
+         fcntl(m_upload_pipe[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+     }
+     LOG_INFO("[%ld PUT %s streaming %lld bytes]", pthread_self(), m_url, m_upload_left);
+     return UPLOAD_REQUEST;
+}
+
+/*
+     就地解碼一段chunked訊息體並寫入暫存檔，consumed設為屬於訊息體的輸入位元組數
+     傳回值：
+         GET_REQUEST：訊息體已結束
+         NO_REQUEST：尚未結束
+         BAD_REQUEST：格式錯誤
+         INTERNAL_ERROR：寫入失敗
+*/
+http_conn::HTTP_CODE http_conn::write_chunked(char *data, size_t len, size_t &consumed)
+{
+     size_t out_len = 0;
+     chunked_decoder::STATUS status = m_chunk.decode(data, len, data, consumed, out_len);
+     if (status == chunked_decoder::BAD)
+     {
+         return BAD_REQUEST;
+     }
+     if (!write_all(m_upload_fd, data, out_len))
+     {
+         LOG_ERROR("PUT %s: write to %s failed: %s", m_url, m_upload_tmp.c_str(), strerror(errno));
+         return INTERNAL_ERROR;
+     }
+     return status == chunked_decoder::DONE ? GET_REQUEST : NO_REQUEST;
+}
+
+/*
+     chunked訊息體結束在已讀取的資料中間時，其後屬於下一個請求的部分放回讀取緩衝區，接在請求標頭之後
+     傳回值：放不下時為false
+*/
+bool http_conn::unread_body(const char *data, size_t len)
+{
+     // 緩衝區中的訊息體都已寫入檔案，直接覆蓋
+     m_read_idx = m_check_idx;
+     m_request_end = m_check_idx;
+     while (m_read_size - m_read_idx < (int)len)
+     {
+         if (!grow_read_buf())
+         {
+             return false;
+         }
+     }
+     memcpy(m_read_buf + m_read_idx, data, len);
+     m_read_idx += len;
+     // 覆蓋處的行尾索引已不對應，之後從頭掃描
+     while (m_mark_count > m_mark_next && m_marks[m_mark_count - 1] >= m_check_idx)
+     {
+         --m_mark_count;
+     }
+     if (m_scan_idx > m_check_idx)
+     {
+         m_scan_idx = m_check_idx;
+     }
+     return true;
+}
+
+/*
+     繼續接收上傳、表單或cgi的訊息體，直到socket沒有資料、收完、達到單次處理量，或cgi尚未寫入的內容過多
+*/
+void http_conn::process_upload()
+{
+     // TLS、表單與cgi需在使用者空間取得資料，經由此緩衝區（TLS記錄最大16KB）寫入檔案或送入解析器、cgi；
+     // 讀取緩衝區中的請求行與標頭需保留到回應送出
+     char relay[16 * 1024];
+     bool copy = m_ssl || m_form || m_cgi_input || m_chunked;
+     long long budget = UPLOAD_SLICE;
+     bool paused = false;
+     // SSL內部已解密的資料不會再觸發EPOLLIN，需讀完才能讓出執行緒（cgi暫停時也是，最多多出一個TLS記錄）
+     while (m_upload_left > 0 && ((budget > 0 && !paused) || (m_ssl && SSL_pending(m_ssl) > 0)))
+     {
+         size_t want = std::min(m_upload_left, (long long)UPLOAD_PIPE_SIZE);
+         ssize_t n;
+         if (m_ssl)
+         {
+             n = tls_read(relay, std::min(want, sizeof(relay)));
+         }
+         else if (copy)
+         {
+             n = recv(m_sockfd, relay, std::min(want, sizeof(relay)), 0);
+         }
+         else
+         {
+             n = splice(m_sockfd, NULL, m_upload_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+         }
+         if (n == 0)
+         {
+             close_conn();
+             return;
+         }
+         if (n < 0)
+         {
+             if (errno == EAGAIN || errno == EWOULDBLOCK)
+             {
+                 break;
+             }
+             close_conn();
+             return;
+         }
+
+         bool ok = true;
+         if (m_chunked)
+         {
+             size_t consumed = 0;
+             HTTP_CODE ret = write_chunked(relay, n, consumed);
+             if (ret == GET_REQUEST)
+             {
+                 // 最後一個chunk之後的資料屬於下一個請求；放不下時回應後關閉連線
+                 if (!unread_body(relay + consumed, n - consumed))
+                 {
+                     m_linger = false;
+                 }
+                 m_upload_left = 0;
+                 break;
+             }
+             if (ret != NO_REQUEST)
+             {
+                 abort_upload();
+                 m_linger = false;
+                 upload_respond(ret);
+                 return;
+             }
+             // 長度未知，m_upload_left維持UPLOAD_CHUNKED
+             budget -= n;
+             continue;
+         }
+         if (m_form)
+         {
+             ok = m_form->feed(relay, n);
+         }
+         else if (m_cgi_input)
+         {
+             // 在推送鎖內記錄暫停，cgi_resume不會在記錄前執行而遺失
+             m_push_mutex.lock();
+             m_upload_paused = !cgi::feed(m_cgi_input, relay, n, m_upload_left == n, this, m_conn_id);
+             paused = m_upload_paused;
+             m_push_mutex.unlock();
+         }
+         else if (copy)
+         {
+             ok = write_all(m_upload_fd, relay, n);
+         }
+         else
+         {
+             // pipe中的資料全部搬到檔案，檔案端不會遇到EAGAIN
+             ssize_t left = n;
+             while (left > 0)
+             {
+                 ssize_t m = splice(m_upload_pipe[0], NULL, m_upload_fd, NULL, left, SPLICE_F_MOVE);
+                 if (m <= 0)
+                 {
+                     ok = false;
+                     break;
+                 }
+                 left -= m;
+             }
+         }
+         if (!ok)
+         {
+             // 表單格式錯誤或寫入失敗（例如磁碟已滿），其餘訊息體無法略過，回應後關閉連線
+             HTTP_CODE ret = BAD_REQUEST;
+             if (!m_form)
+             {
+                 LOG_ERROR("PUT %s: write to %s failed: %s", m_url, m_upload_tmp.c_str(), strerror(errno));
+                 ret = INTERNAL_ERROR;
+             }
+             abort_upload();
+             m_linger = false;
+             upload_respond(ret);
+             return;
+         }
+         m_upload_left -= n;
+         budget -= n;
+     }
+     if (m_cgi_input)
+     {
+         // 訊息體收完後與一般的cgi請求相同，等待輸出；未收完時由rearm先寫出已收到的cgi輸出，未暫停時註冊讀事件
+         if (m_upload_left == 0)
+         {
+             m_cgi_input.reset();
+         }
+         if (!rearm())
+         {
+             close_conn();
+         }
+         return;
+     }
+     if (m_upload_left > 0)
+     {
+         // socket沒有資料，或讓出執行緒給其他連線（資料還在socket中，重新註冊後會立即觸發）
+         modfd(m_epollfd, m_sockfd, EPOLLIN);
+         return;
+     }
+     upload_respond(m_form ? finish_form() : finish_upload());
+}
+
+/*
+     訊息體收完：關閉暫存檔並取代目標
+*/
+http_conn::HTTP_CODE http_conn::finish_upload()
+{
+     // 上傳的檔案需可由GET讀取（check_file要求S_IROTH）
+     fchmod(m_upload_fd, 0644);
+     close(m_upload_fd);
+     m_upload_fd = -1;
+     if (m_upload_pipe[0] >= 0)
+     {
+         close(m_upload_pipe[0]);
+         close(m_upload_pipe[1]);
+         m_upload_pipe[0] = m_upload_pipe[1] = -1;
+     }
+     if (rename(m_upload_tmp.c_str(), m_upload_target.c_str()) < 0)
+     {
+         LOG_ERROR("PUT: rename %s to %s failed: %s", m_upload_tmp.c_str(), m_upload_target.c_str(), strerror(errno));
+         unlink(m_upload_tmp.c_str());
+         return INTERNAL_ERROR;
+     }
+     return m_upload_created ? CREATED_REQUEST : UPDATED_REQUEST;
+}
+
+/*
+     放棄上傳，刪除暫存檔或解析中的表單，或結束送入cgi的訊息體
+*/
+void http_conn::abort_upload()
+{
+     if (m_cgi_input)
+     {
+         cgi::close_input(m_cgi_input);
+         m_cgi_input.reset();
+         return;
+     }
+     if (m_form)
+     {
+         delete m_form;
+         m_form = 0;
+         return;
+     }
+     close(m_upload_fd);
+     m_upload_fd = -1;
+     if (m_upload_pipe[0] >= 0)
+     {
+         close(m_upload_pipe[0]);
+         close(m_upload_pipe[1]);
+         m_upload_pipe[0] = m_upload_pipe[1] = -1;
+     }
+     unlink(m_upload_tmp.c_str());
+}
+
+/*
+     串流上傳結束後送出回應，之後回到一般的請求處理
+*/
+void http_conn::upload_respond(HTTP_CODE ret)
+{
+     if (!process_wirte(ret))
+     {
+         close_conn();
+         return;
+     }
+     m_batch_linger = m_linger;
+     next_request();
+     modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
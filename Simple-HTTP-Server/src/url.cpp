@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "url.h"
+#include "head_scanner.h"
+
+int url::hex_value(char c)
+{
+     if (c >= '0' && c <= '9')
+     {
+         return c - '0';
+     }
+     if (c >= 'a' && c <= 'f')
+     {
+         return c - 'a' + 10;
+     }
+     if (c >= 'A' && c <= 'F')
+     {
+         return c - 'A' + 10;
+     }
+     return -1;
+}
+
+/*
+     單次掃描：
+         大多數URL不需要改寫，先以SIMD找出第一個需要處理的位置，找不到時直接傳回；
+         否則從該位置所在的路徑段開始，邊解碼邊寫出，每遇到/或結尾時處理剛寫完的路徑段
+*/
+int url::normalize(char *path, char **query)
+{
+     *query = 0;
+     size_t n = strlen(path);
+     size_t pos = head_scanner::find_url_special(path, n);
+     if (pos == n)
+     {
+         return n;
+     }
+
+     // 之前的部分不含%、?、#與./、//，原樣保留
+     char *out = path + pos;
+     while (*out != '/')
+     {
+         --out;
+     }
+     const char *in = out + 1;
+     const char *end = path + n;
+     *out++ = '/';
+     char *segment = out; // 目前路徑段在輸出中的起點（/之後）
+     while (true)
+     {
+         int c;
+         if (in == end || *in == '?' || *in == '#')
+         {
+             c = -1;
+         }
+         else if (*in == '%')
+         {
+             int hi = end - in >= 3 ? hex_value(in[1]) : -1;
+             int lo = hi >= 0 ? hex_value(in[2]) : -1;
+             if (lo < 0 || (hi == 0 && lo == 0))
+             {
+                 return -1;
+             }
+             c = hi << 4 | lo;
+             in += 3;
+         }
+         else
+         {
+             c = (unsigned char)*in++;
+         }
+
+         if (c != '/' && c != -1)
+         {
+             *out++ = c;
+             continue;
+         }
+
+         // 路徑段結束：.直接移除，..連同前一段移除，已在根目錄時忽略
+         size_t len = out - segment;
+         if (len == 1 && segment[0] == '.')
+         {
+             out = segment;
+         }
+         else if (len == 2 && segment[0] == '.' && segment[1] == '.')
+         {
+             out = segment - 1;
+             if (out == path)
+             {
+                 out = segment;
+             }
+             else
+             {
+                 do
+                 {
+                     --out;
+                 } while (*out != '/');
+                 ++out;
+             }
+         }
+         if (c == -1)
+         {
+             break;
+         }
+         // 空的路徑段（//）不再寫出/
+         if (out[-1] != '/')
+         {
+             *out++ = '/';
+         }
+         segment = out;
+     }
+
+     if (in != end && *in == '?')
+     {
+         char *q = path + (in - path) + 1;
+         char *hash = strchr(q, '#');
+         if (hash)
+         {
+             *hash = '\0';
+         }
+         *query = q;
+     }
+     *out = '\0';
+     return out - path;
+}
+
+void url::decode_form(std::string &s)
+{
+     size_t out = 0;
+     for (size_t i = 0; i < s.size(); ++i)
+     {
+         char c = s[i];
+         if (c == '+')
+         {
+             c = ' ';
+         }
+         else if (c == '%' && i + 2 < s.size() && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0)
+         {
+             c = (hex_value(s[i + 1]) << 4) | hex_value(s[i + 2]);
+             i += 2;
+         }
+         s[out++] = c;
+     }
+     s.resize(out);
+}
@@ -0,0 +1,405 @@
+/*
+     WebSocket（RFC 6455）：
+         握手請求通過後回覆101，之後讀取緩衝區中的資料改以訊框解析，
+         完整訊息在執行緒池中交給路徑對應的處理器；
+         處理器送出的訊息編碼成共用的訊框排入連線的推送佇列，由擁有連線的執行緒以writev寫出
+*/
+#include <openssl/evp.h>
+
+#include "http_conn.h"
+#include "websocket.h"
+#include "log.h"
+
+/* 握手金鑰的固定GUID */
+static const char websocket_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+static const char switching_protocols[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                                          "Connection: Upgrade\r\nSec-WebSocket-Accept: ";
+
+std::map<std::string, websocket_handler *> websocket::m_handlers;
+
+void websocket::add_handler(const std::string &path, websocket_handler *handler)
+{
+     m_handlers[path] = handler;
+}
+
+websocket_handler *websocket::find_handler(const char *path)
+{
+     std::map<std::string, websocket_handler *>::const_iterator it = m_handlers.find(path);
+     return it == m_handlers.end() ? 0 : it->second;
+}
+
+/*
+     Sec-WebSocket-Accept = base64(SHA-1(key + GUID))
+*/
+std::string websocket::accept_key(const char *key)
+{
+     std::string input(key);
+     input.append(websocket_guid, sizeof(websocket_guid) - 1);
+     unsigned char digest[EVP_MAX_MD_SIZE];
+     unsigned int digest_len = 0;
+     EVP_Digest(input.data(), input.size(), digest, &digest_len, EVP_sha1(), NULL);
+     unsigned char encoded[4 * ((EVP_MAX_MD_SIZE + 2) / 3) + 1];
+     int len = EVP_EncodeBlock(encoded, digest, digest_len);
+     return std::string((char *)encoded, len);
+}
+
+int websocket::frame_header(char *out, int opcode, size_t len)
+{
+     int n = 0;
+     out[n++] = 0x80 | opcode;
+     if (len < 126)
+     {
+         out[n++] = len;
+     }
+     else if (len <= 0xffff)
+     {
+         out[n++] = 126;
+         out[n++] = (len >> 8) & 0xff;
+         out[n++] = len & 0xff;
+     }
+     else
+     {
+         out[n++] = 127;
+         for (int shift = 56; shift >= 0; shift -= 8)
+         {
+             out[n++] = ((unsigned long long)len >> shift) & 0xff;
+         }
+     }
+     return n;
+}
+
+bool websocket::valid_close_code(int code)
+{
+     // 1000~1003、1007~1014為已定義的狀態碼，3000~3999由IANA登記，4000~4999供應用程式使用
+     return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1014) || (code >= 3000 && code <= 4999);
+}
+
+bool websocket::valid_utf8(const char *data, size_t len)
+{
+     const unsigned char *p = (const unsigned char *)data;
+     size_t i = 0;
+     while (i < len)
+     {
+         unsigned char c = p[i];
+         if (c < 0x80)
+         {
+             ++i;
+             continue;
+         }
+         // 依首位元組決定長度，以及第二個位元組的範圍（排除過長編碼、代理區與超過U+10FFFF）
+         int n;
+         unsigned char lo = 0x80, hi = 0xbf;
+         if (c >= 0xc2 && c <= 0xdf)
+         {
+             n = 2;
+         }
+         else if (c >= 0xe0 && c <= 0xef)
+         {
+             n = 3;
+             lo = c == 0xe0 ? 0xa0 : 0x80;
+             hi = c == 0xed ? 0x9f : 0xbf;
+         }
+         else if (c >= 0xf0 && c <= 0xf4)
+         {
+             n = 4;
+             lo = c == 0xf0 ? 0x90 : 0x80;
+             hi = c == 0xf4 ? 0x8f : 0xbf;
+         }
+         else
+         {
+             return false;
+         }
+         if (len - i < (size_t)n || p[i + 1] < lo || p[i + 1] > hi)
+         {
+             return false;
+         }
+         for (int k = 2; k < n; ++k)
+         {
+             if ((p[i + k] & 0xc0) != 0x80)
+             {
+                 return false;
+             }
+         }
+         i += n;
+     }
+     return true;
+}
+
+std::shared_ptr<std::string> websocket::frame(int opcode, const char *data, size_t len)
+{
+     char head[10];
+     int n = frame_header(head, opcode, len);
+     std::shared_ptr<std::string> out = std::make_shared<std::string>();
+     out->reserve(n + len);
+     out->append(head, n);
+     out->append(data, len);
+     return out;
+}
+
+bool websocket::send(const websocket_conn &ws, int opcode, const std::string &message)
+{
+     return send(ws, frame(opcode, message.data(), message.size()));
+}
+
+bool websocket::send(const websocket_conn &ws, const std::shared_ptr<std::string> &frame)
+{
+     return ws.conn->push(ws.id, frame);
+}
+
+/*
+     檢查WebSocket握手請求：路徑需有註冊的處理器，方法為GET，版本為13且帶有金鑰
+*/
+http_conn::HTTP_CODE http_conn::do_websocket_request()
+{
+     websocket_handler *handler = websocket::find_handler(m_url);
+     if (!handler)
+     {
+         return NO_RESOURCE;
+     }
+     const char *key = m_headers.get(http_headers::HDR_SEC_WEBSOCKET_KEY);
+     const char *version = m_headers.get(http_headers::HDR_SEC_WEBSOCKET_VERSION);
+     if (m_method != GET || !key || !*key || !version || strcmp(version, "13") != 0)
+     {
+         return BAD_REQUEST;
+     }
+     m_ws_accept = websocket::accept_key(key);
+     m_ws_pending = handler;
+     return WEBSOCKET_REQUEST;
+}
+
+/*
+     寫入101回應
+*/
+bool http_conn::add_websocket_accept()
+{
+     return add_bytes(switching_protocols, sizeof(switching_protocols) - 1) &&
+            add_bytes(m_ws_accept.data(), m_ws_accept.size()) && add_bytes("\r\n\r\n", 4);
+}
+
+/*
+     101回應加入批次後切換協定，之後處理器即可向此連線送出訊息
+*/
+void http_conn::ws_start()
+{
+     m_ws = m_ws_pending;
+     m_ws_pending = 0;
+     m_ws_opcode = 0;
+     m_ws_message.clear();
+     m_ws_closing = false;
+     push_enable();
+     websocket_conn ws = {this, m_conn_id};
+     m_ws->on_open(ws);
+}
+
+/*
+     解析緩衝區中所有完整的訊框：
+         客戶端訊框必須遮罩，就地解除遮罩後處理；控制訊框的回覆直接寫入m_write_buf，
+         處理器的訊息經由推送佇列在控制訊框之後送出
+*/
+void http_conn::process_ws()
+{
+     int pos = 0;
+     // 保留空間給控制訊框的回覆（最多125位元組資料）
+     while (!m_ws_closing && WRITE_BUFFER_SIZE - m_write_idx >= 256)
+     {
+         int avail = m_read_idx - pos;
+         if (avail < 2)
+         {
+             break;
+         }
+         unsigned char *p = (unsigned char *)m_read_buf + pos;
+         bool fin = p[0] & 0x80;
+         int opcode = p[0] & 0x0f;
+         // 未協商擴充，RSV位元必須為0
+         if ((p[0] & 0x70) || !(p[1] & 0x80))
+         {
+             ws_close(1002);
+             break;
+         }
+         unsigned long long len = p[1] & 0x7f;
+         int head = 2;
+         if (len == 126)
+         {
+             if (avail < 4)
+             {
+                 break;
+             }
+             len = (p[2] << 8) | p[3];
+             head = 4;
+         }
+         else if (len == 127)
+         {
+             if (avail < 10)
+             {
+                 break;
+             }
+             len = 0;
+             for (int i = 2; i < 10; ++i)
+             {
+                 len = (len << 8) | p[i];
+             }
+             head = 10;
+         }
+         head += 4;
+         // 整個訊框需放入讀取緩衝區
+         if (len > (unsigned long long)(m_read_buffer_limit - head))
+         {
+             ws_close(1009);
+             break;
+         }
+         if (avail < head + (int)len)
+         {
+             break;
+         }
+         const unsigned char *mask = p + head - 4;
+         char *payload = (char *)p + head;
+         for (int i = 0; i < (int)len; ++i)
+         {
+             payload[i] ^= mask[i & 3];
+         }
+         pos += head + len;
+         if (!ws_frame(fin, opcode, payload, len))
+         {
+             break;
+         }
+     }
+
+     int left = m_read_idx - pos;
+     if (m_ws_closing)
+     {
+         // 關閉訊框之後不再處理任何資料
+         left = 0;
+     }
+     else if (pos > 0 && left > 0)
+     {
+         memmove(m_read_buf, m_read_buf + pos, left);
+     }
+     shrink_read_buf(left);
+     m_read_idx = left;
+
+     m_batch_linger = !m_ws_closing;
+     if (m_ws_closing)
+     {
+         // 關閉訊框必須是最後送出的訊框
+         modfd(m_epollfd, m_sockfd, EPOLLOUT);
+         return;
+     }
+     if (push_drain() < 0 || !rearm())
+     {
+         close_conn();
+     }
+}
+
+/*
+     處理一個訊框
+     傳回值：false表示連線將關閉，不再解析後續訊框
+*/
+bool http_conn::ws_frame(bool fin, int opcode, const char *payload, size_t len)
+{
+     if (opcode >= websocket::CLOSE)
+     {
+         // 控制訊框不可分段，可插在分段訊息之間
+         if (!fin || len > websocket::MAX_CONTROL_PAYLOAD)
+         {
+             ws_close(1002);
+             return false;
+         }
+         return ws_control(opcode, payload, len);
+     }
+     if (opcode == websocket::CONTINUATION)
+     {
+         if (m_ws_opcode == 0)
+         {
+             ws_close(1002);
+             return false;
+         }
+         m_ws_message.append(payload, len);
+     }
+     else if (opcode == websocket::TEXT || opcode == websocket::BINARY)
+     {
+         if (m_ws_opcode != 0)
+         {
+             ws_close(1002);
+             return false;
+         }
+         m_ws_opcode = opcode;
+         m_ws_message.assign(payload, len);
+     }
+     else
+     {
+         ws_close(1002);
+         return false;
+     }
+     if (m_ws_message.size() > (size_t)m_read_buffer_limit)
+     {
+         ws_close(1009);
+         return false;
+     }
+     if (fin)
+     {
+         if (m_ws_opcode == websocket::TEXT && !websocket::valid_utf8(m_ws_message.data(), m_ws_message.size()))
+         {
+             ws_close(1007);
+             return false;
+         }
+         websocket_conn ws = {this, m_conn_id};
+         m_ws->on_message(ws, m_ws_opcode, m_ws_message);
+         m_ws_opcode = 0;
+         m_ws_message.clear();
+     }
+     return true;
+}
+
+/*
+     控制訊框：PING回覆相同內容的PONG，CLOSE檢查狀態碼與原因後回覆相同的狀態碼並關閉
+*/
+bool http_conn::ws_control(int opcode, const char *payload, size_t len)
+{
+     switch (opcode)
+     {
+     case websocket::PING:
+     {
+         char head[10];
+         int start = m_write_idx;
+         add_bytes(head, websocket::frame_header(head, websocket::PONG, len));
+         add_bytes(payload, len);
+         add_iv(m_write_buf + start, m_write_idx - start);
+         return true;
+     }
+     case websocket::PONG:
+         return true;
+     case websocket::CLOSE:
+     {
+         // 沒有狀態碼時以1000回覆；狀態碼不完整或不可使用時以1002回覆，原因不是UTF-8時以1007回覆
+         int code = len >= 2 ? ((unsigned char)payload[0] << 8) | (unsigned char)payload[1] : 1000;
+         if (len == 1 || (len >= 2 && !websocket::valid_close_code(code)))
+         {
+             code = 1002;
+         }
+         else if (len > 2 && !websocket::valid_utf8(payload + 2, len - 2))
+         {
+             code = 1007;
+         }
+         ws_close(code);
+         return false;
+     }
+     default:
+         ws_close(1002);
+         return false;
+     }
+}
+
+/*
+     送出關閉訊框，寫完後關閉連線
+*/
+void http_conn::ws_close(int code)
+{
+     char frame[4];
+     websocket::frame_header(frame, websocket::CLOSE, 2);
+     frame[2] = (code >> 8) & 0xff;
+     frame[3] = code & 0xff;
+     int start = m_write_idx;
+     add_bytes(frame, sizeof(frame));
+     add_iv(m_write_buf + start, m_write_idx - start);
+     m_ws_closing = true;
+}
@@ -0,0 +1,278 @@
+#!/usr/bin/python3
+#coding:utf-8
+# FastCGI worker：伺服器以fd 0傳入監聽的socket，依SCRIPT_FILENAME執行cgi腳本
+# Python腳本只編譯一次，之後每個請求都在同一個直譯器中執行，不需要重新啟動直譯器與載入模組；
+# 其他腳本仍以子程序執行；輸出隨腳本flush（子程序則隨讀到的資料）以STDOUT記錄送出，不等腳本結束；
+# PARAMS結束就開始執行，STDIN記錄由另一個執行緒邊收邊寫入腳本的標準輸入（pipe），腳本讀取較慢時不再接收
+# 參數：單一腳本的執行時間上限（秒），伺服器逾時後不知道請求在哪個worker，由worker自行中斷腳本
+import io
+import os
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import traceback
+
+BEGIN_REQUEST, ABORT_REQUEST, END_REQUEST, PARAMS, STDIN, STDOUT, STDERR = 1, 2, 3, 4, 5, 6, 7
+GET_VALUES, GET_VALUES_RESULT, UNKNOWN_TYPE = 9, 10, 11
+KEEP_CONN = 1
+HEADER = struct.Struct('>BBHHBx')
+
+base_env = dict(os.environ)
+timeout = int(sys.argv[1]) if len(sys.argv) > 1 else 0
+scripts = {}  # 路徑 -> (mtime, 編譯後的程式碼；非Python腳本為None)
+state = {'sending': False, 'expired': False}  # 逾時發生在送出記錄途中時延後到送完再中斷，避免記錄不完整
+
+
+def read_exact(conn, n):
+    data = b''
+    while len(data) < n:
+        chunk = conn.recv(n - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+def read_record(conn):
+    version, rtype, rid, length, padding = HEADER.unpack(read_exact(conn, HEADER.size))
+    content = read_exact(conn, length + padding)[:length]
+    return rtype, rid, content
+
+
+def record(rtype, rid, data=b''):
+    out = []
+    pos = 0
+    while True:
+        chunk = data[pos:pos + 65535]
+        padding = -len(chunk) % 8
+        out.append(HEADER.pack(1, rtype, rid, len(chunk), padding) + chunk + b'\0' * padding)
+        pos += len(chunk)
+        if pos >= len(data):
+            return b''.join(out)
+
+
+def read_length(data, pos):
+    if data[pos] < 128:
+        return data[pos], pos + 1
+    return struct.unpack('>I', data[pos:pos + 4])[0] & 0x7fffffff, pos + 4
+
+
+def parse_pairs(data):
+    pairs = {}
+    pos = 0
+    while pos < len(data):
+        nlen, pos = read_length(data, pos)
+        vlen, pos = read_length(data, pos)
+        name = data[pos:pos + nlen].decode('latin-1')
+        pos += nlen
+        pairs[name] = data[pos:pos + vlen].decode('latin-1')
+        pos += vlen
+    return pairs
+
+
+def encode_pairs(pairs):
+    out = b''
+    for name, value in pairs.items():
+        name, value = name.encode(), value.encode()
+        out += bytes([len(name), len(value)]) + name + value
+    return out
+
+
+def load(path):
+    mtime = os.stat(path).st_mtime
+    cached = scripts.get(path)
+    if cached and cached[0] == mtime:
+        return cached[1]
+    with open(path, 'rb') as f:
+        source = f.read()
+    code = None
+    if source.startswith(b'#!') and b'python' in source.split(b'\n', 1)[0]:
+        code = compile(source, path, 'exec')
+    scripts[path] = (mtime, code)
+    return code
+
+
+class RecordWriter(io.RawIOBase):
+    """寫入的資料以STDOUT記錄送出；deferred不為None時改為暫存，與END_REQUEST一起送出"""
+
+    def __init__(self, conn, rid):
+        self.conn = conn
+        self.rid = rid
+        self.deferred = None
+
+    def writable(self):
+        return True
+
+    def write(self, data):
+        if data and self.deferred is not None:
+            self.deferred.append(record(STDOUT, self.rid, bytes(data)))
+        elif data:
+            state['sending'] = True
+            try:
+                self.conn.sendall(record(STDOUT, self.rid, bytes(data)))
+            finally:
+                state['sending'] = False
+            if state['expired']:
+                state['expired'] = False
+                raise TimeoutError('script exceeded %d seconds' % timeout)
+        return len(data)
+
+
+def feed(conn, rid, fd):
+    """將rid的STDIN記錄寫入fd直到空記錄；腳本不再讀取（已關閉pipe）時其餘內容丟棄"""
+    try:
+        while True:
+            rtype, rec_rid, content = read_record(conn)
+            if rec_rid != rid or rtype not in (STDIN, ABORT_REQUEST):
+                continue
+            if rtype == ABORT_REQUEST or not content:
+                break
+            view = memoryview(content)
+            while fd >= 0 and view:
+                try:
+                    view = view[os.write(fd, view):]
+                except BrokenPipeError:
+                    os.close(fd)
+                    fd = -1
+    except (EOFError, OSError):
+        pass
+    finally:
+        if fd >= 0:
+            os.close(fd)
+
+
+def run(env, stdin, out):
+    path = env.get('SCRIPT_FILENAME', '')
+    code = load(path)
+    cgi_env = dict(base_env)
+    cgi_env.update(env)
+    if code is None:
+        # stdin直接接到feed寫入的pipe，stderr由執行緒讀取，主執行緒讀到輸出就轉送；逾時直接結束子程序
+        try:
+            p = subprocess.Popen([path], stdin=stdin, stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=cgi_env)
+        finally:
+            os.close(stdin)
+        errors = []
+        threads = [threading.Thread(target=lambda: errors.append(p.stderr.read()))]
+        for t in threads:
+            t.start()
+        timer = threading.Timer(timeout, p.kill) if timeout else None
+        if timer:
+            timer.start()
+        try:
+            while True:
+                chunk = p.stdout.read1(65536)
+                if not chunk:
+                    break
+                out.write(chunk)
+        finally:
+            p.stdout.close()
+            status = p.wait()
+            if timer:
+                timer.cancel()
+            for t in threads:
+                t.join()
+        return b''.join(errors), status
+
+    saved = sys.stdin, sys.stdout, sys.argv
+    sys.stdin = io.TextIOWrapper(os.fdopen(stdin, 'rb'), encoding='utf-8')
+    sys.stdout = io.TextIOWrapper(io.BufferedWriter(out, 16 * 1024), encoding='utf-8')
+    sys.argv = [path]
+    os.environ.clear()
+    os.environ.update(cgi_env)
+    err = b''
+    status = 0
+    signal.alarm(timeout)
+    try:
+        exec(code, {'__name__': '__main__', '__file__': path, '__builtins__': __builtins__})
+    except SystemExit as e:
+        status = e.code if isinstance(e.code, int) else (0 if e.code is None else 1)
+    except BaseException:
+        err = traceback.format_exc().encode()
+        status = 1
+    finally:
+        signal.alarm(0)
+        state['expired'] = False
+        stdout = sys.stdout
+        sys.stdin.close()
+        sys.stdin, sys.stdout, sys.argv = saved
+        # 腳本結束時還在緩衝區的輸出與結束碼一起送出，伺服器在送出標頭前就能知道腳本失敗
+        out.deferred = []
+        try:
+            stdout.flush()
+        except (OSError, TimeoutError):
+            pass
+        stdout.detach()
+    return err, status
+
+
+def serve(conn):
+    # 同一連線上可以有多個請求（以requestId區分），依PARAMS結束的順序執行；
+    # 執行期間由feed接收該請求的STDIN，結束後才繼續讀取其他記錄
+    requests = {}
+    while True:
+        rtype, rid, content = read_record(conn)
+        if rtype == GET_VALUES:
+            # 同一連線上的請求依序執行而非同時進行，不宣告支援多工
+            values = {'FCGI_MAX_CONNS': '1', 'FCGI_MAX_REQS': '1', 'FCGI_MPXS_CONNS': '0'}
+            conn.sendall(record(GET_VALUES_RESULT, 0, encode_pairs(values)))
+        elif rtype == BEGIN_REQUEST:
+            role, flags = struct.unpack('>HB', content[:3])
+            requests[rid] = {'flags': flags, 'params': b''}
+        elif rtype == ABORT_REQUEST:
+            requests.pop(rid, None)
+            conn.sendall(record(END_REQUEST, rid, struct.pack('>IB3x', 1, 0)))
+        elif rtype == PARAMS and rid in requests:
+            req = requests[rid]
+            if content:
+                req['params'] += content
+                continue
+            del requests[rid]
+            rfd, wfd = os.pipe()
+            feeder = threading.Thread(target=feed, args=(conn, rid, wfd))
+            feeder.start()
+            out = RecordWriter(conn, rid)
+            try:
+                err, status = run(parse_pairs(req['params']), rfd, out)
+            except OSError:
+                raise
+            except Exception:
+                err, status = traceback.format_exc().encode(), 1
+            finally:
+                feeder.join()
+            response = b''.join(out.deferred or []) + record(STDOUT, rid)
+            if err:
+                response += record(STDERR, rid, err) + record(STDERR, rid)
+            response += record(END_REQUEST, rid, struct.pack('>IB3x', status & 0xffffffff, 0))
+            conn.sendall(response)
+            if not req['flags'] & KEEP_CONN and not requests:
+                return
+        elif rtype not in (PARAMS, STDIN):
+            conn.sendall(record(UNKNOWN_TYPE, 0, bytes([rtype]) + b'\0' * 7))
+
+
+def expired(signum, frame):
+    if state['sending']:
+        state['expired'] = True
+        return
+    raise TimeoutError('script exceeded %d seconds' % timeout)
+
+
+def main():
+    signal.signal(signal.SIGALRM, expired)
+    listener = socket.socket(fileno=0)
+    while True:
+        conn, _ = listener.accept()
+        try:
+            serve(conn)
+        except (EOFError, OSError):
+            pass
+        finally:
+            conn.close()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+#include "cgi_cache.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 與cgi_cache::MAX_ENTRIES相同
+static const int MAX_ENTRIES = 1024;
+
+static shared_ptr<http_conn::cgi_result> result(const string &output){
+    shared_ptr<http_conn::cgi_result> r(new http_conn::cgi_result);
+    r->output = output;
+    return r;
+}
+
+static void store(const string &key, int ttl, int stale, const string &output){
+    cgi_cache::policy p;
+    p.ttl = ttl;
+    p.stale = stale;
+    cgi_cache::store(key, p, result(output));
+}
+
+// output為0表示不應命中
+static void check(const char *name, const string &key, const char *output, bool refresh_expect = false){
+    bool refresh = !refresh_expect;
+    shared_ptr<http_conn::cgi_result> r = cgi_cache::lookup(key, refresh);
+    if((r == 0) != (output == 0) || (r && r->output != output) || refresh != refresh_expect){
+        printf("FAIL %s: %s refresh %d\n", name, r ? r->output.c_str() : "(miss)", refresh);
+        ++failed;
+    }
+}
+
+int main(){
+    // 設定
+    cgi_cache::configure("/cgi/a", 10, 20, vector<string>(1, "accept"));
+    const cgi_cache::policy *p = cgi_cache::find("/cgi/a");
+    if(!p || p->ttl != 10 || p->stale != 20 || p->vary.size() != 1 || cgi_cache::find("/cgi/b")){
+        printf("FAIL configure\n");
+        ++failed;
+    }
+
+    // 快取鍵區分URL、標頭與訊息體，訊息體以32位元組的摘要代替
+    vector<const char *> values(1, "text/html");
+    string k = cgi_cache::key("/a", values, "body", 4);
+    vector<const char *> other(1, "text/plain");
+    if(k != cgi_cache::key("/a", values, "body", 4) || k == cgi_cache::key("/b", values, "body", 4) ||
+       k == cgi_cache::key("/a", other, "body", 4) || k == cgi_cache::key("/a", values, "bodx", 4) ||
+       k.size() != 3 + 10 + 32 || cgi_cache::key("/a", values, string(100000, 'x').data(), 100000).size() != k.size()){
+        printf("FAIL key\n");
+        ++failed;
+    }
+
+    // TTL內直接命中
+    check("miss", "fresh", 0);
+    store("fresh", 100, 0, "one");
+    check("hit", "fresh", "one");
+    store("fresh", 100, 0, "two");
+    check("replace", "fresh", "two");
+
+    // 已過期仍在stale期間：回覆舊的輸出，只有第一個請求負責更新，放棄後可再次更新
+    store("stale", 0, 100, "old");
+    check("stale first", "stale", "old", true);
+    check("stale second", "stale", "old", false);
+    cgi_cache::abandon("stale");
+    check("stale after abandon", "stale", "old", true);
+    store("stale", 100, 0, "new");
+    check("refreshed", "stale", "new");
+
+    // 超過stale期間時刪除
+    store("dead", 0, 0, "gone");
+    check("dead", "dead", 0);
+
+    // 達上限時先刪除所有超過stale期間的項目
+    int live = MAX_ENTRIES - 10 - 2;
+    for(int i = 0; i < 10; ++i){
+        store("dead" + to_string(i), 0, 0, "x");
+    }
+    for(int i = 0; i < live; ++i){
+        store("live" + to_string(i), 100, 100, "x");
+    }
+    store("evict1", 100, 100, "x");
+    for(int i = 0; i < live; ++i){
+        check("live kept", "live" + to_string(i), "x");
+    }
+    check("fresh kept", "fresh", "two");
+    check("stale kept", "stale", "new");
+    check("evict1 stored", "evict1", "x");
+
+    // 都還可使用時淘汰stale_until最早的一項
+    store("short", 50, 0, "x");
+    for(int i = 0; i < 8; ++i){
+        store("fill" + to_string(i), 100, 100, "x");
+    }
+    store("evict2", 100, 100, "x");
+    check("oldest evicted", "short", 0);
+    check("evict2 stored", "evict2", "x");
+    check("others kept", "fill0", "x");
+    check("others kept", "live0", "x");
+
+    if(failed){
+        printf("cgi_cache_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("cgi_cache_test: ok\n");
+    return 0;
+}
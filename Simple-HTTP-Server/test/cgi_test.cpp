@@ -0,0 +1,74 @@
+#include "cgi.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 以eof解析完整的輸出，比對狀態行、轉送的標頭與訊息體
+static void check(const char *name, const string &out, int status, const char *reason, const char *lines, const string &body){
+    http_conn::cgi_result piece;
+    size_t body_start = 12345;
+    bool done = cgi::parse_head(out, true, piece, body_start);
+    string got_body = body_start <= out.size() ? out.substr(body_start) : "(bad body_start)";
+    if(!done || piece.status != status || piece.reason != reason || piece.header_lines != lines || got_body != body){
+        printf("FAIL %s: done %d status %d \"%s\"\n  lines: %s\n  body: %s\n", name, done, piece.status, piece.reason.c_str(),
+               piece.header_lines.c_str(), got_body.c_str());
+        ++failed;
+    }
+}
+
+// 輸出尚未結束時，只有已能判斷的前綴才傳回true
+static void check_more(const char *name, const string &out, bool expect){
+    http_conn::cgi_result piece;
+    size_t body_start;
+    if(cgi::parse_head(out, false, piece, body_start) != expect){
+        printf("FAIL %s: expect %d\n", name, expect);
+        ++failed;
+    }
+}
+
+int main(){
+    check("content-type", "Content-Type: text/plain\r\n\r\nhello", 200, "OK", "Content-Type: text/plain\r\n", "hello");
+    check("lf only", "Content-Type: text/plain\nX-A: 1\n\nhello\n", 200, "OK", "Content-Type: text/plain\r\nX-A: 1\r\n", "hello\n");
+    check("status", "Status: 404 Not Found\r\nContent-Type: text/html\r\n\r\nmissing", 404, "Not Found",
+          "Content-Type: text/html\r\n", "missing");
+    check("status no reason", "Status: 204\r\n\r\n", 204, "", "", "");
+    check("status bad", "Status: abc\r\nContent-Type: text/plain\r\n\r\nx", 200, "OK", "Content-Type: text/plain\r\n", "x");
+
+    // 只有Location時為302，Status優先
+    check("location", "Location: /elsewhere\r\n\r\n", 302, "Found", "Location: /elsewhere\r\n", "");
+    check("location status", "Status: 301 Moved Permanently\r\nLocation: /new\r\n\r\n", 301, "Moved Permanently",
+          "Location: /new\r\n", "");
+
+    // 伺服器決定的標頭不轉送，值前後的空白去除
+    check("hop by hop", "Content-Type: text/plain\r\nConnection: close\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n"
+          "Date: x\r\nX-Keep:   kept  \r\n\r\nabc", 200, "OK", "Content-Type: text/plain\r\nX-Keep: kept\r\n", "abc");
+
+    // 不輸出標頭的腳本：整段輸出都是訊息體
+    check("no header", "<html>hello</html>\n", 200, "OK", "", "<html>hello</html>\n");
+    check("no cgi field", "X-A: 1\r\n\r\nbody", 200, "OK", "", "X-A: 1\r\n\r\nbody");
+    check("empty line first", "\r\nbody", 200, "OK", "", "\r\nbody");
+    check("empty output", "", 200, "OK", "", "");
+    check("unterminated head", "Content-Type: text/plain\r\n", 200, "OK", "", "Content-Type: text/plain\r\n");
+
+    // 超過MAX_HEAD
+    string big = "Content-Type: text/plain\r\nX-Big: " + string(cgi::MAX_HEAD, 'a') + "\r\n\r\nbody";
+    check("too large", big, 200, "OK", "", big);
+    check_more("too large partial", big.substr(0, cgi::MAX_HEAD + 1), true);
+
+    // 尚未結束的輸出
+    check_more("partial name", "Content-Ty", false);
+    check_more("partial line", "Content-Type: text/pl", false);
+    check_more("partial head", "Content-Type: text/plain\r\n", false);
+    check_more("not a name", "<html", true);
+    check_more("space in name", "Hello world", true);
+    check_more("complete", "Content-Type: text/plain\r\n\r\n", true);
+
+    if(failed){
+        printf("cgi_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("cgi_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "chunked.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 將in在split處切成兩段送入解碼器，傳回最後的狀態、輸出與處理的位元組數
+static chunked_decoder::STATUS run(const string &in, size_t split, string &out, size_t &used){
+    chunked_decoder d;
+    string buf(in);
+    out.clear();
+    used = 0;
+    chunked_decoder::STATUS s = chunked_decoder::MORE;
+    size_t pos = 0;
+    size_t ends[2] = {split, buf.size()};
+    for(int i = 0; i < 2 && s == chunked_decoder::MORE; ++i){
+        size_t consumed = 0, out_len = 0;
+        // 就地解碼：輸出寫回同一塊緩衝區
+        char *p = &buf[0] + pos;
+        s = d.decode(p, ends[i] - pos, p, consumed, out_len);
+        out.append(p, out_len);
+        pos += consumed;
+    }
+    used = pos;
+    return s;
+}
+
+// 在每個位置切開都應得到相同的結果
+static void check(const char *name, const string &in, chunked_decoder::STATUS expect, const string &body = "", size_t used_expect = 0){
+    for(size_t split = 0; split <= in.size(); ++split){
+        string out;
+        size_t used;
+        chunked_decoder::STATUS s = run(in, split, out, used);
+        if(s != expect){
+            printf("FAIL %s (split %zu): status %d, expect %d\n", name, split, s, expect);
+            ++failed;
+            return;
+        }
+        if(expect == chunked_decoder::DONE && (out != body || used != (used_expect ? used_expect : in.size()))){
+            printf("FAIL %s (split %zu): body \"%s\" used %zu\n", name, split, out.c_str(), used);
+            ++failed;
+            return;
+        }
+    }
+}
+
+int main(){
+    check("single", "5\r\nhello\r\n0\r\n\r\n", chunked_decoder::DONE, "hello");
+    check("multiple", "5\r\nhello\r\n1\r\n \r\n5\r\nworld\r\n0\r\n\r\n", chunked_decoder::DONE, "hello world");
+    check("hex", "A\r\n0123456789\r\nf\r\nabcdefghijklmno\r\n0\r\n\r\n", chunked_decoder::DONE, "0123456789abcdefghijklmno");
+    check("empty", "0\r\n\r\n", chunked_decoder::DONE, "");
+    check("extension", "5;name=value;x\r\nhello\r\n0;last\r\n\r\n", chunked_decoder::DONE, "hello");
+    check("trailer", "5\r\nhello\r\n0\r\nExpires: never\r\nX-Sum: 1\r\n\r\n", chunked_decoder::DONE, "hello");
+    check("leading zeros", "0005\r\nhello\r\n000\r\n\r\n", chunked_decoder::DONE, "hello");
+
+    // 訊息體之後屬於下一個請求的資料不被處理
+    string next = "5\r\nhello\r\n0\r\n\r\n";
+    check("pipelined", next + "GET / HTTP/1.1\r\n\r\n", chunked_decoder::DONE, "hello", next.size());
+
+    // 尚未結束
+    check("partial size", "5", chunked_decoder::MORE);
+    check("partial data", "5\r\nhel", chunked_decoder::MORE);
+    check("no last chunk", "5\r\nhello\r\n", chunked_decoder::MORE);
+    check("no final crlf", "5\r\nhello\r\n0\r\n", chunked_decoder::MORE);
+
+    // 格式錯誤
+    check("no size", "\r\nhello\r\n0\r\n\r\n", chunked_decoder::BAD);
+    check("bad digit", "5g\r\nhello\r\n0\r\n\r\n", chunked_decoder::BAD);
+    check("bad size lf", "5\rxhello\r\n0\r\n\r\n", chunked_decoder::BAD);
+    check("data too long", "5\r\nhello!\r\n0\r\n\r\n", chunked_decoder::BAD);
+    check("data no lf", "5\r\nhello\rx0\r\n\r\n", chunked_decoder::BAD);
+    check("too many digits", "1000000000000000\r\n", chunked_decoder::BAD);
+    check("15 digits ok", "00000000000000f\r\n", chunked_decoder::MORE);
+    check("line too long", "5;" + string(chunked_decoder::MAX_LINE, 'x') + "\r\nhello\r\n0\r\n\r\n", chunked_decoder::BAD);
+
+    // remaining與reset
+    chunked_decoder d;
+    char buf[] = "a\r\n01234";
+    size_t consumed, out_len;
+    if(d.decode(buf, strlen(buf), buf, consumed, out_len) != chunked_decoder::MORE || out_len != 5 || d.remaining() != 5){
+        printf("FAIL remaining: out_len %zu remaining %llu\n", out_len, d.remaining());
+        ++failed;
+    }
+    d.reset();
+    char again[] = "3\r\nabc\r\n0\r\n\r\n";
+    if(d.decode(again, strlen(again), again, consumed, out_len) != chunked_decoder::DONE || out_len != 3 || memcmp(again, "abc", 3) != 0){
+        printf("FAIL reset\n");
+        ++failed;
+    }
+
+    if(failed){
+        printf("chunked_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("chunked_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef __CONN_DRIVER_H__
+#define __CONN_DRIVER_H__
+
+#include "http_conn.h"
+#include "log.h"
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+/*
+    以socketpair驅動一條http_conn，在同一個執行緒中依序扮演主執行緒（read、write）與執行緒池（process），
+    不需要監聽埠即可檢查送出的位元組
+*/
+class conn_driver
+{
+public:
+    conn_driver() : m_conn(new http_conn), m_open(true){
+        if(http_conn::m_epollfd < 0){
+            Log::init(".", "conn_test", 0, 10000);
+            http_conn::m_epollfd = epoll_create(1);
+            http_conn::init_error_responses();
+        }
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        m_conn->init(fds[0], addr);
+        m_peer = fds[1];
+    }
+    ~conn_driver(){
+        if(m_open) m_conn->close_conn();
+        close(m_peer);
+        delete m_conn;
+    }
+
+    // 送出data並處理到沒有可處理的請求為止，傳回伺服器寫出的所有位元組
+    std::string send(const std::string &data){
+        ::send(m_peer, data.data(), data.size(), 0);
+        if(m_open && !m_conn->read()) close_conn();
+        while(m_open){
+            m_conn->process();
+            if(!m_conn->write()){
+                close_conn();
+            }else if(!m_conn->pipelined()){
+                break;
+            }
+        }
+        std::string out;
+        char buf[4096];
+        ssize_t n;
+        while((n = recv(m_peer, buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+        return out;
+    }
+
+    // 伺服器是否仍保持連線
+    bool open() const{
+        return m_open;
+    }
+
+private:
+    void close_conn(){
+        m_conn->close_conn();
+        m_open = false;
+    }
+
+private:
+    http_conn *m_conn;
+    int m_peer;
+    bool m_open;
+};
+
+#endif
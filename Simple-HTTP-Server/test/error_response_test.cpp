@@ -0,0 +1,68 @@
+#include "conn_driver.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+static const string body_400 = "Your request has bad syntax or is inherently impossible to satisfy.\n";
+static const string body_404 = "The requested file was not found on this server.\n";
+static const string body_413 = "The request is larger than the server is willing to process.\n";
+static const string body_431 = "The request header fields are larger than the server is willing to process.\n";
+
+// 去掉每個回應的Date標頭（"Date: "之後固定29個字元加上\r\n），其餘位元組應完全相同
+static string strip_date(const string &s){
+    string out;
+    size_t pos = 0, d;
+    while((d = s.find("\r\nDate: ", pos)) != string::npos){
+        out.append(s, pos, d + 2 - pos);
+        pos = d + 2 + 6 + 29 + 2;
+    }
+    out.append(s, pos, string::npos);
+    return out;
+}
+
+static void check(const char *name, const string &request, const string &expect, bool open_expect){
+    conn_driver c;
+    string got = strip_date(c.send(request));
+    if(got != expect || c.open() != open_expect){
+        printf("FAIL %s: open %d\n  got:\n%s\n  expect:\n%s\n", name, c.open(), got.c_str(), expect.c_str());
+        ++failed;
+    }
+}
+
+// max為Keep-Alive中剩餘的請求數，0表示Connection: close
+static string head(const char *status, const string &body, int max){
+    return string("HTTP/1.1 ") + status + "\r\nContent-Length: " + to_string(body.size()) + "\r\n" +
+           (max ? "Connection: keep-alive\r\nKeep-Alive: max=" + to_string(max) + "\r\n" : "Connection: close\r\n") + "\r\n";
+}
+
+int main(){
+    http_conn::m_read_buffer_limit = 4096;
+
+    // Connection與Keep-Alive依請求而定，狀態行、Content-Length與訊息體是共用的
+    check("404", "GET /missing HTTP/1.1\r\nHost: x\r\n\r\n", head("404 Not Found", body_404, 99) + body_404, true);
+    check("404 close", "GET /missing HTTP/1.1\r\nConnection: close\r\n\r\n", head("404 Not Found", body_404, 0) + body_404, false);
+    check("404 http/1.0", "GET /missing HTTP/1.0\r\n\r\n", head("404 Not Found", body_404, 0) + body_404, false);
+    // HEAD只送出標頭，Content-Length仍為訊息體的長度
+    check("404 head", "HEAD /missing HTTP/1.1\r\n\r\n", head("404 Not Found", body_404, 99), true);
+
+    // 無法繼續解析的請求回應後關閉
+    check("400", "BLAH\r\n\r\n", head("400 Bad Request", body_400, 0) + body_400, false);
+    check("431", "GET / HTTP/1.1\r\nX-Big: " + string(5000, 'a') + "\r\n\r\n",
+          head("431 Request Header Fields Too Large", body_431, 0) + body_431, false);
+    check("413", "POST /cgi HTTP/1.1\r\nContent-Length: 10000\r\n\r\n",
+          head("413 Payload Too Large", body_413, 0) + body_413, false);
+
+    // 同一批次中的多個錯誤回應各自帶有正確的Connection
+    check("batch", "GET /a HTTP/1.1\r\n\r\nHEAD /b HTTP/1.1\r\n\r\nGET /c HTTP/1.1\r\nConnection: close\r\n\r\n",
+          head("404 Not Found", body_404, 99) + body_404 + head("404 Not Found", body_404, 98) +
+          head("404 Not Found", body_404, 0) + body_404, false);
+
+    if(failed){
+        printf("error_response_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("error_response_test: ok\n");
+    return 0;
+}
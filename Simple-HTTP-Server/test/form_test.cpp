@@ -0,0 +1,117 @@
+#include "form.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 將收到的事件依序記錄成字串
+class record_handler : public form_handler
+{
+public:
+    string log;
+    virtual void on_field(const string &name, const string &value){
+        log += "field[" + name + "=" + value + "]";
+    }
+    virtual void on_file_begin(const string &name, const string &filename, const string &content_type){
+        log += "file[" + name + "," + filename + "," + content_type + "]";
+    }
+    virtual void on_file_data(const char *data, size_t len){
+        log.append(data, len);
+    }
+    virtual void on_file_end(){
+        log += "[end]";
+    }
+    virtual void on_complete(string &body){
+        log += "[complete]";
+    }
+};
+
+// 依序相鄰的檔案資料在切成不同片段時會分成多次on_file_data，記錄中直接相接，結果與切法無關
+static bool parse(const char *content_type, const string &body, size_t step, string &log){
+    record_handler *h = new record_handler;
+    form_parser parser(h);
+    bool ok = parser.init(content_type);
+    for(size_t pos = 0; ok && pos < body.size(); pos += step){
+        ok = parser.feed(body.data() + pos, min(step, body.size() - pos));
+    }
+    ok = ok && parser.finish();
+    log = h->log;
+    return ok;
+}
+
+// 以各種片段大小送入都應得到相同的結果
+static void check(const char *name, const char *content_type, const string &body, bool ok_expect, const string &expect = ""){
+    for(size_t step = 1; step <= body.size() + 1; ++step){
+        string log;
+        bool ok = parse(content_type, body, step, log);
+        if(ok != ok_expect || (ok && log != expect)){
+            printf("FAIL %s (step %zu): ok %d\n  got    %s\n  expect %s\n", name, step, ok, log.c_str(), expect.c_str());
+            ++failed;
+            return;
+        }
+    }
+}
+
+int main(){
+    const char *urlencoded = "application/x-www-form-urlencoded";
+    check("urlencoded", urlencoded, "a=1&b=hello+world&c=%41%42",
+          true, "field[a=1]field[b=hello world]field[c=AB]");
+    check("urlencoded name", urlencoded, "first+name=J%C3%BCrgen&empty=&flag",
+          true, "field[first name=J\xC3\xBCrgen]field[empty=]field[flag=]");
+    check("urlencoded empty pairs", urlencoded, "&&a=1&", true, "field[a=1]");
+    check("urlencoded charset", "application/x-www-form-urlencoded; charset=utf-8", "x=y", true, "field[x=y]");
+
+    // multipart，分隔線可能被切在任意兩個片段之間
+    const char *multipart = "multipart/form-data; boundary=----b0undary";
+    string body =
+        "preamble\r\n"
+        "------b0undary\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n"
+        "\r\n"
+        "hello\r\n"
+        "------b0undary\r\n"
+        "Content-Disposition: form-data; name=\"upload\"; filename=\"a.txt\"\r\n"
+        "Content-Type: text/plain\r\n"
+        "\r\n"
+        "line1\r\n--not-a-boundary\r\n------b0undar\r\nline3\r\n"
+        "------b0undary\r\n"
+        "Content-Disposition: form-data; name=\"empty\"\r\n"
+        "\r\n"
+        "\r\n"
+        "------b0undary--\r\n"
+        "epilogue";
+    check("multipart", multipart, body, true,
+          "field[title=hello]"
+          "file[upload,a.txt,text/plain]line1\r\n--not-a-boundary\r\n------b0undar\r\nline3[end]"
+          "field[empty=]");
+    check("multipart quoted boundary", "multipart/form-data; boundary=\"----b0undary\"", body, true,
+          "field[title=hello]"
+          "file[upload,a.txt,text/plain]line1\r\n--not-a-boundary\r\n------b0undar\r\nline3[end]"
+          "field[empty=]");
+
+    // 沒有結束分隔線
+    check("multipart truncated", multipart,
+          "------b0undary\r\nContent-Disposition: form-data; name=\"a\"\r\n\r\nvalue", false);
+
+    // 不支援的類型或缺少boundary
+    string log;
+    if(parse("text/plain", "a=1", 1, log) || parse("multipart/form-data", body, 1, log)){
+        printf("FAIL init accepted an unsupported content type\n");
+        ++failed;
+    }
+
+    // 一般欄位超過上限
+    string big = "a=" + string(form_parser::MAX_FIELD_SIZE + 1, 'x');
+    if(parse(urlencoded, big, 4096, log)){
+        printf("FAIL oversized field accepted\n");
+        ++failed;
+    }
+
+    if(failed){
+        printf("form_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("form_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "head_scanner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+using namespace std;
+
+static int failed = 0;
+
+// 逐位元組的參考實作，SIMD的結果必須與其相同
+static vector<int> index_ref(const string &s){
+    vector<int> out;
+    for(size_t i = 0; i < s.size(); ++i){
+        char c = s[i];
+        if(c == '\r' || c == '\n' || c == ' ' || c == '\t' || c == ':') out.push_back(i);
+    }
+    return out;
+}
+
+static size_t find_url_ref(const string &s){
+    for(size_t i = 0; i < s.size(); ++i){
+        char c = s[i];
+        if(c == '%' || c == '?' || c == '#' || (c == '/' && i + 1 < s.size() && (s[i + 1] == '/' || s[i + 1] == '.'))) return i;
+    }
+    return s.size();
+}
+
+// 以上限max分次掃描，每次從上次的scanned接著，合併的結果應與參考實作相同
+static void check_index(const char *name, const string &s, size_t max){
+    vector<int> got;
+    int out[64];
+    size_t pos = 0;
+    while(pos < s.size()){
+        size_t scanned = 12345;
+        size_t n = head_scanner::index(s.data() + pos, s.size() - pos, out, max, scanned);
+        if(n > max || scanned == 0 || scanned > s.size() - pos || (n < max && scanned != s.size() - pos)){
+            printf("FAIL %s (max %zu): count %zu scanned %zu at %zu\n", name, max, n, scanned, pos);
+            ++failed;
+            return;
+        }
+        for(size_t i = 0; i < n; ++i) got.push_back(out[i] + pos);
+        pos += scanned;
+    }
+    if(got != index_ref(s)){
+        printf("FAIL %s (max %zu): %zu offsets, expect %zu\n", name, max, got.size(), index_ref(s).size());
+        ++failed;
+    }
+}
+
+static void check_url(const char *name, const string &s){
+    // 從s的每個位置開始，涵蓋不同的對齊與長度
+    for(size_t i = 0; i <= s.size(); ++i){
+        string t = s.substr(i);
+        size_t got = head_scanner::find_url_special(t.c_str(), t.size());
+        if(got != find_url_ref(t)){
+            printf("FAIL %s (from %zu): %zu, expect %zu\n", name, i, got, find_url_ref(t));
+            ++failed;
+            return;
+        }
+    }
+}
+
+int main(){
+    printf("head_scanner: %s\n", head_scanner::impl_name());
+
+    string req = "GET /index.html HTTP/1.1\r\nHost: example.com\r\nUser-Agent: test\tagent\r\nAccept: */*\r\n\r\n";
+    size_t maxes[] = {1, 2, 5, 16, 64};
+    for(size_t m = 0; m < sizeof(maxes) / sizeof(maxes[0]); ++m){
+        check_index("request", req, maxes[m]);
+        check_index("no marks", string(100, 'a'), maxes[m]);
+        check_index("all marks", string(100, ':'), maxes[m]);
+    }
+    check_index("empty", "", 64);
+
+    // 隨機內容：字元集中在分隔字元附近，長度跨過16與32位元組的區塊邊界
+    const char alphabet[] = "ab:\r\n \t%/?#.";
+    srand(1);
+    for(int round = 0; round < 2000; ++round){
+        string s;
+        size_t len = rand() % 100;
+        for(size_t i = 0; i < len; ++i) s += alphabet[rand() % (sizeof(alphabet) - 1)];
+        check_index("random", s, 1 + rand() % 64);
+        check_url("random url", s);
+    }
+
+    check_url("plain", "/static/css/site.css");
+    check_url("percent", "/static/a%20b");
+    check_url("query", "/search?q=1");
+    check_url("fragment", "/page#top");
+    check_url("double slash", "/a//b");
+    check_url("dot segment", "/a/./b/../c");
+    // 緊接在結尾之前的/只能比對字串結尾的\0
+    check_url("trailing slash", "/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/");
+    check_url("long", "/" + string(70, 'x') + "/.hidden");
+
+    if(failed){
+        printf("head_scanner_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("head_scanner_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include "hpack.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+static string unhex(const char *s){
+    string out;
+    int hi = -1;
+    for(; *s; ++s){
+        int v;
+        if(*s >= '0' && *s <= '9') v = *s - '0';
+        else if(*s >= 'a' && *s <= 'f') v = *s - 'a' + 10;
+        else continue;
+        if(hi < 0) hi = v;
+        else{
+            out += (char)(hi << 4 | v);
+            hi = -1;
+        }
+    }
+    return out;
+}
+
+static string dump(const hpack::header_list &h){
+    string s;
+    for(size_t i = 0; i < h.size(); ++i){
+        s += h[i].first + ": " + h[i].second + "\n";
+    }
+    return s;
+}
+
+// 以同一個解碼器解碼一個標頭區塊（動態表延續到下一個區塊），比對結果
+static void check(hpack &dec, const char *name, const string &block, const char *expect){
+    hpack::header_list h;
+    bool ok = dec.decode((const unsigned char *)block.data(), block.size(), h);
+    if(!ok || dump(h) != expect){
+        printf("FAIL %s: ok %d\n  got:\n%s  expect:\n%s", name, ok, dump(h).c_str(), expect);
+        ++failed;
+    }
+}
+
+static void check_bad(const char *name, const string &block){
+    hpack dec;
+    hpack::header_list h;
+    if(dec.decode((const unsigned char *)block.data(), block.size(), h)){
+        printf("FAIL %s: accepted\n", name);
+        ++failed;
+    }
+}
+
+int main(){
+    // RFC 7541 C.2：單一標頭的各種表示法
+    {
+        hpack dec;
+        check(dec, "C.2.1", unhex("400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572"),
+              "custom-key: custom-header\n");
+    }
+    {
+        hpack dec;
+        check(dec, "C.2.2", unhex("040c 2f73 616d 706c 652f 7061 7468"), ":path: /sample/path\n");
+    }
+    {
+        hpack dec;
+        check(dec, "C.2.3", unhex("1008 7061 7373 776f 7264 0673 6563 7265 74"), "password: secret\n");
+    }
+    {
+        hpack dec;
+        check(dec, "C.2.4", unhex("82"), ":method: GET\n");
+    }
+
+    // RFC 7541 C.3：不使用Huffman的請求，動態表在請求之間延續
+    {
+        hpack dec;
+        check(dec, "C.3.1", unhex("8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d"),
+              ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+        check(dec, "C.3.2", unhex("8286 84be 5808 6e6f 2d63 6163 6865"),
+              ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+        check(dec, "C.3.3", unhex("8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"),
+              ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+    }
+
+    // RFC 7541 C.4：使用Huffman的相同請求
+    {
+        hpack dec;
+        check(dec, "C.4.1", unhex("8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff"),
+              ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n");
+        check(dec, "C.4.2", unhex("8286 84be 5886 a8eb 1064 9cbf"),
+              ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\ncache-control: no-cache\n");
+        check(dec, "C.4.3", unhex("8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"),
+              ":method: GET\n:scheme: https\n:path: /index.html\n:authority: www.example.com\ncustom-key: custom-value\n");
+    }
+
+    // RFC 7541 C.6：使用Huffman的回應，動態表上限256位元組（以區塊開頭的大小更新3fe101設定），會逐出舊項目
+    {
+        hpack dec;
+        check(dec, "C.6.1", unhex("3fe101"
+                                  "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 0b81 66e0 82a6"
+                                  "2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae 43d3"),
+              ":status: 302\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n");
+        check(dec, "C.6.2", unhex("4883 640e ffc1 c0bf"),
+              ":status: 307\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:21 GMT\nlocation: https://www.example.com\n");
+        check(dec, "C.6.3", unhex("88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff c05a 839b d9ab"
+                                  "77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af 2708 7f36 72c1 ab27 0fb5 291f"
+                                  "9587 3160 65c0 03ed 4ee5 b106 3d50 07"),
+              ":status: 200\ncache-control: private\ndate: Mon, 21 Oct 2013 20:13:22 GMT\nlocation: https://www.example.com\n"
+              "content-encoding: gzip\nset-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n");
+    }
+
+    // 編碼的結果可由解碼端還原
+    {
+        char buf[256];
+        int len = 0;
+        len += hpack::encode_status(buf + len, 200);
+        len += hpack::encode_status(buf + len, 404);
+        len += hpack::encode_status(buf + len, 302);
+        len += hpack::encode_header(buf + len, hpack::IDX_CONTENT_TYPE, "text/html", 9);
+        len += hpack::encode_header(buf + len, hpack::IDX_CONTENT_LENGTH, "123456", 6);
+        string location(200, 'x');
+        char big[512];
+        int big_len = hpack::encode_header(big, hpack::IDX_LOCATION, location.data(), location.size());
+        len += hpack::encode_literal(buf + len, "x-custom", 8, "value", 5);
+        hpack dec;
+        check(dec, "encode", string(buf, len),
+              ":status: 200\n:status: 404\n:status: 302\ncontent-type: text/html\ncontent-length: 123456\nx-custom: value\n");
+        check(dec, "encode long value", string(big, big_len), ("location: " + location + "\n").c_str());
+    }
+
+    // 格式錯誤
+    check_bad("index 0", unhex("80"));
+    check_bad("index out of range", unhex("ff00"));
+    check_bad("truncated string", unhex("400a 6375 7374"));
+    check_bad("huffman eos", unhex("0085 ffff ffff ff"));
+    check_bad("huffman long padding", unhex("0081 ff01 61"));
+    check_bad("table size above limit", unhex("3fe2 1f"));
+
+    if(failed){
+        printf("hpack_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("hpack_test: ok\n");
+    return 0;
+}
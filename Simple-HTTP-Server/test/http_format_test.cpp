@@ -0,0 +1,90 @@
+#include "http_format.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+using namespace std;
+
+static int failed = 0;
+
+static void check_dec(unsigned long v, const char *expect){
+    char buf[32];
+    int len = http_format::format_dec(buf, v);
+    if(len != (int)strlen(expect) || memcmp(buf, expect, len) != 0){
+        printf("FAIL format_dec %lu: expect \"%s\", got \"%.*s\"\n", v, expect, len, buf);
+        ++failed;
+    }
+}
+
+static void check_hex(unsigned long v, const char *expect){
+    char buf[32];
+    int len = http_format::format_hex(buf, v);
+    if(len != (int)strlen(expect) || memcmp(buf, expect, len) != 0){
+        printf("FAIL format_hex %lu: expect \"%s\", got \"%.*s\"\n", v, expect, len, buf);
+        ++failed;
+    }
+}
+
+int main(){
+    check_dec(0, "0");
+    check_dec(7, "7");
+    check_dec(10, "10");
+    check_dec(99, "99");
+    check_dec(100, "100");
+    check_dec(1234567, "1234567");
+    check_dec(18446744073709551615UL, "18446744073709551615");
+
+    check_hex(0, "0");
+    check_hex(10, "a");
+    check_hex(255, "ff");
+    check_hex(4096, "1000");
+    check_hex(0xdeadbeefUL, "deadbeef");
+    check_hex(18446744073709551615UL, "ffffffffffffffff");
+
+    // Date標頭：固定長度、IMF-fixdate格式，且與目前時間一致
+    char buf[http_format::DATE_HEADER_LEN + 1];
+    time_t before = time(0);
+    int len = http_format::date_header(buf);
+    time_t after = time(0);
+    buf[len] = '\0';
+    if(len != http_format::DATE_HEADER_LEN || len != 37){
+        printf("FAIL date_header: length %d\n", len);
+        ++failed;
+    }
+    if(strncmp(buf, "Date: ", 6) != 0 || strcmp(buf + len - 6, " GMT\r\n") != 0){
+        printf("FAIL date_header: \"%s\"\n", buf);
+        ++failed;
+    }
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(buf + 6, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || strcmp(end, "\r\n") != 0){
+        printf("FAIL date_header: cannot parse \"%s\"\n", buf);
+        ++failed;
+    }
+    else{
+        time_t t = timegm(&tm);
+        if(t < before || t > after){
+            printf("FAIL date_header: %ld not in [%ld, %ld]\n", (long)t, (long)before, (long)after);
+            ++failed;
+        }
+    }
+
+    // 同一秒內重複取得的結果相同
+    char again[http_format::DATE_HEADER_LEN + 1];
+    for(int i = 0; i < 3; ++i){
+        time_t now = time(0);
+        http_format::date_header(buf);
+        http_format::date_header(again);
+        if(time(0) == now && memcmp(buf, again, http_format::DATE_HEADER_LEN) != 0){
+            printf("FAIL date_header: differs within one second\n");
+            ++failed;
+        }
+    }
+
+    if(failed){
+        printf("http_format_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("http_format_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,160 @@
+#include "http_headers.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 依HEADER_ID的順序
+static const char *names[http_headers::HDR_COUNT] = {
+    "", "Connection", "Content-Length", "Host", "Transfer-Encoding", "Content-Type", "Upgrade", "Keep-Alive",
+    "If-Modified-Since", "If-None-Match", "Cookie", "User-Agent", "Accept", "Accept-Encoding", "Expect",
+    "Sec-WebSocket-Key", "Sec-WebSocket-Version", "HTTP2-Settings", "Range", "Last-Event-ID", "Authorization",
+    "Date", "Referer", "TE", "Origin", "Cache-Control", "Pragma", "Accept-Language", "If-Match",
+    "If-Unmodified-Since", "Content-Encoding", "X-Forwarded-For", "Sec-WebSocket-Protocol", "Sec-WebSocket-Extensions"};
+
+static void check_lookup(const char *name, int expect){
+    int id = http_headers::lookup(name, strlen(name));
+    if(id != expect){
+        printf("FAIL lookup %s: %d, expect %d\n", name, id, expect);
+        ++failed;
+    }
+}
+
+// 在buf中依序放入"name: value"，以偏移加入標頭表；add時會讀取名稱，base須指向目前的buf
+static void add(http_headers &h, string &buf, char *&base, const char *name, const char *value){
+    int name_off = buf.size();
+    buf += name;
+    buf += ": ";
+    int value_off = buf.size();
+    buf += value;
+    buf += '\0';
+    base = &buf[0];
+    h.add(name_off, strlen(name), value_off, strlen(value));
+}
+
+static void check_int(const char *value, bool ok_expect, long expect = 0){
+    string buf;
+    char *base = 0;
+    http_headers h;
+    h.bind(&base);
+    add(h, buf, base, "Content-Length", value);
+    long n = -1;
+    bool ok = h.get_int(http_headers::HDR_CONTENT_LENGTH, n);
+    // 第二次讀取使用保存的結果
+    long again = -1;
+    bool ok_again = h.get_int(http_headers::HDR_CONTENT_LENGTH, again);
+    if(ok != ok_expect || ok_again != ok || (ok && (n != expect || again != expect))){
+        printf("FAIL get_int \"%s\": ok %d value %ld\n", value, ok, n);
+        ++failed;
+    }
+}
+
+int main(){
+    // 已知標頭不分大小寫，且各自對應到不同的HEADER_ID
+    for(int id = 1; id < http_headers::HDR_COUNT; ++id){
+        check_lookup(names[id], id);
+        string lower(names[id]), upper(names[id]);
+        for(size_t i = 0; i < lower.size(); ++i){
+            lower[i] = tolower(lower[i]);
+            upper[i] = toupper(upper[i]);
+        }
+        check_lookup(lower.c_str(), id);
+        check_lookup(upper.c_str(), id);
+    }
+
+    // 雜湊槽位相同但名稱不同的標頭不會被誤認
+    check_lookup("", http_headers::HDR_UNKNOWN);
+    check_lookup("hxst", http_headers::HDR_UNKNOWN);
+    check_lookup("Content-Lengtx", http_headers::HDR_UNKNOWN);
+    check_lookup("Content-Lengthh", http_headers::HDR_UNKNOWN);
+    check_lookup("X-Custom", http_headers::HDR_UNKNOWN);
+    check_lookup("t", http_headers::HDR_UNKNOWN);
+
+    // 偏移相對於讀取緩衝區，緩衝區搬移後仍然有效
+    {
+        string buf;
+        char *base = 0;
+        http_headers h;
+        h.bind(&base);
+        add(h, buf, base, "Host", "example.com");
+        add(h, buf, base, "X-Custom", "one");
+        add(h, buf, base, "host", "second.example.com");
+        add(h, buf, base, "Content-Length", "42");
+        buf.reserve(buf.size() * 4);
+        base = &buf[0];
+        long n;
+        if(h.count() != 4 || strcmp(h.get(http_headers::HDR_HOST), "example.com") != 0 ||
+           strcmp(h.get("HOST"), "example.com") != 0 || strcmp(h.get("x-custom"), "one") != 0 ||
+           h.get("X-Other") != 0 || h.get(http_headers::HDR_COOKIE) != 0 ||
+           !h.get_int(http_headers::HDR_CONTENT_LENGTH, n) || n != 42 ||
+           h.name_len(2) != 4 || strncmp(h.name(2), "host", 4) != 0 || h.value_len(2) != 18){
+            printf("FAIL table\n");
+            ++failed;
+        }
+
+        // clear之後已知標頭都不存在，並可重新使用
+        h.clear();
+        buf.clear();
+        add(h, buf, base, "Cookie", "a=1");
+        if(h.count() != 1 || h.get(http_headers::HDR_HOST) != 0 || h.get(http_headers::HDR_CONTENT_LENGTH) != 0 ||
+           strcmp(h.get(http_headers::HDR_COOKIE), "a=1") != 0){
+            printf("FAIL clear\n");
+            ++failed;
+        }
+    }
+
+    // 超過MAX_HEADERS
+    {
+        string buf;
+        buf.reserve(http_headers::MAX_HEADERS * 16 + 16);
+        char *base = &buf[0];
+        http_headers h;
+        h.bind(&base);
+        for(int i = 0; i < http_headers::MAX_HEADERS; ++i){
+            add(h, buf, base, "X-A", "1");
+        }
+        if(h.add(0, 3, 5, 1) != -1 || h.count() != http_headers::MAX_HEADERS){
+            printf("FAIL max headers\n");
+            ++failed;
+        }
+    }
+
+    // get_int只接受純十進位數字
+    check_int("0", true, 0);
+    check_int("1234567890", true, 1234567890L);
+    check_int("000000000000000042", true, 42);
+    check_int("999999999999999999", true, 999999999999999999L);
+    check_int("1000000000000000000", false);
+    check_int("", false);
+    check_int("-1", false);
+    check_int("+1", false);
+    check_int("12a", false);
+    check_int("1 2", false);
+    check_int("0x10", false);
+
+    // get_date
+    {
+        string buf;
+        char *base = 0;
+        http_headers h;
+        h.bind(&base);
+        add(h, buf, base, "If-Modified-Since", "Sun, 06 Nov 1994 08:49:37 GMT");
+        add(h, buf, base, "If-Unmodified-Since", "Sunday, 06-Nov-94 08:49:37 GMT");
+        time_t t = 0;
+        if(!h.get_date(http_headers::HDR_IF_MODIFIED_SINCE, t) || t != 784111777 ||
+           h.get_date(http_headers::HDR_IF_UNMODIFIED_SINCE, t) || h.get_date(http_headers::HDR_DATE, t)){
+            printf("FAIL get_date: %ld\n", (long)t);
+            ++failed;
+        }
+    }
+
+    if(failed){
+        printf("http_headers_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("http_headers_test: ok\n");
+    return 0;
+}
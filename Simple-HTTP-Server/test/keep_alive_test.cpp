@@ -0,0 +1,71 @@
+#include "conn_driver.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 依序取出回應中每個Connection與Keep-Alive標頭，例如"keep-alive 99|close|"
+static string summary(const string &out){
+    string s;
+    size_t pos = 0;
+    while((pos = out.find("HTTP/1.1 ", pos)) != string::npos){
+        size_t end = out.find("\r\n\r\n", pos);
+        string head = out.substr(pos, end - pos);
+        size_t c = head.find("Connection: ");
+        s += c == string::npos ? "none" : head.substr(c + 12, head.find("\r\n", c) - c - 12);
+        size_t k = head.find("Keep-Alive: max=");
+        if(k != string::npos) s += " " + head.substr(k + 16, head.find("\r\n", k) - k - 16);
+        s += "|";
+        pos = end;
+    }
+    return s;
+}
+
+static void check(const char *name, conn_driver &c, const string &request, const string &expect, bool open_expect){
+    string got = summary(c.send(request));
+    if(got != expect || c.open() != open_expect){
+        printf("FAIL %s: %s open %d, expect %s open %d\n", name, got.c_str(), c.open(), expect.c_str(), open_expect);
+        ++failed;
+    }
+}
+
+static void check(const char *name, const string &request, const string &expect, bool open_expect){
+    conn_driver c;
+    check(name, c, request, expect, open_expect);
+}
+
+int main(){
+    // HTTP/1.1預設保持連線，Connection: close優先於keep-alive
+    check("http/1.1", "GET /a HTTP/1.1\r\n\r\n", "keep-alive 99|", true);
+    check("close", "GET /a HTTP/1.1\r\nConnection: close\r\n\r\n", "close|", false);
+    check("close token", "GET /a HTTP/1.1\r\nConnection: keep-alive, Close\r\n\r\n", "close|", false);
+    check("close in second header", "GET /a HTTP/1.1\r\nConnection: TE\r\nConnection: close\r\n\r\n", "close|", false);
+
+    // HTTP/1.0預設關閉，明確要求時保持連線
+    check("http/1.0", "GET /a HTTP/1.0\r\n\r\n", "close|", false);
+    check("http/1.0 keep-alive", "GET /a HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", "keep-alive 99|", true);
+
+    // 關閉連線的回應之後，同一批中的其他請求不再處理
+    check("close stops pipeline", "GET /a HTTP/1.1\r\nConnection: close\r\n\r\nGET /b HTTP/1.1\r\n\r\n", "close|", false);
+
+    // 同一連線上的請求數上限，Keep-Alive: max為剩餘的請求數，最後一個回應關閉連線
+    http_conn::m_max_keep_alive_requests = 3;
+    {
+        conn_driver c;
+        check("cap 1", c, "GET /a HTTP/1.1\r\n\r\n", "keep-alive 2|", true);
+        check("cap 2", c, "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", "keep-alive 1|", true);
+        check("cap 3", c, "GET /a HTTP/1.1\r\n\r\n", "close|", false);
+    }
+    check("cap pipelined", "GET /a HTTP/1.1\r\n\r\nGET /b HTTP/1.1\r\n\r\nGET /c HTTP/1.1\r\n\r\nGET /d HTTP/1.1\r\n\r\n",
+          "keep-alive 2|keep-alive 1|close|", false);
+    http_conn::m_max_keep_alive_requests = 1;
+    check("cap 1 request", "GET /a HTTP/1.1\r\n\r\n", "close|", false);
+
+    if(failed){
+        printf("keep_alive_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("keep_alive_test: ok\n");
+    return 0;
+}
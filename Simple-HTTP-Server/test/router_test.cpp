@@ -0,0 +1,96 @@
+#include "router.h"
+#include <stdio.h>
+#include <string.h>
+using namespace std;
+
+static int failed = 0;
+
+// http_conn::METHOD的順序
+enum { GET = 0, POST, HEAD, PUT, DELETE };
+
+// 路由表保存的是副本，以target辨識；expect為0表示沒有符合的路由
+static void check(int method, const char *path, const char *expect, size_t prefix_expect = 0){
+    size_t prefix_len = 12345;
+    const route *r = router::find(method, path, prefix_len);
+    if((r == 0) != (expect == 0) || (r && r->target != expect)){
+        printf("FAIL %d %s: got %s\n", method, path, r ? r->target.c_str() : "(none)");
+        ++failed;
+        return;
+    }
+    if(r && prefix_len != prefix_expect){
+        printf("FAIL %d %s: prefix_len %zu, expect %zu\n", method, path, prefix_len, prefix_expect);
+        ++failed;
+    }
+}
+
+int main(){
+    // 測試開始前路由表是空的
+    check(GET, "/", 0);
+
+    route root(route::STATIC, "root");
+    route api(route::CGI, "api");
+    route api_post(route::CGI, "api_post");
+    route api_v2(route::CGI, "api_v2");
+    route upload(route::UPLOAD, "upload");
+    route old(route::REDIRECT, "old", 0, 301);
+    route old2(route::REDIRECT, "old2", 0, 302);
+
+    // Allow標頭隨加入的路由更新，OPTIONS一定允許
+    if(router::allow_header() != "Allow: OPTIONS\r\n"){
+        printf("FAIL allow before routes: %s", router::allow_header().c_str());
+        ++failed;
+    }
+    router::add("/", router::M_GET | router::M_HEAD, root);
+    if(router::allow_header() != "Allow: GET, HEAD, OPTIONS\r\n"){
+        printf("FAIL allow: %s", router::allow_header().c_str());
+        ++failed;
+    }
+    // HTTP/2取methods()的子集
+    if(router::allow_value(router::methods() & ~router::M_HEAD) != "GET, OPTIONS" || router::allow_value(0) != ""){
+        printf("FAIL allow_value: %s\n", router::allow_value(router::methods()).c_str());
+        ++failed;
+    }
+    router::add("/api", router::M_GET, api);
+    router::add("/api/", router::M_POST, api_post);
+    router::add("/api/v2", router::M_ANY, api_v2);
+    router::add("/upload", router::M_PUT, upload);
+    router::add("/old", router::M_GET, old);
+    // 同一前綴與方法以後加入的為準
+    router::add("/old", router::M_GET, old2);
+
+    // 根目錄
+    check(GET, "/", "root", 0);
+    check(HEAD, "/index.html", "root", 0);
+    check(GET, "/a/b/c", "root", 0);
+
+    // 最長前綴，且只在/邊界上符合
+    check(GET, "/api", "api", 4);
+    check(GET, "/api/", "api", 4);
+    check(GET, "/api/users", "api", 4);
+    check(GET, "/apix", "root", 0);
+    check(GET, "/ap", "root", 0);
+    check(GET, "/api/v2", "api_v2", 7);
+    check(GET, "/api/v2/items", "api_v2", 7);
+    check(GET, "/api/v22", "api", 4);
+    check(DELETE, "/api/v2/items", "api_v2", 7);
+
+    // 方法遮罩：沒有該方法的路由時退回較短的前綴
+    check(POST, "/api/users", "api_post", 4);
+    check(POST, "/", 0);
+    check(POST, "/apix", 0);
+    check(HEAD, "/api/users", "root", 0);
+    check(PUT, "/upload/a.txt", "upload", 7);
+    check(PUT, "/uploads", 0);
+    check(GET, "/upload/a.txt", "root", 0);
+
+    // 重新加入的路由
+    check(GET, "/old/page", "old2", 4);
+    check(HEAD, "/old/page", "root", 0);
+
+    if(failed){
+        printf("router_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("router_test: ok\n");
+    return 0;
+}
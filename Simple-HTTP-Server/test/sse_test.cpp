@@ -0,0 +1,38 @@
+#include "sse.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+static void check(const char *name, const string &event, const string &data, const string &expect){
+    string got = *sse::encode(7, event, data);
+    if(got != expect){
+        printf("FAIL %s:\n  got:\n%s  expect:\n%s", name, got.c_str(), expect.c_str());
+        ++failed;
+    }
+}
+
+int main(){
+    check("plain", "", "hello", "id: 7\ndata: hello\n\n");
+    check("event", "tick", "now", "id: 7\nevent: tick\ndata: now\n\n");
+    check("empty data", "", "", "id: 7\ndata: \n\n");
+
+    // \r\n、\r與\n都是換行，各行成為一個data欄位
+    check("lf", "", "a\nb", "id: 7\ndata: a\ndata: b\n\n");
+    check("crlf", "", "a\r\nb", "id: 7\ndata: a\ndata: b\n\n");
+    check("cr", "", "a\rb", "id: 7\ndata: a\ndata: b\n\n");
+    check("mixed", "", "a\r\rb\n\r\nc\r", "id: 7\ndata: a\ndata: \ndata: b\ndata: \ndata: c\ndata: \n\n");
+    check("lf cr", "", "a\n\rb", "id: 7\ndata: a\ndata: \ndata: b\n\n");
+
+    // 事件名稱不能插入其他欄位
+    check("event injection", "tick\r\ndata: evil\nid: 0", "x", "id: 7\nevent: tickdata: evilid: 0\ndata: x\n\n");
+    check("event cr", "a\rb", "x", "id: 7\nevent: ab\ndata: x\n\n");
+
+    if(failed){
+        printf("sse_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("sse_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include "url.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+// 正規化in，比對結果路徑與查詢字串（expect為0表示應傳回-1）
+static void check(const char *in, const char *expect, const char *query = 0){
+    char buf[512];
+    strcpy(buf, in);
+    char *q = 0;
+    int len = url::normalize(buf, &q);
+    if(!expect){
+        if(len != -1){
+            printf("FAIL %s: expect -1, got %d \"%s\"\n", in, len, buf);
+            ++failed;
+        }
+        return;
+    }
+    if(len != (int)strlen(expect) || strcmp(buf, expect) != 0){
+        printf("FAIL %s: expect \"%s\", got %d \"%s\"\n", in, expect, len, len < 0 ? "" : buf);
+        ++failed;
+    }
+    if((query == 0) != (q == 0) || (query && strcmp(q, query) != 0)){
+        printf("FAIL %s: expect query \"%s\", got \"%s\"\n", in, query ? query : "(null)", q ? q : "(null)");
+        ++failed;
+    }
+}
+
+static void check_form(const char *in, const char *expect){
+    string s(in);
+    url::decode_form(s);
+    if(s != expect){
+        printf("FAIL decode_form %s: expect \"%s\", got \"%s\"\n", in, expect, s.c_str());
+        ++failed;
+    }
+}
+
+int main(){
+    // 不需改寫的路徑
+    check("/", "/");
+    check("/index.html", "/index.html");
+    check("/a/b/c.txt", "/a/b/c.txt");
+
+    // .與..路徑段，不會超出根目錄
+    check("/a/./b", "/a/b");
+    check("/a/../b", "/b");
+    check("/a/b/..", "/a/");
+    check("/a/b/.", "/a/b/");
+    check("/..", "/");
+    check("/../../etc/passwd", "/etc/passwd");
+    check("/a/..b/c", "/a/..b/c");
+    check("/a/.b", "/a/.b");
+
+    // 連續的/
+    check("//a///b", "/a/b");
+
+    // 百分比解碼，%2F視為路徑分隔，解碼後的.與..同樣移除
+    check("/%41%62c", "/Abc");
+    check("/a%2Fb", "/a/b");
+    check("/a%2fb", "/a/b");
+    check("/%2e%2e/%2E%2E/etc", "/etc");
+    check("/..%2F..%2Fetc%2Fpasswd", "/etc/passwd");
+    check("/a/b%2F..%2F..%2F..%2Fc", "/c");
+    check("/a%20b", "/a b");
+
+    // 格式錯誤的%編碼與%00
+    check("/a%00b", 0);
+    check("/a%zz", 0);
+    check("/a%4", 0);
+    check("/a%", 0);
+
+    // 查詢字串與片段
+    check("/a?x=1&y=%41", "/a", "x=1&y=%41");
+    check("/a/../b?q", "/b", "q");
+    check("/a#frag", "/a");
+    check("/a?x=1#frag", "/a", "x=1");
+    check("/a?", "/a", "");
+
+    // 特殊字元出現在較長路徑的後段
+    check("/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/bbbb/../c",
+          "/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa/c");
+    check("/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa?q=1",
+          "/aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "q=1");
+
+    // 表單欄位解碼
+    check_form("a+b", "a b");
+    check_form("%41%62%63", "Abc");
+    check_form("100%25", "100%");
+    check_form("x%zz%4", "x%zz%4");
+    check_form("%E4%B8%AD", "\xE4\xB8\xAD");
+
+    if(failed){
+        printf("url_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("url_test: ok\n");
+    return 0;
+}
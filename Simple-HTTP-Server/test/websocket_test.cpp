@@ -0,0 +1,125 @@
+#include "conn_driver.h"
+#include "websocket.h"
+#include <stdio.h>
+#include <string>
+using namespace std;
+
+static int failed = 0;
+
+class echo_handler : public websocket_handler
+{
+public:
+    virtual void on_message(const websocket_conn &ws, int opcode, const string &message){
+        websocket::send(ws, opcode, message);
+    }
+};
+
+static void check_utf8(const char *name, const string &s, bool expect){
+    if(websocket::valid_utf8(s.data(), s.size()) != expect){
+        printf("FAIL utf8 %s: expect %d\n", name, expect);
+        ++failed;
+    }
+}
+
+// 客戶端訊框必須遮罩
+static string client_frame(int opcode, const string &payload, bool fin = true){
+    string f;
+    f += (char)((fin ? 0x80 : 0) | opcode);
+    f += (char)(0x80 | payload.size());
+    const char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    f.append(mask, 4);
+    for(size_t i = 0; i < payload.size(); ++i) f += payload[i] ^ mask[i % 4];
+    return f;
+}
+
+static string close_payload(int code, const string &reason = ""){
+    string p;
+    p += (char)(code >> 8);
+    p += (char)code;
+    return p + reason;
+}
+
+// 握手後送出frames，比對伺服器送出的訊框
+static void check_frames(const char *name, const string &frames, const string &expect){
+    conn_driver c;
+    string accept = c.send("GET /ws HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                           "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+    if(accept.find("HTTP/1.1 101 ") != 0){
+        printf("FAIL %s: handshake\n%s\n", name, accept.c_str());
+        ++failed;
+        return;
+    }
+    string got = c.send(frames);
+    if(got != expect){
+        printf("FAIL %s: got %zu bytes, expect %zu\n", name, got.size(), expect.size());
+        ++failed;
+    }
+}
+
+static string server_close(int code){
+    return string("\x88\x02", 2) + close_payload(code);
+}
+
+int main(){
+    // 狀態碼
+    int valid[] = {1000, 1001, 1002, 1003, 1007, 1008, 1009, 1010, 1011, 1012, 1013, 1014, 3000, 3999, 4000, 4999};
+    int invalid[] = {0, 999, 1004, 1005, 1006, 1015, 1016, 1100, 2000, 2999, 5000, 65535};
+    for(size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); ++i){
+        if(!websocket::valid_close_code(valid[i])){
+            printf("FAIL close code %d rejected\n", valid[i]);
+            ++failed;
+        }
+    }
+    for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i){
+        if(websocket::valid_close_code(invalid[i])){
+            printf("FAIL close code %d accepted\n", invalid[i]);
+            ++failed;
+        }
+    }
+
+    // UTF-8
+    check_utf8("empty", "", true);
+    check_utf8("ascii", "hello", true);
+    check_utf8("2 bytes", "\xc2\xa9", true);
+    check_utf8("3 bytes", "\xe4\xb8\xad\xe6\x96\x87", true);
+    check_utf8("4 bytes", "\xf0\x9f\x98\x80", true);
+    check_utf8("max", "\xf4\x8f\xbf\xbf", true);
+    check_utf8("before surrogates", "\xed\x9f\xbf", true);
+    check_utf8("after surrogates", "\xee\x80\x80", true);
+    check_utf8("continuation first", "\x80", false);
+    check_utf8("overlong 2", "\xc0\xaf", false);
+    check_utf8("overlong 3", "\xe0\x80\xaf", false);
+    check_utf8("overlong 4", "\xf0\x80\x80\xaf", false);
+    check_utf8("surrogate", "\xed\xa0\x80", false);
+    check_utf8("above max", "\xf4\x90\x80\x80", false);
+    check_utf8("f5", "\xf5\x80\x80\x80", false);
+    check_utf8("truncated", "\xe4\xb8", false);
+    check_utf8("bad continuation", "\xe4\x28\xad", false);
+    check_utf8("bad last continuation", "\xf0\x9f\x98\x28", false);
+    check_utf8("ff", "a\xff", false);
+
+    // 連線上的CLOSE與TEXT
+    static echo_handler echo;
+    websocket::add_handler("/ws", &echo);
+    check_frames("close 1000", client_frame(websocket::CLOSE, close_payload(1000, "bye")), server_close(1000));
+    check_frames("close 4000", client_frame(websocket::CLOSE, close_payload(4000)), server_close(4000));
+    check_frames("close empty", client_frame(websocket::CLOSE, ""), server_close(1000));
+    check_frames("close 1 byte", client_frame(websocket::CLOSE, "\x03"), server_close(1002));
+    check_frames("close 1005", client_frame(websocket::CLOSE, close_payload(1005)), server_close(1002));
+    check_frames("close 999", client_frame(websocket::CLOSE, close_payload(999)), server_close(1002));
+    check_frames("close 5000", client_frame(websocket::CLOSE, close_payload(5000)), server_close(1002));
+    check_frames("close bad reason", client_frame(websocket::CLOSE, close_payload(1000, "\xff")), server_close(1007));
+    check_frames("text", client_frame(websocket::TEXT, "h\xc3\xa9"), string("\x81\x03h\xc3\xa9", 5));
+    check_frames("text bad", client_frame(websocket::TEXT, "h\xc3"), server_close(1007));
+    // 合法的字元可以被切在兩個訊框之間
+    check_frames("text fragmented", client_frame(websocket::TEXT, "h\xc3", false) + client_frame(websocket::CONTINUATION, "\xa9"),
+                 string("\x81\x03h\xc3\xa9", 5));
+    check_frames("binary", client_frame(websocket::BINARY, "\xff"), string("\x82\x01\xff", 3));
+
+    if(failed){
+        printf("websocket_test: %d failed\n", failed);
+        return 1;
+    }
+    printf("websocket_test: ok\n");
+    return 0;
+}